@@ -0,0 +1,182 @@
+﻿#include "ConvolutionEngine.h"
+#include "common.h"
+#include "ThreadPool.h"
+
+const float ConvolutionEngine::TOLERANCE = 1e-4f;
+
+ConvolutionEngine::ConvolutionEngine() {
+	grid_size = 0;
+	cell_length = 0.0f;
+	dist_max = 0.0f;
+	decay = 0.0f;
+	weight = 0.0f;
+	window_size = 0;
+	dft_size = 0;
+	initialized = false;
+}
+
+/**
+ * カーネルをセットする。パラメータが前回と同じなら、何もしない。
+ *
+ * @param grid_size		グリッドの一辺のサイズ
+ * @param cell_length	セルの一辺の距離 [m]
+ * @param dist_max		値が広がる最大距離 [m]
+ * @param decay			距離に対する減衰係数
+ * @param weight		カーネル全体に掛ける係数
+ * @return				カーネルが変更されたらtrue
+ */
+bool ConvolutionEngine::setKernel(int grid_size, float cell_length, float dist_max, float decay, float weight) {
+	if (initialized && this->grid_size == grid_size && this->cell_length == cell_length && this->dist_max == dist_max && this->decay == decay && this->weight == weight) return false;
+
+	this->grid_size = grid_size;
+	this->cell_length = cell_length;
+	this->dist_max = dist_max;
+	this->decay = decay;
+	this->weight = weight;
+	initialized = true;
+
+	// グリッドの外に出るタップは寄与しないので、窓はグリッドサイズまでに制限する
+	window_size = std::min((int)(dist_max / cell_length + 0.5f), grid_size - 1);
+
+	int n = window_size * 2 + 1;
+	kernel = cv::Mat_<float>(n, n);
+	for (int dr = -window_size; dr <= window_size; ++dr) {
+		for (int dc = -window_size; dc <= window_size; ++dc) {
+			double dist = sqrt(SQR(dc * cell_length) + SQR(dr * cell_length));
+			kernel(dr + window_size, dc + window_size) = (float)(weight * exp(-decay * dist));
+		}
+	}
+
+	// スペクトルは、FFTが初めて必要になった時に計算する
+	kernel_spectrum = cv::Mat();
+	dft_size = 0;
+
+	return true;
+}
+
+/**
+ * dst = src * kernel を計算する。
+ * グリッドの外は0として扱う。
+ */
+void ConvolutionEngine::apply(const cv::Mat_<float>& src, cv::Mat_<float>& dst) {
+	if (preferFFT(cv::countNonZero(src))) {
+		applyFFT(src, dst);
+	} else {
+		applyDirect(src, dst);
+	}
+}
+
+/**
+ * dst += src * kernel を計算する。
+ * srcは変化量なので、負の値も許容する。
+ */
+void ConvolutionEngine::accumulate(const cv::Mat_<float>& src, cv::Mat_<float>& dst) {
+	int nonzeros = cv::countNonZero(src);
+	if (nonzeros == 0) return;
+
+	if (preferFFT(nonzeros)) {
+		cv::Mat_<float> out;
+		convolveFFT(src, out);
+		dst += out;
+	} else {
+		scatter(src, dst);
+	}
+}
+
+/**
+ * FFTを使って、畳み込みを計算する。
+ */
+void ConvolutionEngine::applyFFT(const cv::Mat_<float>& src, cv::Mat_<float>& dst) {
+	convolveFFT(src, dst);
+}
+
+/**
+ * 各セルの値を周辺セルに足し込む直接法で、畳み込みを計算する。
+ */
+void ConvolutionEngine::applyDirect(const cv::Mat_<float>& src, cv::Mat_<float>& dst) {
+	dst = cv::Mat_<float>::zeros(grid_size, grid_size);
+	scatter(src, dst);
+}
+
+/**
+ * 0でないセルの数から、FFTと直接法のどちらが速いかを見積もる。
+ */
+bool ConvolutionEngine::preferFFT(int nonzeros) const {
+	int n = window_size * 2 + 1;
+	double direct_cost = (double)nonzeros * n * n;
+
+	int m = cv::getOptimalDFTSize(grid_size + window_size);
+	double fft_cost = 5.0 * m * m * log((double)m) / log(2.0);
+
+	return direct_cost > fft_cost;
+}
+
+/**
+ * 0でないセルの値を、周辺セルに足し込む。
+ * 出力の行のタイルごとに並列に計算するため、出力の各セルが、影響を与えるセルから値を集める形で計算する。
+ * 各出力セルへの足し込みは、ソースの行優先の順に行うので、1つずつ足し込む元の方法と結果は一致する。
+ */
+void ConvolutionEngine::scatter(const cv::Mat_<float>& src, cv::Mat_<float>& dst) {
+	// 各行の0でないセルの列番号
+	std::vector<std::vector<int> > nonzeros(grid_size);
+	ThreadPool::forEachTile(grid_size, grid_size, [&](int tile, int r0, int r1) {
+		for (int r = r0; r < r1; ++r) {
+			for (int c = 0; c < grid_size; ++c) {
+				if (src(r, c) != 0.0f) nonzeros[r].push_back(c);
+			}
+		}
+	});
+
+	ThreadPool::forEachTile(grid_size, grid_size, [&](int tile, int r0, int r1) {
+		for (int ro = r0; ro < r1; ++ro) {
+			float* d = dst[ro];
+
+			int rs0 = std::max(0, ro - window_size);
+			int rs1 = std::min(grid_size - 1, ro + window_size);
+			for (int r = rs0; r <= rs1; ++r) {
+				const float* k = kernel[ro - r + window_size] + window_size;
+				const float* s = src[r];
+				const std::vector<int>& cols = nonzeros[r];
+				for (int i = 0; i < cols.size(); ++i) {
+					int c = cols[i];
+					float v = s[c];
+
+					int dc0 = std::max(-window_size, -c);
+					int dc1 = std::min(window_size, grid_size - 1 - c);
+					for (int dc = dc0; dc <= dc1; ++dc) {
+						d[c + dc] += v * k[dc];
+					}
+				}
+			}
+		}
+	});
+}
+
+/**
+ * out = src * kernel をFFTで計算する。
+ */
+void ConvolutionEngine::convolveFFT(const cv::Mat_<float>& src, cv::Mat_<float>& out) {
+	if (kernel_spectrum.empty()) {
+		// 巡回畳み込みが線形畳み込みと一致するよう、grid_size + W 以上にパディングする
+		dft_size = cv::getOptimalDFTSize(grid_size + window_size);
+
+		// カーネルの中心を(0, 0)に置き、負のオフセットは反対側に折り返す
+		cv::Mat_<float> padded = cv::Mat_<float>::zeros(dft_size, dft_size);
+		for (int dr = -window_size; dr <= window_size; ++dr) {
+			for (int dc = -window_size; dc <= window_size; ++dc) {
+				padded((dr + dft_size) % dft_size, (dc + dft_size) % dft_size) = kernel(dr + window_size, dc + window_size);
+			}
+		}
+		cv::dft(padded, kernel_spectrum);
+	}
+
+	cv::Mat_<float> padded = cv::Mat_<float>::zeros(dft_size, dft_size);
+	src.copyTo(padded(cv::Rect(0, 0, grid_size, grid_size)));
+
+	cv::Mat spectrum;
+	cv::dft(padded, spectrum, 0, grid_size);
+	cv::mulSpectrums(spectrum, kernel_spectrum, spectrum, 0);
+	cv::dft(spectrum, padded, cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT, grid_size);
+
+	padded(cv::Rect(0, 0, grid_size, grid_size)).copyTo(out);
+}
@@ -0,0 +1,47 @@
+﻿#pragma once
+
+#include <opencv/cv.h>
+
+/**
+ * 指数減衰カーネル weight * exp(-decay * dist) を使って、各セルの値を周辺セルに広げる畳み込みエンジン。
+ * 周辺人口、周辺商業、汚染度の計算に使用する。
+ *
+ * カーネルは (grid_size, cell_length, dist_max, decay, weight) が変わった時だけ再計算し、
+ * そのスペクトルをキャッシュしておく。値が0でないセルが少ない場合は直接法、
+ * 多い場合はFFTで O(N^2 log N) で計算する。
+ *
+ * FFTの結果は、直接法（元のscatterループ）との差の最大値が、
+ * 出力の最大値の TOLERANCE 倍以内に収まる。
+ */
+class ConvolutionEngine {
+public:
+	static const float TOLERANCE;
+
+private:
+	int grid_size;
+	float cell_length;
+	float dist_max;
+	float decay;
+	float weight;
+	int window_size;
+	cv::Mat_<float> kernel;			// (2W+1)x(2W+1)のカーネル
+	cv::Mat kernel_spectrum;		// FFT用に、パディングしたカーネルのスペクトル
+	int dft_size;
+	bool initialized;
+
+public:
+	ConvolutionEngine();
+
+	bool setKernel(int grid_size, float cell_length, float dist_max, float decay, float weight);
+	int windowSize() const { return window_size; }
+
+	void apply(const cv::Mat_<float>& src, cv::Mat_<float>& dst);
+	void accumulate(const cv::Mat_<float>& src, cv::Mat_<float>& dst);
+	void applyFFT(const cv::Mat_<float>& src, cv::Mat_<float>& dst);
+	void applyDirect(const cv::Mat_<float>& src, cv::Mat_<float>& dst);
+
+private:
+	bool preferFFT(int nonzeros) const;
+	void scatter(const cv::Mat_<float>& src, cv::Mat_<float>& dst);
+	void convolveFFT(const cv::Mat_<float>& src, cv::Mat_<float>& out);
+};
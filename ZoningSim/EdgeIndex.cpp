@@ -0,0 +1,105 @@
+﻿#include "EdgeIndex.h"
+
+EdgeIndex::EdgeIndex(float cell_size) {
+	this->cell_size = cell_size;
+	min_x = min_y = std::numeric_limits<int>::max();
+	max_x = max_y = std::numeric_limits<int>::min();
+	stale = false;
+}
+
+/**
+ * インデックスを、道路グラフに合わせる。後から追加されたエッジだけを登録する。
+ * invalidate()された場合や、エッジが減った場合は、作り直す。
+ */
+void EdgeIndex::sync(const RoadGraph& roads) {
+	const int num_edges = boost::num_edges(roads.graph);
+	if (stale || num_edges < edges.size()) {
+		rebuild(roads);
+		return;
+	}
+	if (num_edges == edges.size()) return;
+
+	// boost::add_edge()は、エッジのリストの末尾に追加するので、最後に登録したエッジの後ろが新しいエッジ
+	RoadEdgeIter ei, eend;
+	boost::tie(ei, eend) = boost::edges(roads.graph);
+	if (!edges.empty()) {
+		ei = last_edge;
+		++ei;
+	}
+	for (; ei != eend; ++ei) {
+		int id = edges.size();
+		edges.push_back(*ei);
+		polylines.push_back(roads.graph[*ei]->polyline);
+		ids.insert((*ei).get_property(), id);
+		insertEdge(id);
+		last_edge = ei;
+	}
+}
+
+/**
+ * 全てのエッジを登録し直す。
+ */
+void EdgeIndex::rebuild(const RoadGraph& roads) {
+	buckets.clear();
+	edges.clear();
+	polylines.clear();
+	ids.clear();
+	min_x = min_y = std::numeric_limits<int>::max();
+	max_x = max_y = std::numeric_limits<int>::min();
+	stale = false;
+
+	const int num_edges = boost::num_edges(roads.graph);
+	edges.reserve(num_edges);
+	polylines.reserve(num_edges);
+	sync(roads);
+}
+
+/**
+ * エッジのポリラインが変わったので、登録し直す。
+ */
+void EdgeIndex::update(const RoadGraph& roads, RoadEdgeDesc e) {
+	sync(roads);
+
+	int id = ids.value(e.get_property(), -1);
+	if (id < 0) return;
+
+	removeEdge(id);
+	polylines[id] = roads.graph[e]->polyline;
+	insertEdge(id);
+}
+
+/**
+ * エッジの各線分を、通過する全てのセルに登録する。
+ */
+void EdgeIndex::insertEdge(int id) {
+	const Polyline2D& polyline = polylines[id];
+	for (int i = 0; i + 1 < polyline.size(); ++i) {
+		Entry entry = { id, i };
+		cover(polyline[i], polyline[i + 1], [&](int x, int y) {
+			buckets[key(x, y)].push_back(entry);
+			min_x = std::min(min_x, x);
+			min_y = std::min(min_y, y);
+			max_x = std::max(max_x, x);
+			max_y = std::max(max_y, y);
+		});
+	}
+}
+
+/**
+ * エッジの各線分を、セルから削除する。
+ */
+void EdgeIndex::removeEdge(int id) {
+	const Polyline2D& polyline = polylines[id];
+	for (int i = 0; i + 1 < polyline.size(); ++i) {
+		cover(polyline[i], polyline[i + 1], [&](int x, int y) {
+			std::vector<Entry>& bucket = buckets[key(x, y)];
+			for (int k = 0; k < bucket.size(); ) {
+				if (bucket[k].edge == id) {
+					bucket.erase(bucket.begin() + k);
+				} else {
+					++k;
+				}
+			}
+		});
+	}
+}
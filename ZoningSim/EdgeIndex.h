@@ -0,0 +1,223 @@
+﻿#pragma once
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <QHash>
+#include <QVector2D>
+#include "RoadGraph.h"
+#include "Polyline2D.h"
+#include "Util.h"
+
+/**
+ * エッジのポリラインの線分の空間インデックス（一様なハッシュグリッド）。
+ * 各線分は、通過する全てのセルに登録する。最近傍のエッジ、半径内のエッジ、線分と交差するエッジを、
+ * 全エッジを走査せずに求める。
+ *
+ * エッジには、登録した順（boost::edges()の順）に番号を振る。結果が同じ距離のエッジは、番号が小さい方を優先し、
+ * 複数のエッジを返す場合も番号順に並べるので、全エッジを順に走査した場合と同じ結果になる。
+ *
+ * エッジは、無効になってもインデックスから削除しない。各クエリのfilterで、valid等をチェックすること。
+ * GraphUtil::addEdge()、setPolyline()、moveEdge()、moveVertex()は、インデックスを更新する（splitEdge()はaddEdge()を使う）。
+ * それ以外の方法で追加されたエッジは、sync()で追加される。ポリラインを直接書き換えた場合は、update()を呼ぶか、
+ * invalidate()を呼ぶと、次のsync()で作り直す。
+ */
+class EdgeIndex {
+private:
+	struct Entry {
+		int edge;		// エッジの番号
+		int segment;	// ポリラインの線分の番号
+	};
+
+	float cell_size;
+	QHash<qint64, std::vector<Entry> > buckets;
+	std::vector<RoadEdgeDesc> edges;		// 番号 -> エッジ
+	std::vector<Polyline2D> polylines;		// 各エッジの、インデックスに登録したポリライン
+	QHash<const void*, int> ids;			// エッジ -> 番号
+	RoadEdgeIter last_edge;					// 最後に登録したエッジ（新しいエッジは、この後ろに追加される）
+	int min_x, min_y, max_x, max_y;			// 線分が存在するセルの範囲
+	bool stale;
+
+public:
+	EdgeIndex(float cell_size = 100.0f);
+
+	void sync(const RoadGraph& roads);
+	void rebuild(const RoadGraph& roads);
+	void invalidate() { stale = true; }
+	void update(const RoadGraph& roads, RoadEdgeDesc e);
+	int size() const { return edges.size(); }
+	int id(RoadEdgeDesc e) const { return ids.value(e.get_property(), -1); }
+
+	/**
+	 * filter(e)がtrueのエッジのうち、ptに最も近いエッジを探す。
+	 *
+	 * @param max_dist	探索する最大距離（この距離ちょうどのエッジも含む）
+	 * @param dist		見つかったエッジまでの距離
+	 * @return			見つかったらtrue
+	 */
+	template<class Filter>
+	bool nearest(const QVector2D& pt, float max_dist, Filter filter, RoadEdgeDesc& desc, float& dist) const {
+		float best = max_dist;
+		int best_id = -1;
+		int rejected = -1;		// 直前にfilterで除外したエッジ（同じエッジの線分が続くので、filterを呼び直さない）
+
+		const int cx = cell(pt.x());
+		const int cy = cell(pt.y());
+		for (int r = 0; !outside(cx, cy, r); ++r) {
+			// リングrのセルだけを通る線分は、少なくとも (r - 1) * cell_size 離れている
+			float bound = std::max(0, r - 1) * cell_size;
+			if (bound > best) break;
+
+			visitRing(cx, cy, r, [&](const Entry& entry) {
+				if (entry.edge == rejected) return;
+				const Polyline2D& polyline = polylines[entry.edge];
+				QVector2D closestPt;
+				float d = Util::pointSegmentDistanceXY(polyline[entry.segment], polyline[entry.segment + 1], pt, closestPt);
+				if (d > best || (d == best && best_id >= 0 && entry.edge > best_id)) return;
+				if (entry.edge != best_id && !filter(edges[entry.edge])) {
+					rejected = entry.edge;
+					return;
+				}
+				best = d;
+				best_id = entry.edge;
+			});
+		}
+
+		if (best_id < 0) return false;
+		desc = edges[best_id];
+		dist = best;
+		return true;
+	}
+
+	/**
+	 * filter(e)がtrueのエッジのうち、ptから半径radius以内（境界を含む）のエッジを、番号順に返却する。
+	 */
+	template<class Filter>
+	std::vector<RoadEdgeDesc> withinRadius(const QVector2D& pt, float radius, Filter filter) const {
+		std::vector<int> found;
+
+		for (int y = std::max(min_y, cell(pt.y() - radius)); y <= std::min(max_y, cell(pt.y() + radius)); ++y) {
+			for (int x = std::max(min_x, cell(pt.x() - radius)); x <= std::min(max_x, cell(pt.x() + radius)); ++x) {
+				visitCell(x, y, [&](const Entry& entry) {
+					const Polyline2D& polyline = polylines[entry.edge];
+					QVector2D closestPt;
+					if (Util::pointSegmentDistanceXY(polyline[entry.segment], polyline[entry.segment + 1], pt, closestPt) <= radius) found.push_back(entry.edge);
+				});
+			}
+		}
+
+		return toEdges(found, filter);
+	}
+
+	/**
+	 * filter(e)がtrueのエッジのうち、ポリラインのいずれかの線分と交差するエッジを、番号順に返却する。
+	 * 交差の判定は、GraphUtil::isIntersect()と同じく、Util::segmentSegmentIntersectXY()を使う。
+	 */
+	template<class Filter>
+	std::vector<RoadEdgeDesc> crossing(const Polyline2D& polyline, Filter filter) const {
+		std::vector<int> found;
+
+		for (int i = 0; i + 1 < polyline.size(); ++i) {
+			const QVector2D& a = polyline[i];
+			const QVector2D& b = polyline[i + 1];
+			cover(a, b, [&](int x, int y) {
+				if (x < min_x || x > max_x || y < min_y || y > max_y) return;
+				visitCell(x, y, [&](const Entry& entry) {
+					const Polyline2D& polyline2 = polylines[entry.edge];
+					float tab, tcd;
+					QVector2D intPoint;
+					if (Util::segmentSegmentIntersectXY(polyline2[entry.segment], polyline2[entry.segment + 1], a, b, &tab, &tcd, true, intPoint)) found.push_back(entry.edge);
+				});
+			});
+		}
+
+		return toEdges(found, filter);
+	}
+
+private:
+	int cell(float x) const { return (int)floor(x / cell_size); }
+	static qint64 key(int x, int y) { return ((qint64)x << 32) | (unsigned int)y; }
+
+	void insertEdge(int id);
+	void removeEdge(int id);
+
+	/**
+	 * 線分abが通過する全てのセルについて、func(x, y)を呼ぶ。
+	 * 行ごとに、その行の範囲にある部分のx座標の範囲を求める（境界上の点は、両側のセルに含める）。
+	 */
+	template<class F>
+	void cover(const QVector2D& a, const QVector2D& b, F func) const {
+		const float margin = cell_size * 1e-4f;
+		const int y0 = cell(std::min(a.y(), b.y()) - margin);
+		const int y1 = cell(std::max(a.y(), b.y()) + margin);
+
+		for (int y = y0; y <= y1; ++y) {
+			float lo = std::min(a.x(), b.x());
+			float hi = std::max(a.x(), b.x());
+			if (a.y() != b.y()) {
+				// この行の範囲 [y * cell_size, (y + 1) * cell_size] にある部分を求める
+				float t0 = (y * cell_size - a.y()) / (b.y() - a.y());
+				float t1 = ((y + 1) * cell_size - a.y()) / (b.y() - a.y());
+				if (t0 > t1) std::swap(t0, t1);
+				t0 = std::max(0.0f, t0);
+				t1 = std::min(1.0f, t1);
+				float x0 = a.x() + (b.x() - a.x()) * t0;
+				float x1 = a.x() + (b.x() - a.x()) * t1;
+				lo = std::max(lo, std::min(x0, x1));
+				hi = std::min(hi, std::max(x0, x1));
+			}
+
+			for (int x = cell(lo - margin); x <= cell(hi + margin); ++x) {
+				func(x, y);
+			}
+		}
+	}
+
+	/**
+	 * (cx, cy)からチェビシェフ距離rのセルにある、全ての線分についてfunc(entry)を呼ぶ。
+	 */
+	template<class F>
+	void visitRing(int cx, int cy, int r, F func) const {
+		for (int y = cy - r; y <= cy + r; ++y) {
+			if (y < min_y || y > max_y) continue;
+			int step = (y == cy - r || y == cy + r) ? 1 : 2 * r;
+			for (int x = cx - r; x <= cx + r; x += std::max(step, 1)) {
+				if (x < min_x || x > max_x) continue;
+				visitCell(x, y, func);
+			}
+		}
+	}
+
+	template<class F>
+	void visitCell(int x, int y, F func) const {
+		QHash<qint64, std::vector<Entry> >::const_iterator it = buckets.constFind(key(x, y));
+		if (it == buckets.constEnd()) return;
+		const std::vector<Entry>& bucket = it.value();
+		for (int i = 0; i < bucket.size(); ++i) {
+			func(bucket[i]);
+		}
+	}
+
+	/**
+	 * リングrが、線分が存在するセルの範囲を全て超えたか。
+	 */
+	bool outside(int cx, int cy, int r) const {
+		return edges.empty() || (cx - r < min_x && cx + r > max_x && cy - r < min_y && cy + r > max_y);
+	}
+
+	/**
+	 * エッジの番号のリストから重複を除き、filter(e)がtrueのエッジを番号順に返却する。
+	 */
+	template<class Filter>
+	std::vector<RoadEdgeDesc> toEdges(std::vector<int>& found, Filter filter) const {
+		std::sort(found.begin(), found.end());
+		found.erase(std::unique(found.begin(), found.end()), found.end());
+
+		std::vector<RoadEdgeDesc> ret;
+		for (int i = 0; i < found.size(); ++i) {
+			if (filter(edges[found[i]])) ret.push_back(edges[found[i]]);
+		}
+		return ret;
+	}
+};
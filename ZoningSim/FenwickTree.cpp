@@ -0,0 +1,98 @@
+﻿#include "FenwickTree.h"
+
+FenwickTree::FenwickTree() {
+	init(0);
+}
+
+FenwickTree::FenwickTree(int n) {
+	init(n);
+}
+
+/**
+ * n個の要素を、全て重み0で初期化する。
+ */
+void FenwickTree::init(int n) {
+	tree.assign(n + 1, 0.0);
+	weights.assign(n, 0.0);
+
+	mask = 1;
+	while (mask * 2 <= n) mask *= 2;
+}
+
+/**
+ * 全要素の重みをまとめてセットする。O(n)で構築できる。
+ */
+void FenwickTree::build(const std::vector<double>& weights) {
+	init(weights.size());
+	this->weights = weights;
+
+	for (int i = 1; i < tree.size(); ++i) {
+		tree[i] += weights[i - 1];
+		int parent = i + (i & -i);
+		if (parent < tree.size()) tree[parent] += tree[i];
+	}
+}
+
+/**
+ * i番目の要素の重みをwにする。
+ */
+void FenwickTree::set(int i, double w) {
+	add(i, w - weights[i]);
+}
+
+/**
+ * i番目の要素の重みにdwを加える。
+ */
+void FenwickTree::add(int i, double dw) {
+	if (dw == 0.0) return;
+
+	weights[i] += dw;
+	for (int j = i + 1; j < tree.size(); j += j & -j) {
+		tree[j] += dw;
+	}
+}
+
+/**
+ * 0番目からi番目までの要素の重みの和を返却する。
+ */
+double FenwickTree::prefixSum(int i) const {
+	double sum = 0.0;
+	for (int j = i + 1; j > 0; j -= j & -j) {
+		sum += tree[j];
+	}
+	return sum;
+}
+
+/**
+ * 全要素の重みの和を返却する。
+ */
+double FenwickTree::total() const {
+	return prefixSum(weights.size() - 1);
+}
+
+/**
+ * 累積重みがuを超える最初の要素を返却する。
+ * uを[0, total())の一様乱数にすれば、重みに比例した確率で要素をサンプリングできる。
+ * 重みが0の要素は選ばれない。全ての重みが0の場合は、-1を返却する。
+ */
+int FenwickTree::sample(double u) const {
+	if (weights.size() == 0 || total() <= 0.0) return -1;
+
+	int pos = 0;
+	for (int step = mask; step > 0; step >>= 1) {
+		int next = pos + step;
+		if (next < tree.size() && tree[next] <= u) {
+			pos = next;
+			u -= tree[next];
+		}
+	}
+
+	// 丸め誤差で末尾を越えたり、重み0の要素に当たった場合は、手前の重みのある要素を返す
+	if (pos >= weights.size()) pos = weights.size() - 1;
+	while (pos > 0 && weights[pos] <= 0.0) pos--;
+	if (weights[pos] <= 0.0) {
+		while (pos < weights.size() && weights[pos] <= 0.0) pos++;
+	}
+
+	return pos;
+}
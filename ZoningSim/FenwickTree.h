@@ -0,0 +1,31 @@
+﻿#pragma once
+
+#include <vector>
+
+/**
+ * 非負の重みを持つ要素の集合から、重みに比例した確率で要素をサンプリングするためのFenwick木。
+ * 重みの更新とサンプリングは、どちらもO(log n)で行える。
+ *
+ * 人・仕事を配置する際の、セルの空き容量（×魅力度）のインデックスとして使用する。
+ */
+class FenwickTree {
+private:
+	std::vector<double> tree;		// 1-indexedのFenwick木
+	std::vector<double> weights;	// 各要素の現在の重み
+	int mask;						// サンプリング時の二分探索の開始ビット
+
+public:
+	FenwickTree();
+	FenwickTree(int n);
+
+	void init(int n);
+	void build(const std::vector<double>& weights);
+	int size() const { return weights.size(); }
+
+	void set(int i, double w);
+	void add(int i, double dw);
+	double get(int i) const { return weights[i]; }
+	double prefixSum(int i) const;
+	double total() const;
+	int sample(double u) const;
+};
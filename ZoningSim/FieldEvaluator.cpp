@@ -0,0 +1,85 @@
+﻿#include "FieldEvaluator.h"
+#include "SimdKernels.h"
+#include "ThreadPool.h"
+
+const int FieldEvaluator::BLOCK_SIZE = 256;
+
+/**
+ * 地価と効用を計算する。
+ * 全てのフィールドは、同じサイズで、連続したメモリ（isContinuous()）であること。
+ * 出力は、サイズが同じならバッファを再利用する。
+ * 係数が0の項は、最初に取り除いておく（0を足しても結果は変わらないので、全ての項を足した場合と一致する）。
+ *
+ * @param params			コンパイル済みの重み
+ * @param max_landvalue		地価の上限
+ * @param max_utility		効用の指数から引く値（桁あふれを防ぐため）
+ * @param inputs			入力フィールド（INPUT_LANDVALUEのスロットは使用しない）
+ * @param landValue			地価の出力先（OUTPUT_LANDVALUEを指定しない場合は、効用の入力として読むだけ）
+ * @param utilities			生活・店・工場の指標の出力先
+ * @param outputs			計算する出力（OUTPUT_xxxのOR）
+ */
+void FieldEvaluator::evaluate(const ZoningParams& params, float max_landvalue, float max_utility, const cv::Mat_<float>* inputs[ZoningParams::NUM_INPUTS], cv::Mat_<float>& landValue, cv::Mat_<float>* utilities[ZoningParams::NUM_UTILITIES], int outputs) {
+	const int rows = inputs[ZoningParams::INPUT_ACCESSIBILITY]->rows;
+	const int cols = inputs[ZoningParams::INPUT_ACCESSIBILITY]->cols;
+
+	if (outputs & OUTPUT_LANDVALUE) landValue.create(rows, cols);
+	for (int k = 0; k < ZoningParams::NUM_UTILITIES; ++k) {
+		if (outputs & utilityOutput(k)) utilities[k]->create(rows, cols);
+	}
+
+	const float* in[ZoningParams::NUM_INPUTS];
+	for (int i = 0; i < ZoningParams::NUM_INPUTS; ++i) {
+		in[i] = i == ZoningParams::INPUT_LANDVALUE ? landValue[0] : (*inputs[i])[0];
+	}
+	float* lv = landValue[0];
+
+	// 係数が0でない項のリスト
+	std::vector<Term> landValueTerms;
+	for (int i = 0; i < ZoningParams::NUM_INPUTS; ++i) {
+		if (i == ZoningParams::INPUT_LANDVALUE || params.landvalue[i] == 0.0f) continue;
+		Term term = { in[i], params.landvalue[i] };
+		landValueTerms.push_back(term);
+	}
+	std::vector<int> active;
+	std::vector<std::vector<Term> > utilityTerms;
+	for (int k = 0; k < ZoningParams::NUM_UTILITIES; ++k) {
+		if (!(outputs & utilityOutput(k))) continue;
+
+		active.push_back(k);
+		utilityTerms.push_back(std::vector<Term>());
+		for (int i = 0; i < ZoningParams::NUM_INPUTS; ++i) {
+			if (params.utility[i][k] == 0.0f) continue;
+			Term term = { in[i], params.utility[i][k] };
+			utilityTerms.back().push_back(term);
+		}
+	}
+
+	// タイルごとに並列に計算する。各セルの計算は独立なので、結果はタイルの分け方によらない
+	ThreadPool::forEachTile(rows, cols, [&](int tile, int r0, int r1) {
+		std::vector<float> acc(BLOCK_SIZE);
+
+		for (int begin = r0 * cols; begin < r1 * cols; begin += BLOCK_SIZE) {
+			const int n = std::min(BLOCK_SIZE, r1 * cols - begin);
+
+			// 地価
+			if (outputs & OUTPUT_LANDVALUE) {
+				for (int j = 0; j < n; ++j) acc[j] = 0.0f;
+				for (int i = 0; i < landValueTerms.size(); ++i) {
+					SimdKernels::axpy(&acc[0], landValueTerms[i].x + begin, landValueTerms[i].w, n);
+				}
+				SimdKernels::clamp(&acc[0], 0.0f, max_landvalue, n);
+				std::copy(acc.begin(), acc.begin() + n, lv + begin);
+			}
+
+			// 効用（地価も入力の1つ）
+			for (int a = 0; a < active.size(); ++a) {
+				const std::vector<Term>& terms = utilityTerms[a];
+				for (int j = 0; j < n; ++j) acc[j] = 0.0f;
+				for (int i = 0; i < terms.size(); ++i) {
+					SimdKernels::axpy(&acc[0], terms[i].x + begin, terms[i].w, n);
+				}
+				SimdKernels::expShift((*utilities[active[a]])[0] + begin, &acc[0], max_utility, n);
+			}
+		}
+	});
+}
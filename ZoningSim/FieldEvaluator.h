@@ -0,0 +1,35 @@
+﻿#pragma once
+
+#include <opencv/cv.h>
+#include "ZoningParams.h"
+
+/**
+ * 地価と、生活・店・工場の指標を、グリッド全体に対して1回の走査でまとめて計算する。
+ *
+ * 9個の入力フィールドをN×9のブロック（structure of arrays）とみなし、
+ * 9×4の係数行列（地価 + 3つの効用）との積を、キャッシュに収まるブロックごとに計算してから、expをとる。
+ * 地価は効用の入力でもあるので、ブロックごとに先に地価を計算し、それを使って効用を計算する。
+ * グリッドはThreadPoolのタイルに分け、タイルごとに並列に計算する。
+ * 加算の順序は、updateLandValue()、utilityValue()と同じにしてあるので、地価は一致する。
+ * 積和とexpはSimdKernelsで計算するので、効用はexpの近似の分（数ulp）だけ異なる。
+ */
+class FieldEvaluator {
+public:
+	static const int BLOCK_SIZE;
+
+	// 計算する出力
+	static enum { OUTPUT_LANDVALUE = 1, OUTPUT_LIFE = 2, OUTPUT_SHOP = 4, OUTPUT_FACTORY = 8, OUTPUT_ALL = 15 };
+
+private:
+	struct Term {
+		const float* x;
+		float w;
+	};
+
+public:
+	static void evaluate(const ZoningParams& params, float max_landvalue, float max_utility, const cv::Mat_<float>* inputs[ZoningParams::NUM_INPUTS], cv::Mat_<float>& landValue, cv::Mat_<float>* utilities[ZoningParams::NUM_UTILITIES], int outputs = OUTPUT_ALL);
+	static int utilityOutput(int utility) { return OUTPUT_LIFE << utility; }
+
+private:
+	FieldEvaluator() {}
+};
@@ -0,0 +1,66 @@
+﻿#include "FieldTracker.h"
+
+FieldTracker::FieldTracker() {
+	for (int i = 0; i < MAX_FIELDS; ++i) {
+		versions[i] = 0;
+		dependencies[i] = 0;
+		valid[i] = false;
+		for (int j = 0; j < MAX_FIELDS; ++j) {
+			seen[i][j] = 0;
+		}
+	}
+}
+
+/**
+ * フィールドが書き換えられたことを記録する。
+ */
+void FieldTracker::touch(int field) {
+	versions[field]++;
+}
+
+/**
+ * 派生フィールドが依存するフィールドをセットする。依存関係が変わった場合は、計算し直す必要があるとみなす。
+ *
+ * @param field		派生フィールド
+ * @param inputs	依存するフィールド（1 << FIELD_xxxのOR）
+ */
+void FieldTracker::setDependencies(int field, unsigned int inputs) {
+	if (dependencies[field] != inputs) valid[field] = false;
+	dependencies[field] = inputs;
+}
+
+/**
+ * 派生フィールドを計算し直す必要があるか。
+ */
+bool FieldTracker::isDirty(int field) const {
+	if (!valid[field]) return true;
+
+	for (int i = 0; i < MAX_FIELDS; ++i) {
+		if ((dependencies[field] & (1u << i)) && seen[field][i] != versions[i]) return true;
+	}
+	return false;
+}
+
+/**
+ * 派生フィールドを計算したことを記録する。依存フィールドの現在の版番号を記録し、自身の版番号を進める。
+ */
+void FieldTracker::markComputed(int field) {
+	for (int i = 0; i < MAX_FIELDS; ++i) {
+		if (dependencies[field] & (1u << i)) seen[field][i] = versions[i];
+	}
+	valid[field] = true;
+	versions[field]++;
+}
+
+/**
+ * 次回、必ず計算し直すようにする。
+ */
+void FieldTracker::invalidate(int field) {
+	valid[field] = false;
+}
+
+void FieldTracker::invalidateAll() {
+	for (int i = 0; i < MAX_FIELDS; ++i) {
+		valid[i] = false;
+	}
+}
@@ -0,0 +1,34 @@
+﻿#pragma once
+
+/**
+ * フィールドの版番号と依存関係を管理し、派生フィールドを計算し直す必要があるかを判定する。
+ *
+ * フィールドを書き換えたらtouch()で版番号を進める。派生フィールドを計算したらmarkComputed()を呼ぶと、
+ * その時点の依存フィールドの版番号を記録し、派生フィールド自身の版番号を進める。
+ * isDirty()は、依存フィールドのどれかの版番号が、記録した時から変わっていればtrueを返す。
+ *
+ * フィールドの番号は、StepScheduler::FIELD_xxxを使う。依存関係は、係数が0でない入力だけにしておけば、
+ * 係数が0の入力が変化しても計算し直さない。
+ */
+class FieldTracker {
+public:
+	static const int MAX_FIELDS = 32;
+
+private:
+	unsigned int versions[MAX_FIELDS];
+	unsigned int dependencies[MAX_FIELDS];		// 各フィールドが依存するフィールド（ビットマスク）
+	unsigned int seen[MAX_FIELDS][MAX_FIELDS];	// 計算した時の、依存フィールドの版番号
+	bool valid[MAX_FIELDS];						// 一度でも計算したか
+
+public:
+	FieldTracker();
+
+	void touch(int field);
+	unsigned int version(int field) const { return versions[field]; }
+	void setDependencies(int field, unsigned int inputs);
+	unsigned int dependsOn(int field) const { return dependencies[field]; }
+	bool isDirty(int field) const;
+	void markComputed(int field);
+	void invalidate(int field);
+	void invalidateAll();
+};
@@ -8,61 +8,11 @@ GLWidget3D::GLWidget3D(MainWindow* mainWin) : QGLWidget(QGLFormat(QGL::SampleBuf
 	this->mainWin = mainWin;
 	camera.dz = 1000;
 
-	// 重みを適当にセットする
-	QMap<QString, float> weights;
-	weights["highway_accessibility"] = 30.0f;			// セル内のhighway長が、アクセシビリティに与える影響度
-	weights["avenue_accessibility"] = 30.0f;			// セル内のavenue長が、アクセシビリティに与える影響度
-	weights["street_accessibility"] = 3.0f;			// セル内のlocal street長が、アクセシビリティに与える影響度
-
-	weights["population_neighbor"] = 0.15f;				// 人口が、周辺人口に与える影響
-	weights["distance_neighbor_population"] = 0.005f;	// 周辺人口を計算する際の、距離に対する係数
-	weights["commercial_neighbor"] = 0.15f;				// 店が、周辺商業に与える影響
-	weights["distance_neighbor_commercial"] = 0.004f;	// 周辺商業を計算する際の、距離に対する係数
-	weights["industrial_pollution"] = 0.2f;				// 工場が、汚染度に与える影響
-	weights["distance_pollution"] = 0.003f;				// 工場からの距離が、汚染度に与える影響
-
-	weights["accessibility_landvalue"] = 450.0f;		// アクセシビリティが、地価に与える影響度
-	weights["neighbor_population_landvalue"] = 100.0f;	// 周辺人口が、地価に与える影響度
-	weights["neighbor_commercial_landvalue"] = 300.0f;	// 周辺商業が、地価に与える影響度
-	weights["pollution_landvalue"] = -350.0f;			// 汚染度が、地価に与える影響度
-	weights["slope_landvalue"] = -100.0f;				// 地面傾斜が、地価に与える影響度
-	weights["population_landvalue"] = 200.0f;			// 人口が、地価に与える影響度
-	weights["commercialjobs_landvalue"] = 200.0f;		// 商業の仕事量が、地価に与える影響度
-	weights["industrialjobs_landvalue"] = 200.0f;		// 工業の仕事量が、地価に与える影響度
-
-	weights["accessibility_life"] = 0.6f;				// アクセシビリティが、良い生活に与える影響度
-	weights["neighbor_population_life"] = 0.0f;			// 周辺人口が、良い生活に与える影響度
-	weights["neighbor_commercial_life"] = 0.6f;			// 周辺商業が、良い生活に与える影響度
-	weights["pollution_life"] = -1.0f;					// 汚染度が、良い生活に与える影響度
-	weights["slope_life"] = -0.1f;						// 地面傾斜が、良い生活に与える影響度
-	weights["landvalue_life"] = -0.1f;					// 地価が、良い生活に与える影響度
-	weights["population_life"] = 0.0f;					// 人口が、良い生活に与える影響度
-	weights["commercialjobs_life"] = 0.05f;				// 商業の仕事量が、良い生活に与える影響度
-	weights["industrialjobs_life"] = -1.0f;				// 工業の仕事量が、良い生活に与える影響度
-
-	weights["accessibility_shop"] = 0.5f;				// アクセシビリティが、店に与える影響度
-	weights["neighbor_population_shop"] = 0.8f;			// 周辺人口が、店に与える影響度
-	weights["neighbor_commercial_shop"] = 0.0f;			// 周辺商業が、店に与える影響度
-	weights["pollution_shop"] = -0.1f;					// 汚染度が、店に与える影響度
-	weights["slope_shop"] = 0.0f;						// 地面傾斜が、店に与える影響度
-	weights["landvalue_shop"] = 0.2f;					// 地価が、店に与える影響度
-	weights["population_shop"] = 0.0f;					// 人口が、店に与える影響度
-	weights["commercialjobs_shop"] = 0.0f;				// 商業の仕事量が、店に与える影響度
-	weights["industrialjobs_shop"] = 0.0f;				// 工業の仕事量が、店に与える影響度
-
-	weights["accessibility_factory"] = 0.1f;			// アクセシビリティが、工場に与える影響度
-	weights["neighbor_population_factory"] = -0.2f;		// 周辺人口が、工場に与える影響度
-	weights["neighbor_commercial_factory"] = 0.0f;		// 周辺商業が、工場に与える影響度
-	weights["pollution_factory"] = 0.7f;				// 汚染度が、工場に与える影響度
-	weights["slope_factory"] = 0.0f;					// 地面傾斜が、工場に与える影響度
-	weights["landvalue_factory"] = -0.1f;				// 地価が、工場に与える影響度
-	weights["population_factory"] = -1.0f;				// 人口が、工場に与える影響度
-	weights["commercialjobs_factory"] = 0.0f;			// 商業の仕事量が、工場に与える影響度
-	weights["industrialjobs_factory"] = 0.0f;			// 工業の仕事量が、工場に与える影響度
-
-	zoning = new Zoning(9000, 60, weights);
+	zoning = new Zoning(9000, 60, Zoning::defaultWeights());
 	//zoning = new Zoning(1200, 8, weights);
-	loadRoads("osm/lafayette.gsm");
+	if (!loadRoads("osm/lafayette.gsm")) {
+		std::cerr << "Warning: osm/lafayette.gsm could not be loaded." << std::endl;
+	}
 }
 
 /**
@@ -273,7 +223,12 @@ void GLWidget3D::drawScene() {
 	glEnd();
 }
 
-void GLWidget3D::loadRoads(const QString& filename) {
-	GraphUtil::loadRoads(roads, filename);
+/**
+ * 道路を読み込む。読み込めなかった場合は、今の道路とゾーニングをそのまま残して、falseを返す。
+ */
+bool GLWidget3D::loadRoads(const QString& filename) {
+	if (!GraphUtil::loadRoads(roads, filename)) return false;
+
 	zoning->setRoads(roads);
+	return true;
 }
\ No newline at end of file
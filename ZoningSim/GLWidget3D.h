@@ -22,7 +22,7 @@ public:
 public:
 	GLWidget3D(MainWindow *parent);
 	void drawScene();
-	void loadRoads(const QString& filename);
+	bool loadRoads(const QString& filename);
 
 protected:
 	void initializeGL();
@@ -1,7 +1,9 @@
 ﻿#include "GraphUtil.h"
 #include <time.h>
+#include <set>
 #include <QList>
 #include <QSet>
+#include <QFile>
 #include <QDebug>
 #include <boost/geometry.hpp>
 #include <boost/geometry/geometries/point_xy.hpp>
@@ -30,6 +32,11 @@ int GraphUtil::getNumVertices(RoadGraph& roads, bool onlyValidVertex) {
 }
 
 int GraphUtil::getNumVertices(RoadGraph& roads, const QVector2D& pos, float radius) {
+	VertexIndex* index = getVertexIndex(roads);
+	if (index != NULL) {
+		return index->withinRadius(pos, radius, [&](RoadVertexDesc v) { return roads.graph[v]->valid; }).size();
+	}
+
 	float radius2 = radius * radius;
 
 	int count = 0;
@@ -104,6 +111,12 @@ RoadVertexDesc GraphUtil::getVertex(RoadGraph& roads, const QVector2D& pt, bool
 	RoadVertexDesc nearest_desc;
 	float min_dist = std::numeric_limits<float>::max();
 
+	VertexIndex* index = getVertexIndex(roads);
+	if (index != NULL) {
+		index->nearest(pt, min_dist, [&](RoadVertexDesc v) { return !onlyValidVertex || roads.graph[v]->valid; }, nearest_desc);
+		return nearest_desc;
+	}
+
 	RoadVertexIter vi, vend;
 	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
 		if (onlyValidVertex && !roads.graph[*vi]->valid) continue;
@@ -125,6 +138,12 @@ RoadVertexDesc GraphUtil::getVertex(RoadGraph& roads, const QVector2D& pt, RoadV
 	RoadVertexDesc nearest_desc;
 	float min_dist = std::numeric_limits<float>::max();
 
+	VertexIndex* index = getVertexIndex(roads);
+	if (index != NULL) {
+		index->nearest(pt, min_dist, [&](RoadVertexDesc v) { return v != ignore && (!onlyValidVertex || roads.graph[v]->valid); }, nearest_desc);
+		return nearest_desc;
+	}
+
 	RoadVertexIter vi, vend;
 	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
 		if (*vi == ignore) continue;
@@ -148,6 +167,16 @@ RoadVertexDesc GraphUtil::getVertex(RoadGraph& roads, const QVector2D& pt, float
 	RoadVertexDesc nearest_desc;
 	float min_dist = std::numeric_limits<float>::max();
 
+	VertexIndex* index = getVertexIndex(roads);
+	if (index != NULL) {
+		index->nearest(pt, min_dist, [&](RoadVertexDesc v) {
+			if (onlyValidVertex && !roads.graph[v]->valid) return false;
+			QVector2D vec = roads.graph[v]->getPt() - pt;
+			return Util::diffAngle(angle, atan2f(vec.y(), vec.x())) <= angle_threshold;
+		}, nearest_desc);
+		return nearest_desc;
+	}
+
 	RoadVertexIter vi, vend;
 	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
 		if (onlyValidVertex && !roads.graph[*vi]->valid) continue;
@@ -175,6 +204,22 @@ bool GraphUtil::getVertex(RoadGraph& roads, RoadVertexDesc srcDesc, float distan
 	float min_dist = distance_threshold * distance_threshold;
 	bool found = false;;
 
+	VertexIndex* index = getVertexIndex(roads);
+	if (index != NULL) {
+		const QVector2D& pt = roads.graph[srcDesc]->pt;
+		RoadVertexDesc desc;
+		bool ret = index->nearest(pt, distance_threshold, [&](RoadVertexDesc v) {
+			if (onlyValidVertex && !roads.graph[v]->valid) return false;
+			if (v == srcDesc) return false;
+			QVector2D vec = roads.graph[v]->getPt() - pt;
+			return Util::diffAngle(angle, atan2f(vec.y(), vec.x())) <= angle_threshold;
+		}, desc);
+		if (!ret || (roads.graph[desc]->pt - pt).lengthSquared() >= min_dist) return false;
+
+		nearest_desc = desc;
+		return true;
+	}
+
 	RoadVertexIter vi, vend;
 	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
 		if (onlyValidVertex && !roads.graph[*vi]->valid) continue;
@@ -202,6 +247,12 @@ bool GraphUtil::getVertex(RoadGraph& roads, RoadVertexDesc srcDesc, float distan
 bool GraphUtil::getVertex(RoadGraph& roads, const QVector2D& pos, float threshold, RoadVertexDesc& desc, bool onlyValidVertex) {
 	float min_dist = std::numeric_limits<float>::max();
 
+	VertexIndex* index = getVertexIndex(roads);
+	if (index != NULL) {
+		if (!index->nearest(pos, min_dist, [&](RoadVertexDesc v) { return !onlyValidVertex || roads.graph[v]->valid; }, desc)) return false;
+		return (roads.graph[desc]->pt - pos).lengthSquared() <= threshold * threshold;
+	}
+
 	RoadVertexIter vi, vend;
 	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
 		if (onlyValidVertex && !roads.graph[*vi]->valid) continue;
@@ -232,6 +283,12 @@ bool GraphUtil::getVertex(RoadGraph& roads, RoadVertexDesc v, float threshold, R
 bool GraphUtil::getVertex(RoadGraph& roads, const QVector2D& pos, float threshold, RoadVertexDesc ignore, RoadVertexDesc& desc, bool onlyValidVertex) {
 	float min_dist = std::numeric_limits<float>::max();
 
+	VertexIndex* index = getVertexIndex(roads);
+	if (index != NULL) {
+		if (!index->nearest(pos, min_dist, [&](RoadVertexDesc v) { return v != ignore && (!onlyValidVertex || roads.graph[v]->valid); }, desc)) return false;
+		return (roads.graph[desc]->pt - pos).lengthSquared() <= threshold * threshold;
+	}
+
 	RoadVertexIter vi, vend;
 	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
 		if (onlyValidVertex && !roads.graph[*vi]->valid) continue;
@@ -268,6 +325,12 @@ bool GraphUtil::getVertex2(RoadGraph& roads, const QVector2D& pos, float thresho
 		}
 	}
 
+	VertexIndex* index = getVertexIndex(roads);
+	if (index != NULL) {
+		if (!index->nearest(pos, min_dist, [&](RoadVertexDesc v) { return v != ignore && !neighbors.contains(v) && (!onlyValidVertex || roads.graph[v]->valid); }, desc)) return false;
+		return (roads.graph[desc]->pt - pos).lengthSquared() <= threshold * threshold;
+	}
+
 	RoadVertexIter vi, vend;
 	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
 		if (onlyValidVertex && !roads.graph[*vi]->valid) continue;
@@ -293,6 +356,12 @@ bool GraphUtil::getVertexInArea(RoadGraph &roads, const QVector2D &pos, const BB
 	bool found = false;
 	float min_dist = std::numeric_limits<float>::max();
 
+	VertexIndex* index = getVertexIndex(roads);
+	if (index != NULL) {
+		if (!area.contains(pos)) return false;
+		return index->nearest(pos, min_dist, [&](RoadVertexDesc v) { return roads.graph[v]->valid; }, desc);
+	}
+
 	RoadVertexIter vi, vend;
 	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
 		if (!roads.graph[*vi]->valid) continue;
@@ -318,6 +387,7 @@ RoadVertexDesc GraphUtil::addVertex(RoadGraph& roads, RoadVertexPtr v) {
 	//RoadVertexPtr new_v = RoadVertexPtr(new RoadVertex(*v));
 	RoadVertexDesc new_v_desc = boost::add_vertex(roads.graph);
 	roads.graph[new_v_desc] = v;
+	if (roads.vertexIndex) roads.vertexIndex->sync(roads);
 
 	roads.setModified();
 
@@ -341,11 +411,12 @@ void GraphUtil::moveVertex(RoadGraph& roads, RoadVertexDesc v, const QVector2D&
 
 		movePolyline(roads, polyline, roads.graph[tgt]->pt, pt);
 
-		roads.graph[*ei]->polyline = polyline;
+		setPolyline(roads, *ei, polyline);
 	}
 
 	// Move the vertex
 	roads.graph[v]->pt = pt;
+	if (roads.vertexIndex) roads.vertexIndex->move(v, pt);
 
 	roads.setModified();
 }
@@ -366,6 +437,24 @@ int GraphUtil::getDegree(RoadGraph& roads, RoadVertexDesc v, bool onlyValidEdge)
 	}
 }
 
+/**
+ * Return the degrees of all the vertices, indexed by the vertex desc.
+ * A loop edge is counted twice, as in getDegree().
+ */
+std::vector<int> GraphUtil::getDegrees(RoadGraph& roads, bool onlyValidEdge) {
+	std::vector<int> ret(boost::num_vertices(roads.graph), 0);
+
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ++ei) {
+		if (onlyValidEdge && !roads.graph[*ei]->valid) continue;
+
+		ret[boost::source(*ei, roads.graph)]++;
+		ret[boost::target(*ei, roads.graph)]++;
+	}
+
+	return ret;
+}
+
 /**
  * Return the list of vertices.
  */
@@ -382,6 +471,28 @@ std::vector<RoadVertexDesc> GraphUtil::getVertices(RoadGraph* roads, bool onlyVa
 	return ret;
 }
 
+/**
+ * Return the list of vertices within the radius from the specified point, in the order of their IDs.
+ */
+std::vector<RoadVertexDesc> GraphUtil::getVertices(RoadGraph& roads, const QVector2D& pt, float radius, bool onlyValidVertex) {
+	VertexIndex* index = getVertexIndex(roads);
+	if (index != NULL) {
+		return index->withinRadius(pt, radius, [&](RoadVertexDesc v) { return !onlyValidVertex || roads.graph[v]->valid; });
+	}
+
+	std::vector<RoadVertexDesc> ret;
+	float radius2 = radius * radius;
+
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
+		if (onlyValidVertex && !roads.graph[*vi]->valid) continue;
+
+		if ((roads.graph[*vi]->pt - pt).lengthSquared() <= radius2) ret.push_back(*vi);
+	}
+
+	return ret;
+}
+
 /**
  * Remove the isolated vertices.
  * Note that this function does not change neither the vertex desc nor the edge desc.
@@ -475,6 +586,12 @@ float GraphUtil::getDensity(RoadGraph& roads, const QVector2D& pos, float radius
 
 	int count = 0;
 
+	VertexIndex* index = getVertexIndex(roads);
+	if (index != NULL) {
+		count = index->withinRadius(pos, radius, [&](RoadVertexDesc v) { return roads.graph[v]->valid; }).size();
+		return (float)count / radius2 / M_PI;
+	}
+
 	RoadVertexIter vi, vend;
 	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
 		if (!roads.graph[*vi]->valid) continue;
@@ -572,6 +689,97 @@ void GraphUtil::setVertexType(RoadGraph &roads) {
 	}
 }
 
+/**
+ * Build the spatial index of the vertices. The vertex proximity queries use it until clearVertexIndex() is called.
+ * addVertex() and moveVertex() keep it up to date, and vertices added in other ways are indexed on the next query.
+ */
+void GraphUtil::buildVertexIndex(RoadGraph& roads, float cell_size) {
+	roads.vertexIndex = boost::shared_ptr<VertexIndex>(new VertexIndex(cell_size));
+	roads.vertexIndex->rebuild(roads);
+}
+
+void GraphUtil::clearVertexIndex(RoadGraph& roads) {
+	roads.vertexIndex.reset();
+}
+
+/**
+ * Return the spatial index of the vertices after bringing it up to date, or NULL if the graph has no index.
+ */
+VertexIndex* GraphUtil::getVertexIndex(RoadGraph& roads) {
+	if (!roads.vertexIndex) return NULL;
+
+	roads.vertexIndex->sync(roads);
+	return roads.vertexIndex.get();
+}
+
+/**
+ * Return the k vertices closest to the specified point, in the order of the distance.
+ */
+std::vector<RoadVertexDesc> GraphUtil::getNearestVertices(RoadGraph& roads, const QVector2D& pt, int k, bool onlyValidVertex) {
+	VertexIndex* index = getVertexIndex(roads);
+	if (index != NULL) {
+		return index->kNearest(pt, k, [&](RoadVertexDesc v) { return !onlyValidVertex || roads.graph[v]->valid; });
+	}
+
+	std::vector<std::pair<float, RoadVertexDesc> > candidates;
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
+		if (onlyValidVertex && !roads.graph[*vi]->valid) continue;
+
+		candidates.push_back(std::make_pair((roads.graph[*vi]->pt - pt).lengthSquared(), *vi));
+	}
+	std::sort(candidates.begin(), candidates.end());
+
+	std::vector<RoadVertexDesc> ret;
+	for (int i = 0; i < candidates.size() && i < k; ++i) {
+		ret.push_back(candidates[i].second);
+	}
+	return ret;
+}
+
+/**
+ * Build the spatial index of the edge segments. The edge proximity and intersection queries use it until clearEdgeIndex() is called.
+ * addEdge(), moveEdge() and moveVertex() keep it up to date, and edges added in other ways are indexed on the next query.
+ */
+void GraphUtil::buildEdgeIndex(RoadGraph& roads, float cell_size) {
+	roads.edgeIndex = boost::shared_ptr<EdgeIndex>(new EdgeIndex(cell_size));
+	roads.edgeIndex->rebuild(roads);
+}
+
+void GraphUtil::clearEdgeIndex(RoadGraph& roads) {
+	roads.edgeIndex.reset();
+}
+
+/**
+ * Return the spatial index of the edge segments after bringing it up to date, or NULL if the graph has no index.
+ */
+EdgeIndex* GraphUtil::getEdgeIndex(RoadGraph& roads) {
+	if (!roads.edgeIndex) return NULL;
+
+	roads.edgeIndex->sync(roads);
+	return roads.edgeIndex.get();
+}
+
+/**
+ * Return the edges within the specified distance from the point, in the order of boost::edges().
+ */
+std::vector<RoadEdgeDesc> GraphUtil::getEdges(RoadGraph& roads, const QVector2D& pt, float radius, bool onlyValidEdge) {
+	EdgeIndex* index = getEdgeIndex(roads);
+	if (index != NULL) {
+		return index->withinRadius(pt, radius, [&](RoadEdgeDesc e) { return !onlyValidEdge || roads.graph[e]->valid; });
+	}
+
+	std::vector<RoadEdgeDesc> ret;
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ++ei) {
+		if (onlyValidEdge && !roads.graph[*ei]->valid) continue;
+
+		QVector2D closestPt;
+		if (distance(roads, pt, *ei, closestPt) <= radius) ret.push_back(*ei);
+	}
+	return ret;
+}
+
 /**
  * Return the index-th edge.
  */
@@ -601,6 +809,14 @@ RoadEdgeDesc GraphUtil::findNearestEdge(RoadGraph& roads, const QVector2D& pt, i
 	dist = std::numeric_limits<float>::max();
 	RoadEdgeDesc min_e;
 
+	EdgeIndex* index = getEdgeIndex(roads);
+	if (index != NULL) {
+		index->nearest(pt, std::numeric_limits<float>::max(), [&](RoadEdgeDesc e) {
+			return roads.graph[e]->valid && (roadType == 0 || (roads.graph[e]->type & roadType));
+		}, min_e, dist);
+		return min_e;
+	}
+
 	RoadEdgeIter ei, eend;
 	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ++ei) {
 		if (!roads.graph[*ei]->valid) continue;
@@ -712,6 +928,7 @@ RoadEdgeDesc GraphUtil::addEdge(RoadGraph& roads, RoadVertexDesc src, RoadVertex
 
 	std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(src, tgt, roads.graph);
 	roads.graph[edge_pair.first] = e;
+	if (roads.edgeIndex) roads.edgeIndex->sync(roads);
 
 	roads.setModified();
 
@@ -727,6 +944,7 @@ RoadEdgeDesc GraphUtil::addEdge(RoadGraph& roads, RoadVertexDesc src, RoadVertex
 
 	std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(src, tgt, roads.graph);
 	roads.graph[edge_pair.first] = edge;
+	if (roads.edgeIndex) roads.edgeIndex->sync(roads);
 
 	return edge_pair.first;
 }
@@ -738,7 +956,7 @@ RoadEdgeDesc GraphUtil::addEdge(RoadGraph& roads, const Polyline2D &polyline, un
 	RoadVertexDesc desc2 = addVertex(roads, v2);
 
 	RoadEdgeDesc e_desc = addEdge(roads, desc1, desc2, type, lanes, oneWay, link, roundabout);
-	roads.graph[e_desc]->polyline = polyline;
+	setPolyline(roads, e_desc, polyline);
 
 	return e_desc;
 }
@@ -886,6 +1104,15 @@ Polyline2D GraphUtil::orderPolyLine(RoadGraph& roads, RoadEdgeDesc e, RoadVertex
 	return roads.graph[e]->polyline;
 }
 
+/**
+ * Replace the polyline of the edge.
+ * エッジのインデックスがあれば、登録し直す。
+ */
+void GraphUtil::setPolyline(RoadGraph& roads, RoadEdgeDesc e, const Polyline2D& polyline) {
+	roads.graph[e]->polyline = polyline;
+	if (roads.edgeIndex) roads.edgeIndex->update(roads, e);
+}
+
 /**
  * Move the edge to the specified location.
  * src_posは、エッジeのsource頂点の移動先
@@ -916,6 +1143,7 @@ void GraphUtil::moveEdge(RoadGraph& roads, RoadEdgeDesc e, QVector2D& src_pos, Q
 		roads.graph[e]->polyline[0] = tgt_pos;
 		roads.graph[e]->polyline[n - 1] = src_pos;
 	}
+	if (roads.edgeIndex) roads.edgeIndex->update(roads, e);
 
 	roads.setModified();
 }
@@ -990,28 +1218,41 @@ bool GraphUtil::isSimilarPolyline(const Polyline2D &polyline1, const Polyline2D
 bool GraphUtil::removeDeadEnd(RoadGraph& roads) {
 	bool removed = false;
 
-	bool removedOne = true;
-	while (removedOne) {
-		removedOne = false;
-		RoadVertexIter vi, vend;
-		for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
-			if (!roads.graph[*vi]->valid) continue;
-			if (roads.graph[*vi]->fixed) continue;
+	// 全頂点を番号順に走査し、削除がなくなるまで繰り返すのと同じ順序で、degreeが1になった頂点だけを処理する。
+	// 削除によってdegreeが1になった隣接頂点は、番号が後ろなら今回の走査で、前なら次回の走査で処理する。
+	std::vector<int> degree = getDegrees(roads);
+	std::set<RoadVertexDesc> queue, next_queue;
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
+		if (degree[*vi] == 1) queue.insert(*vi);
+	}
 
-			if (getDegree(roads, *vi) == 1) {
-				// invalidate all the outing edges.
-				RoadOutEdgeIter ei, eend;
-				for (boost::tie(ei, eend) = boost::out_edges(*vi, roads.graph); ei != eend; ++ei) {
-					roads.graph[*ei]->valid = false;
+	while (!queue.empty()) {
+		RoadVertexDesc v = *queue.begin();
+		queue.erase(queue.begin());
+
+		if (roads.graph[v]->valid && !roads.graph[v]->fixed && degree[v] == 1) {
+			// invalidate all the outing edges.
+			RoadOutEdgeIter ei, eend;
+			for (boost::tie(ei, eend) = boost::out_edges(v, roads.graph); ei != eend; ++ei) {
+				if (roads.graph[*ei]->valid) {
+					RoadVertexDesc u = boost::target(*ei, roads.graph);
+					if (u != v && --degree[u] == 1) {
+						if (u > v) queue.insert(u);
+						else next_queue.insert(u);
+					}
 				}
+				roads.graph[*ei]->valid = false;
+			}
 
-				// invalidate the vertex as well.
-				roads.graph[*vi]->valid = false;
+			// invalidate the vertex as well.
+			roads.graph[v]->valid = false;
+			degree[v] = 0;
 
-				removedOne = true;
-				removed = true;
-			}
+			removed = true;
 		}
+
+		if (queue.empty()) queue.swap(next_queue);
 	}
 
 	if (removed) {
@@ -1173,27 +1414,56 @@ bool GraphUtil::hasCloseEdge(RoadGraph* roads, RoadVertexDesc v1, RoadVertexDesc
 }
 
 bool GraphUtil::isIntersect(RoadGraph &smallRoads, RoadGraph &largeRoads) {
+	// largeRoadsの線分のインデックスがなければ、一時的に作る
+	bool temp_index = !largeRoads.edgeIndex;
+	if (temp_index) buildEdgeIndex(largeRoads);
+
+	bool ret = false;
 	RoadEdgeIter ei, eend;
 	for (boost::tie(ei, eend) = boost::edges(smallRoads.graph); ei != eend; ++ei) {
 		if (!smallRoads.graph[*ei]->valid) continue;
 
-		if (GraphUtil::isIntersect(largeRoads, smallRoads.graph[*ei]->polyline)) return true;
+		if (GraphUtil::isIntersect(largeRoads, smallRoads.graph[*ei]->polyline)) {
+			ret = true;
+			break;
+		}
 	}
 
-	return false;
+	if (temp_index) clearEdgeIndex(largeRoads);
+
+	return ret;
 }
 
 /**
- * Check if the poly line intersects with the existing road segments.
+ * Return the valid edges which may intersect with the poly line, in the order of boost::edges().
+ * If the graph has the spatial index of the edge segments, only the edges that actually intersect are returned.
+ * Otherwise, all the valid edges are returned.
  */
-bool GraphUtil::isIntersect(RoadGraph &roads, const Polyline2D& polyline) {
-	if (polyline.size() < 2) return false;
+RoadEdgeDescs GraphUtil::getIntersectCandidates(RoadGraph &roads, const Polyline2D &polyline) {
+	EdgeIndex* index = getEdgeIndex(roads);
+	if (index != NULL) {
+		return index->crossing(polyline, [&](RoadEdgeDesc e) { return roads.graph[e]->valid; });
+	}
 
+	RoadEdgeDescs ret;
 	RoadEdgeIter ei, eend;
 	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ++ei) {
 		if (!roads.graph[*ei]->valid) continue;
 
-		if (isIntersect(roads, roads.graph[*ei]->polyline, polyline)) return true;
+		ret.push_back(*ei);
+	}
+	return ret;
+}
+
+/**
+ * Check if the poly line intersects with the existing road segments.
+ */
+bool GraphUtil::isIntersect(RoadGraph &roads, const Polyline2D& polyline) {
+	if (polyline.size() < 2) return false;
+
+	RoadEdgeDescs edges = getIntersectCandidates(roads, polyline);
+	for (int i = 0; i < edges.size(); ++i) {
+		if (isIntersect(roads, roads.graph[edges[i]]->polyline, polyline)) return true;
 	}
 
 	return false;
@@ -1205,11 +1475,9 @@ bool GraphUtil::isIntersect(RoadGraph &roads, const Polyline2D& polyline) {
 bool GraphUtil::isIntersect(RoadGraph &roads, const Polyline2D &polyline, QVector2D &intPoint) {
 	if (polyline.size() < 2) return false;
 
-	RoadEdgeIter ei, eend;
-	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ++ei) {
-		if (!roads.graph[*ei]->valid) continue;
-
-		if (isIntersect(roads, roads.graph[*ei]->polyline, polyline, intPoint)) return true;
+	RoadEdgeDescs edges = getIntersectCandidates(roads, polyline);
+	for (int i = 0; i < edges.size(); ++i) {
+		if (isIntersect(roads, roads.graph[edges[i]]->polyline, polyline, intPoint)) return true;
 	}
 
 	return false;
@@ -1224,12 +1492,10 @@ bool GraphUtil::isIntersect(RoadGraph &roads, const Polyline2D &polyline, RoadVe
 
 	float min_dist = std::numeric_limits<float>::max();
 
-	RoadEdgeIter ei, eend;
-	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ++ei) {
-		if (!roads.graph[*ei]->valid) continue;
-
+	RoadEdgeDescs edges = getIntersectCandidates(roads, polyline);
+	for (int i = 0; i < edges.size(); ++i) {
 		QVector2D pt;
-		if (isIntersect(roads, roads.graph[*ei]->polyline, polyline, pt)) {
+		if (isIntersect(roads, roads.graph[edges[i]]->polyline, polyline, pt)) {
 			float dist = (roads.graph[srcDesc]->pt - pt).lengthSquared();
 			if (dist < min_dist) {
 				min_dist = dist;
@@ -1248,12 +1514,11 @@ bool GraphUtil::isIntersect(RoadGraph &roads, const Polyline2D &polyline, RoadVe
 bool GraphUtil::isIntersect(RoadGraph &roads, const Polyline2D &polyline, RoadEdgeDesc ignoreEdge) {
 	if (polyline.size() < 2) return false;
 
-	RoadEdgeIter ei, eend;
-	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ++ei) {
-		if (!roads.graph[*ei]->valid) continue;
-		if (*ei == ignoreEdge) continue;
+	RoadEdgeDescs edges = getIntersectCandidates(roads, polyline);
+	for (int i = 0; i < edges.size(); ++i) {
+		if (edges[i] == ignoreEdge) continue;
 
-		if (isIntersect(roads, roads.graph[*ei]->polyline, polyline)) return true;
+		if (isIntersect(roads, roads.graph[edges[i]]->polyline, polyline)) return true;
 	}
 
 	return false;
@@ -1305,16 +1570,14 @@ bool GraphUtil::isIntersect(RoadGraph &roads, const Polyline2D &polyline, RoadVe
 
 	float min_dist = std::numeric_limits<float>::max();
 
-	RoadEdgeIter ei, eend;
-	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ++ei) {
-		if (!roads.graph[*ei]->valid) continue;
-
+	RoadEdgeDescs edges = getIntersectCandidates(roads, polyline);
+	for (int i = 0; i < edges.size(); ++i) {
 		QVector2D pt;
-		if (isIntersect(roads, roads.graph[*ei]->polyline, polyline, pt)) {
+		if (isIntersect(roads, roads.graph[edges[i]]->polyline, polyline, pt)) {
 			float dist = (roads.graph[srcDesc]->pt - pt).lengthSquared();
 			if (dist < min_dist) {
 				min_dist = dist;
-				nearestEdgeDesc = *ei;
+				nearestEdgeDesc = edges[i];
 				intPoint = pt;
 			}
 		}
@@ -1470,6 +1733,7 @@ void GraphUtil::cleanEdges(RoadGraph &roads) {
 
 		cleanPolyline(roads.graph[*ei]->polyline);
 	}
+	if (roads.edgeIndex) roads.edgeIndex->invalidate();
 }
 
 void GraphUtil::cleanEdge(RoadEdgePtr &edge) {
@@ -1572,7 +1836,7 @@ bool GraphUtil::isPotentiallyStraightEdge(RoadGraph &roads, RoadVertexDesc v, Ro
 RoadVertexDesc GraphUtil::cutoffEdge(RoadGraph &roads, RoadEdgeDesc edge, RoadVertexDesc v_desc, const QVector2D &pt) {
 	Polyline2D polyline = orderPolyLine(roads, edge, v_desc);
 	polyline = finerEdge(polyline);
-	roads.graph[edge]->polyline = polyline;
+	setPolyline(roads, edge, polyline);
 
 	// Add a vertex on the border
 	RoadEdgeDesc e1, e2;
@@ -1676,84 +1940,141 @@ Polyline2D GraphUtil::getAdjoiningPolyline(RoadGraph& roads, RoadVertexDesc v_de
 
 /**
  * Load the road from a file.
+ * ファイルをメモリにマップし、全てのレコードがファイルに収まっていることを確認してから、まとめて読み込む。
+ * ファイルが開けない、または、壊れている場合は、道路グラフを変更せずにfalseを返す。
  */
-void GraphUtil::loadRoads(RoadGraph& roads, const QString& filename, int roadType) {
-	roads.clear();
+bool GraphUtil::loadRoads(RoadGraph& roads, const QString& filename, int roadType) {
+	QFile file(filename);
+	if (!file.open(QIODevice::ReadOnly)) return false;
 
-	FILE* fp = fopen(filename.toUtf8().data(), "rb");
+	// マップできない場合は、全体を一度に読み込む
+	QByteArray buffer;
+	const qint64 size = file.size();
+	const uchar* data = size > 0 ? file.map(0, size) : NULL;
+	if (data == NULL) {
+		buffer = file.readAll();
+		if (buffer.size() != size) return false;
+		data = (const uchar*)buffer.constData();
+	}
 
-	QMap<uint, RoadVertexDesc> idToDesc;
+	return parseRoads(roads, data, size, roadType);
+}
 
-	// Read the number of vertices
-	unsigned int nVertices;
-	fread(&nVertices, sizeof(unsigned int), 1, fp);
+/**
+ * .gsmのバイト列から、道路グラフを作成する。
+ * 頂点IDのバイト数は、保存したビルドのsizeof(RoadVertexDesc)なので、まずは同じバイト数で、だめなら4と8のもう一方で読む。
+ * 一時的なグラフに読み込み、全て読み込めた場合だけ、roadsと入れ替える。
+ */
+bool GraphUtil::parseRoads(RoadGraph& roads, const uchar* data, qint64 size, int roadType) {
+	int id_size = sizeof(RoadVertexDesc);
+	quint64 max_id;
+	if (!scanRoads(data, size, id_size, max_id)) {
+		id_size = id_size == 8 ? 4 : 8;
+		if (!scanRoads(data, size, id_size, max_id)) return false;
+	}
+
+	// IDは、ファイルサイズ未満でなければ不正とみなす（変換用の配列が、ファイルサイズに比例する大きさで済む）
+	if (max_id >= (quint64)size) return false;
+	std::vector<int> idToDesc(max_id + 1, -1);		// ID -> 頂点（未登録なら-1）
 
-	// Read each vertex's information: desc, x, and y.
-	for (int i = 0; i < nVertices; i++) {
-		RoadVertexDesc id;
-		float x, y;
-		unsigned int onBoundary;
-		fread(&id, sizeof(RoadVertexDesc), 1, fp);
-		fread(&x, sizeof(float), 1, fp);
-		fread(&y, sizeof(float), 1, fp);
-		fread(&onBoundary, sizeof(unsigned int), 1, fp);
+	const uchar* p = data;
+	const unsigned int nVertices = readValue<quint32>(p);
+	p += 4;
+
+	BGLGraph graph(nVertices);
+	for (int i = 0; i < nVertices; i++, p += id_size + 12) {
+		quint64 id = readId(p, id_size);
+		float x = readValue<float>(p + id_size);
+		float y = readValue<float>(p + id_size + 4);
+		unsigned int onBoundary = readValue<quint32>(p + id_size + 8);
 
 		RoadVertexPtr vertex = RoadVertexPtr(new RoadVertex(QVector2D(x, y)));
 		vertex->onBoundary = onBoundary == 1;
+		graph[i] = vertex;
 
-		RoadVertexDesc desc = boost::add_vertex(roads.graph);
-		roads.graph[desc] = vertex;
-
-		idToDesc[id] = desc;
+		if (idToDesc[id] >= 0) return false;
+		idToDesc[id] = i;
 	}
 
-	// Read the number of edges
-	unsigned int nEdges;
-	fread(&nEdges, sizeof(unsigned int), 1, fp);
+	const unsigned int nEdges = readValue<quint32>(p);
+	p += 4;
 
-	// Read each edge's information: the descs of two vertices, road type, the number of lanes, the number of points along the polyline, and the coordinate of each point along the polyline.
 	for (int i = 0; i < nEdges; i++) {
-		unsigned int type, lanes, oneWay, link, roundabout;
-		RoadVertexDesc id1, id2;
-		fread(&id1, sizeof(RoadVertexDesc), 1, fp);
-		fread(&id2, sizeof(RoadVertexDesc), 1, fp);
+		quint64 id1 = readId(p, id_size);
+		quint64 id2 = readId(p + id_size, id_size);
+		p += id_size * 2;
+		if (id1 > max_id || id2 > max_id) return false;
 
+		if (idToDesc[id1] < 0 || idToDesc[id2] < 0) return false;
 		RoadVertexDesc src = idToDesc[id1];
 		RoadVertexDesc tgt = idToDesc[id2];
 
-		fread(&type, sizeof(unsigned int), 1, fp);
-		fread(&lanes, sizeof(unsigned int), 1, fp);
-		fread(&oneWay, sizeof(unsigned int), 1, fp);
-		fread(&link, sizeof(unsigned int), 1, fp);
-		fread(&roundabout, sizeof(unsigned int), 1, fp);
+		unsigned int type = readValue<quint32>(p);
+		unsigned int lanes = readValue<quint32>(p + 4);
+		unsigned int oneWay = readValue<quint32>(p + 8);
+		unsigned int link = readValue<quint32>(p + 12);
+		unsigned int roundabout = readValue<quint32>(p + 16);
+		unsigned int nPoints = readValue<quint32>(p + 20);
+		p += 24;
 
-		RoadEdgePtr edge = RoadEdgePtr(new RoadEdge(type, lanes, oneWay == 1, link == 1, roundabout == 1));
-
-		unsigned int nPoints;
-		fread(&nPoints, sizeof(unsigned int), 1, fp);
-
-		for (int j = 0; j < nPoints; j++) {
-			float x, y;
-			fread(&x, sizeof(float), 1, fp);
-			fread(&y, sizeof(float), 1, fp);
+		// 指定されたタイプの道路エッジのみを読み込む
+		if (!isRoadTypeMatched(type, roadType)) {
+			p += (qint64)nPoints * 8;
+			continue;
+		}
 
-			edge->addPoint(QVector2D(x, y));
+		RoadEdgePtr edge = RoadEdgePtr(new RoadEdge(type, lanes, oneWay == 1, link == 1, roundabout == 1));
+		edge->polyline.resize(nPoints);
+		for (int j = 0; j < nPoints; j++, p += 8) {
+			edge->polyline[j] = QVector2D(readValue<float>(p), readValue<float>(p + 4));
 		}
 
 		cleanEdge(edge);
 
-		// 指定されたタイプの道路エッジのみを読み込む
-		if (isRoadTypeMatched(edge->type, roadType)) {
-			std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(src, tgt, roads.graph);
-			roads.graph[edge_pair.first] = edge;
-		}
+		std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(src, tgt, graph);
+		graph[edge_pair.first] = edge;
 	}
 
-	fclose(fp);
+	roads.clear();
+	roads.graph.swap(graph);
 
-	std::cout << "Total length: " << getTotalEdgeLength(roads) << std::endl;
+	std::cerr << "Total length: " << getTotalEdgeLength(roads) << std::endl;
 
 	roads.setModified();
+
+	return true;
+}
+
+/**
+ * 頂点IDのバイト数をid_sizeとして、ヘッダと各レコードがファイルに収まり、ファイルの末尾で終わるかを確認する。
+ * 最大の頂点IDを、max_idに格納する。
+ */
+bool GraphUtil::scanRoads(const uchar* data, qint64 size, int id_size, quint64& max_id) {
+	const qint64 vertex_size = id_size + 12;
+	const qint64 edge_size = id_size * 2 + 24;
+	qint64 pos = 0;
+	max_id = 0;
+
+	if (size - pos < 4) return false;
+	const unsigned int nVertices = readValue<quint32>(data + pos);
+	pos += 4;
+	if ((size - pos) / vertex_size < nVertices) return false;
+	for (int i = 0; i < nVertices; i++, pos += vertex_size) {
+		max_id = std::max(max_id, readId(data + pos, id_size));
+	}
+
+	if (size - pos < 4) return false;
+	const unsigned int nEdges = readValue<quint32>(data + pos);
+	pos += 4;
+	for (int i = 0; i < nEdges; i++) {
+		if (size - pos < edge_size) return false;
+		const unsigned int nPoints = readValue<quint32>(data + pos + edge_size - 4);
+		pos += edge_size;
+		if ((size - pos) / 8 < nPoints) return false;
+		pos += (qint64)nPoints * 8;
+	}
+
+	return pos == size;
 }
 
 /**
@@ -2525,6 +2846,14 @@ bool GraphUtil::getEdge(RoadGraph &roads, const QVector2D &pt, float threshold,
 	float min_dist = std::numeric_limits<float>::max();
 	RoadEdgeDesc min_e;
 
+	EdgeIndex* index = getEdgeIndex(roads);
+	if (index != NULL) {
+		return index->nearest(pt, threshold, [&](RoadEdgeDesc e2) {
+			if (!onlyValidEdge) return true;
+			return roads.graph[e2]->valid && roads.graph[boost::source(e2, roads.graph)]->valid && roads.graph[boost::target(e2, roads.graph)]->valid;
+		}, e, min_dist) && min_dist < threshold;
+	}
+
 	RoadEdgeIter ei, eend;
 	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ++ei) {
 		if (onlyValidEdge && !roads.graph[*ei]->valid) continue;
@@ -2557,6 +2886,18 @@ bool GraphUtil::getEdge(RoadGraph &roads, const QVector2D &pt, float threshold,
 	float min_dist = std::numeric_limits<float>::max();
 	RoadEdgeDesc min_e;
 
+	EdgeIndex* index = getEdgeIndex(roads);
+	if (index != NULL) {
+		bool found = index->nearest(pt, threshold, [&](RoadEdgeDesc e2) {
+			RoadVertexDesc src = boost::source(e2, roads.graph);
+			RoadVertexDesc tgt = boost::target(e2, roads.graph);
+			if (onlyValidEdge && (!roads.graph[e2]->valid || !roads.graph[src]->valid || !roads.graph[tgt]->valid)) return false;
+			return src != srcDesc && tgt != srcDesc;
+		}, e, min_dist);
+		if (found) distance(roads, pt, e, closestPt);
+		return found && min_dist < threshold;
+	}
+
 	RoadEdgeIter ei, eend;
 	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ++ei) {
 		if (onlyValidEdge && !roads.graph[*ei]->valid) continue;
@@ -2591,6 +2932,18 @@ bool GraphUtil::getEdge(RoadGraph& roads, RoadVertexDesc v, float threshold, Roa
 	float min_dist = std::numeric_limits<float>::max();
 	RoadEdgeDesc min_e;
 
+	EdgeIndex* index = getEdgeIndex(roads);
+	if (index != NULL) {
+		bool found = index->nearest(roads.graph[v]->pt, threshold, [&](RoadEdgeDesc e2) {
+			RoadVertexDesc src = boost::source(e2, roads.graph);
+			RoadVertexDesc tgt = boost::target(e2, roads.graph);
+			if (onlyValidEdge && (!roads.graph[e2]->valid || !roads.graph[src]->valid || !roads.graph[tgt]->valid)) return false;
+			return src != v && tgt != v;
+		}, e, min_dist);
+		if (found) distance(roads, roads.graph[v]->pt, e, closestPt);
+		return found && min_dist < threshold;
+	}
+
 	RoadEdgeIter ei, eend;
 	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ++ei) {
 		if (onlyValidEdge && !roads.graph[*ei]->valid) continue;
@@ -2627,6 +2980,18 @@ RoadEdgeDesc GraphUtil::getEdge(RoadGraph& roads, RoadVertexDesc v, QVector2D &c
 	float min_dist = std::numeric_limits<float>::max();
 	RoadEdgeDesc min_e;
 
+	EdgeIndex* index = getEdgeIndex(roads);
+	if (index != NULL) {
+		bool found = index->nearest(roads.graph[v]->pt, std::numeric_limits<float>::max(), [&](RoadEdgeDesc e2) {
+			if (onlyValidEdge && !roads.graph[e2]->valid) return false;
+			RoadVertexDesc src = boost::source(e2, roads.graph);
+			RoadVertexDesc tgt = boost::target(e2, roads.graph);
+			return v != src && v != tgt && src != tgt && roads.graph[e2]->getLength() > 0.1f;
+		}, min_e, min_dist);
+		if (found) distance(roads, roads.graph[v]->pt, min_e, closestPt);
+		return min_e;
+	}
+
 	RoadEdgeIter ei, eend;
 	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ++ei) {
 		if (onlyValidEdge && !roads.graph[*ei]->valid) continue;
@@ -2656,45 +3021,99 @@ RoadEdgeDesc GraphUtil::getEdge(RoadGraph& roads, RoadVertexDesc v, QVector2D &c
 
 /**
  * Clean the road graph by removing all the invalid vertices and edges.
+ * The isolated vertices are also removed.
  */
 void GraphUtil::clean(RoadGraph& roads) {
-	RoadGraph temp;
-	GraphUtil::copyRoads(roads, temp);
-
-	roads.clear();
+	removeIsolatedVertices(roads);
+	compact(roads);
+}
 
-	removeIsolatedVertices(temp);
+/**
+ * Remove the invalid vertices and edges, and return the new desc of each old vertex (null_vertex() if removed).
+ * The valid edges whose end vertex is invalid are also removed.
+ * 頂点とエッジのデータ（RoadVertex、RoadEdge）はコピーせずに、新しいグラフに付け替えるので、
+ * 一時的に増えるメモリは、グラフの隣接構造の分だけである。頂点とエッジの順序は保たれる。
+ *
+ * @param edgeRemap [OUT]	boost::edges()の順で何番目のエッジが、新しいグラフで何番目になるか（削除されたら-1）
+ * @return					古い頂点descから新しい頂点descへの変換表
+ */
+std::vector<RoadVertexDesc> GraphUtil::compact(RoadGraph& roads, std::vector<int>* edgeRemap) {
+	const RoadVertexDesc removed = boost::graph_traits<BGLGraph>::null_vertex();
 
-	QMap<RoadVertexDesc, RoadVertexDesc> conv;
+	std::vector<RoadVertexDesc> remap(boost::num_vertices(roads.graph), removed);
+	int num_vertices = 0;
 	RoadVertexIter vi, vend;
-	for (boost::tie(vi, vend) = boost::vertices(temp.graph); vi != vend; ++vi) {
-		if (!temp.graph[*vi]->valid) continue;
+	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
+		if (!roads.graph[*vi]->valid) continue;
 
-		// Add a vertex
-		RoadVertexPtr new_v = RoadVertexPtr(new RoadVertex(*temp.graph[*vi]));
-		RoadVertexDesc new_v_desc = boost::add_vertex(roads.graph);
-		roads.graph[new_v_desc] = new_v;
+		remap[*vi] = num_vertices++;
+	}
 
-		conv[*vi] = new_v_desc;
+	BGLGraph graph(num_vertices);
+	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
+		if (remap[*vi] == removed) continue;
+
+		graph[remap[*vi]] = roads.graph[*vi];
 	}
 
+	if (edgeRemap != NULL) edgeRemap->assign(boost::num_edges(roads.graph), -1);
+	int old_id = 0;
+	int new_id = 0;
 	RoadEdgeIter ei, eend;
-	for (boost::tie(ei, eend) = boost::edges(temp.graph); ei != eend; ++ei) {
-		if (!temp.graph[*ei]->valid) continue;
-
-		RoadVertexDesc src = boost::source(*ei, temp.graph);
-		RoadVertexDesc tgt = boost::target(*ei, temp.graph);
+	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ++ei, ++old_id) {
+		if (!roads.graph[*ei]->valid) continue;
 
-		RoadVertexDesc new_src = conv[src];
-		RoadVertexDesc new_tgt = conv[tgt];
+		RoadVertexDesc src = remap[boost::source(*ei, roads.graph)];
+		RoadVertexDesc tgt = remap[boost::target(*ei, roads.graph)];
+		if (src == removed || tgt == removed) continue;
 
-		// Add an edge
-		RoadEdgePtr new_e = RoadEdgePtr(new RoadEdge(*temp.graph[*ei]));
-		std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(new_src, new_tgt, roads.graph);
-		roads.graph[edge_pair.first] = new_e;
+		std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(src, tgt, graph);
+		graph[edge_pair.first] = roads.graph[*ei];
+		if (edgeRemap != NULL) (*edgeRemap)[old_id] = new_id++;
 	}
 
+	roads.graph.swap(graph);
+	if (roads.vertexIndex) roads.vertexIndex->invalidate();
+	if (roads.edgeIndex) roads.edgeIndex->invalidate();
 	roads.setModified();
+
+	return remap;
+}
+
+/**
+ * Return the ratio of the invalid vertices and edges to all the vertices and edges.
+ */
+float GraphUtil::getTombstoneRatio(RoadGraph& roads) {
+	int total = boost::num_vertices(roads.graph) + boost::num_edges(roads.graph);
+	if (total == 0) return 0.0f;
+
+	int count = 0;
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
+		if (!roads.graph[*vi]->valid) count++;
+	}
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ++ei) {
+		if (!roads.graph[*ei]->valid) count++;
+	}
+
+	return (float)count / total;
+}
+
+/**
+ * Compact the road graph if the ratio of the invalid vertices and edges exceeds the threshold.
+ * Note that the vertex descs and edge descs change when the graph is compacted.
+ *
+ * @param vertexRemap [OUT]	compactした場合は、古い頂点descから新しい頂点descへの変換表
+ * @return					compactしたらtrue
+ */
+bool GraphUtil::compactIfNeeded(RoadGraph& roads, float maxTombstoneRatio, std::vector<RoadVertexDesc>* vertexRemap) {
+	if (getTombstoneRatio(roads) <= maxTombstoneRatio) return false;
+
+	std::vector<RoadVertexDesc> remap = compact(roads);
+	if (vertexRemap != NULL) vertexRemap->swap(remap);
+
+	return true;
 }
 
 /**
@@ -2703,25 +3122,38 @@ void GraphUtil::clean(RoadGraph& roads) {
 void GraphUtil::reduce(RoadGraph& roads) {
 	bool actuallReduced = false;
 
+	// degreeが2の頂点を、番号の小さい順に処理する。
+	// 縮約しても、2本のエッジが1本に置き換わるだけなので、隣接頂点のdegreeは変わらない。
+	// 隣接頂点は調べ直すが、番号の小さい順に処理するので、縮約のたびに先頭から走査し直すのと同じ結果になる。
+	std::vector<int> degree = getDegrees(roads);
+	std::set<RoadVertexDesc> queue;
 	RoadVertexIter vi, vend;
-	bool deleted = false;
-	do {
-		deleted = false;
+	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
+		if (degree[*vi] == 2) queue.insert(*vi);
+	}
 
-		for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
-			if (!roads.graph[*vi]->valid) continue;
+	while (!queue.empty()) {
+		RoadVertexDesc v = *queue.begin();
+		queue.erase(queue.begin());
 
-			RoadVertexPtr v = roads.graph[*vi];
+		if (!roads.graph[v]->valid) continue;
+		if (degree[v] != 2) continue;
 
-			if (getDegree(roads, *vi) == 2) {
-				if (reduce(roads, *vi)) {
-					deleted = true;
-					actuallReduced = true;
-					break;
-				}
+		std::vector<RoadVertexDesc> neighbors;
+		RoadOutEdgeIter ei, eend;
+		for (boost::tie(ei, eend) = boost::out_edges(v, roads.graph); ei != eend; ++ei) {
+			if (roads.graph[*ei]->valid) neighbors.push_back(boost::target(*ei, roads.graph));
+		}
+
+		if (reduce(roads, v)) {
+			degree[v] = 0;
+			actuallReduced = true;
+
+			for (int i = 0; i < neighbors.size(); ++i) {
+				if (neighbors[i] != v && degree[neighbors[i]] == 2) queue.insert(neighbors[i]);
 			}
 		}
-	} while (deleted);
+	}
 
 	if (actuallReduced) {
 		roads.setModified();
@@ -2786,6 +3218,10 @@ bool GraphUtil::reduce(RoadGraph& roads, RoadVertexDesc desc) {
  * ノードとエッジ間の距離が、閾値よりも小さい場合も、エッジ上にノードを移してしまう。
  */
 void GraphUtil::simplify(RoadGraph& roads, float dist_threshold) {
+	// use the spatial index to find the close vertices
+	bool temp_index = !roads.vertexIndex;
+	if (temp_index) buildVertexIndex(roads);
+
 	RoadVertexIter vi, vend;
 	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
 		if (!roads.graph[*vi]->valid) continue;
@@ -2836,6 +3272,8 @@ void GraphUtil::simplify(RoadGraph& roads, float dist_threshold) {
 		}
 	}
 
+	if (temp_index) clearVertexIndex(roads);
+
 	roads.setModified();
 }
 
@@ -3030,7 +3468,7 @@ void GraphUtil::simplify3(RoadGraph& roads, float dist_threshold) {
 
 			// エッジを追加
 			RoadEdgeDesc e = addEdge(roads, new_src, new_tgt, RoadEdgePtr(new RoadEdge(*temp.graph[*ei])));
-			roads.graph[e]->polyline = temp.graph[*ei]->polyline;
+			setPolyline(roads, e, temp.graph[*ei]->polyline);
 		} else if (temp.graph[src]->properties["isAvenue"] == true) {
 			RoadVertexDesc new_src = conv[groups[src]];
 			RoadVertexDesc new_tgt = conv2[tgt];
@@ -3044,7 +3482,7 @@ void GraphUtil::simplify3(RoadGraph& roads, float dist_threshold) {
 
 			// エッジを追加
 			RoadEdgeDesc e = addEdge(roads, new_src, new_tgt, RoadEdgePtr(new RoadEdge(*temp.graph[*ei])));
-			roads.graph[e]->polyline = temp.graph[*ei]->polyline;
+			setPolyline(roads, e, temp.graph[*ei]->polyline);
 		} else if (temp.graph[tgt]->properties["isAvenue"] == true) {
 			RoadVertexDesc new_src = conv2[src];
 			RoadVertexDesc new_tgt = conv[groups[tgt]];
@@ -3058,14 +3496,14 @@ void GraphUtil::simplify3(RoadGraph& roads, float dist_threshold) {
 
 			// エッジを追加
 			RoadEdgeDesc e = addEdge(roads, new_src, new_tgt, RoadEdgePtr(new RoadEdge(*temp.graph[*ei])));
-			roads.graph[e]->polyline = temp.graph[*ei]->polyline;
+			setPolyline(roads, e, temp.graph[*ei]->polyline);
 		} else {
 			RoadVertexDesc new_src = conv2[src];
 			RoadVertexDesc new_tgt = conv2[tgt];
 
 			// エッジを追加
 			RoadEdgeDesc e = addEdge(roads, new_src, new_tgt, RoadEdgePtr(new RoadEdge(*temp.graph[*ei])));
-			roads.graph[e]->polyline = temp.graph[*ei]->polyline;
+			setPolyline(roads, e, temp.graph[*ei]->polyline);
 		}
 	}
 
@@ -3257,10 +3695,9 @@ void GraphUtil::singlify(RoadGraph& roads) {
  * Convert the road graph to a planar graph.
  */
 void GraphUtil::planarify(RoadGraph& roads) {
-	bool split = true;
-
-	while (split) {
-		split = planarifyOne(roads);
+	// 端点を共有するため除外したエッジの組が、分割後には共有しなくなり、交差として見つかることがあるので、
+	// 交点が追加されなくなるまで繰り返す
+	while (planarifyBatch(roads) > 0) {
 	}
 }
 
@@ -3331,6 +3768,125 @@ bool GraphUtil::planarifyOne(RoadGraph& roads) {
 	return false;
 }
 
+/**
+ * Convert all the intersected road segments to planar ones at once, and return the number of the added intersections.
+ * 全ての交点を線分のインデックスで求めてから、交差する各エッジを、交点で一度に分割する。
+ * planarifyOne()と同様に、端点を共有するエッジの組は対象外とし、エッジの端点や、既に追加した交点から
+ * 10m未満の交点は追加しない。
+ */
+int GraphUtil::planarifyBatch(RoadGraph& roads) {
+	struct Split {
+		float param;			// 交点のポリライン上の位置（線分の番号 + 線分上の位置）
+		QVector2D pt;
+		RoadVertexDesc v;
+		bool operator<(const Split& other) const { return param < other.param; }
+	};
+
+	bool temp_index = !roads.edgeIndex;
+	if (temp_index) buildEdgeIndex(roads);
+	EdgeIndex* index = getEdgeIndex(roads);
+
+	RoadEdgeDescs descs(index->size());
+	std::vector<std::vector<Split> > splits(index->size());
+	int count = 0;
+
+	// 交点を求める
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ++ei) {
+		RoadEdgePtr e = roads.graph[*ei];
+		if (!e->valid) continue;
+
+		int id = index->id(*ei);
+		RoadVertexDesc src = boost::source(*ei, roads.graph);
+		RoadVertexDesc tgt = boost::target(*ei, roads.graph);
+
+		RoadEdgeDescs candidates = index->crossing(e->polyline, [&](RoadEdgeDesc e2) { return roads.graph[e2]->valid; });
+		for (int k = 0; k < candidates.size(); ++k) {
+			// 各組は、番号が小さい方のエッジから一度だけ調べる
+			int id2 = index->id(candidates[k]);
+			if (id2 <= id) continue;
+
+			RoadEdgePtr e2 = roads.graph[candidates[k]];
+			RoadVertexDesc src2 = boost::source(candidates[k], roads.graph);
+			RoadVertexDesc tgt2 = boost::target(candidates[k], roads.graph);
+			if (src == src2 || src == tgt2 || tgt == src2 || tgt == tgt2) continue;
+
+			for (int i = 0; i < e->polyline.size() - 1; i++) {
+				for (int j = 0; j < e2->polyline.size() - 1; j++) {
+					float tab, tcd;
+					QVector2D intPt;
+					if (!Util::segmentSegmentIntersectXY(e->polyline[i], e->polyline[i+1], e2->polyline[j], e2->polyline[j+1], &tab, &tcd, true, intPt)) continue;
+
+					// エッジの端、ぎりぎりで、交差する場合は、交差させない
+					if ((roads.graph[src]->pt - intPt).length() < 10 || (roads.graph[tgt]->pt - intPt).length() < 10 || (roads.graph[src2]->pt - intPt).length() < 10 || (roads.graph[tgt2]->pt - intPt).length() < 10) continue;
+
+					// 既に追加した交点に近い場合も、交差させない（分割後のエッジの端になるため）
+					bool close = false;
+					for (int l = 0; l < splits[id].size() && !close; ++l) {
+						if ((splits[id][l].pt - intPt).length() < 10) close = true;
+					}
+					for (int l = 0; l < splits[id2].size() && !close; ++l) {
+						if ((splits[id2][l].pt - intPt).length() < 10) close = true;
+					}
+					if (close) continue;
+
+					// 交点をノードとして登録
+					RoadVertexDesc v = addVertex(roads, RoadVertexPtr(new RoadVertex(intPt)));
+					Split split1 = { i + tab, intPt, v };
+					Split split2 = { j + tcd, intPt, v };
+					splits[id].push_back(split1);
+					splits[id2].push_back(split2);
+					descs[id] = *ei;
+					descs[id2] = candidates[k];
+					count++;
+				}
+			}
+		}
+	}
+
+	if (temp_index) clearEdgeIndex(roads);
+
+	// 交差する各エッジを、交点で分割する
+	for (int id = 0; id < splits.size(); ++id) {
+		if (splits[id].empty()) continue;
+		std::sort(splits[id].begin(), splits[id].end());
+
+		RoadEdgePtr edge = roads.graph[descs[id]];
+		RoadVertexDesc src = boost::source(descs[id], roads.graph);
+		RoadVertexDesc tgt = boost::target(descs[id], roads.graph);
+		if ((edge->polyline[0] - roads.graph[src]->pt).lengthSquared() > (edge->polyline[0] - roads.graph[tgt]->pt).lengthSquared()) {
+			std::swap(src, tgt);
+		}
+
+		RoadVertexDesc prev = src;
+		Polyline2D polyline;
+		polyline.push_back(edge->polyline[0]);
+		for (int i = 0, k = 0; i < edge->polyline.size() - 1; ++i) {
+			for (; k < splits[id].size() && splits[id][k].param < i + 1; ++k) {
+				polyline.push_back(splits[id][k].pt);
+
+				RoadEdgePtr new_edge = RoadEdgePtr(new RoadEdge(*edge));
+				new_edge->polyline = polyline;
+				addEdge(roads, prev, splits[id][k].v, new_edge);
+
+				prev = splits[id][k].v;
+				polyline.clear();
+				polyline.push_back(splits[id][k].pt);
+			}
+			polyline.push_back(edge->polyline[i + 1]);
+		}
+
+		RoadEdgePtr new_edge = RoadEdgePtr(new RoadEdge(*edge));
+		new_edge->polyline = polyline;
+		addEdge(roads, prev, tgt, new_edge);
+
+		// もともとのエッジを無効にする
+		edge->valid = false;
+	}
+
+	return count;
+}
+
 /**
  * 道路網をスケルトン化する。
  * 具体的には、オリジナル道路網で、degreeが1の頂点と、その隣接エッジを無効にする。
@@ -3375,6 +3931,8 @@ void GraphUtil::rotate(RoadGraph& roads, float theta, const QVector2D& rotationC
 		roads.graph[*vi]->pt.setX(cosf(theta) * (pos.x() - rotationCenter.x()) - sinf(theta) * (pos.y() - rotationCenter.y()) + rotationCenter.x());
 		roads.graph[*vi]->pt.setY(sinf(theta) * (pos.x() - rotationCenter.x()) + cosf(theta) * (pos.y() - rotationCenter.y()) + rotationCenter.y());
 	}
+	if (roads.vertexIndex) roads.vertexIndex->invalidate();
+	if (roads.edgeIndex) roads.edgeIndex->invalidate();
 
 	// Rotate edges
 	RoadEdgeIter ei, eend;
@@ -3398,6 +3956,8 @@ void GraphUtil::translate(RoadGraph& roads, const QVector2D& offset) {
 	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
 		roads.graph[*vi]->pt += offset;
 	}
+	if (roads.vertexIndex) roads.vertexIndex->invalidate();
+	if (roads.edgeIndex) roads.edgeIndex->invalidate();
 
 	// Translate edges
 	RoadEdgeIter ei, eend;
@@ -3426,6 +3986,8 @@ void GraphUtil::scale(RoadGraph& roads, const BBox& bbox1, const BBox& bbox2) {
 		roads.graph[*vi]->pt.setX(x);
 		roads.graph[*vi]->pt.setY(y);
 	}
+	if (roads.vertexIndex) roads.vertexIndex->invalidate();
+	if (roads.edgeIndex) roads.edgeIndex->invalidate();
 
 	// Translate edges
 	RoadEdgeIter ei, eend;
@@ -3451,6 +4013,10 @@ void GraphUtil::scale(RoadGraph& roads, const BBox& bbox1, const BBox& bbox2) {
 void GraphUtil::snapDeadendEdges(RoadGraph& roads, float threshold) {
 	float min_angle_threshold = 0.34f;
 
+	// use the spatial index to find the close vertices
+	bool temp_index = !roads.vertexIndex;
+	if (temp_index) buildVertexIndex(roads);
+
 	RoadVertexIter vi, vend;
 	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
 		if (!roads.graph[*vi]->valid) continue;
@@ -3474,32 +4040,33 @@ void GraphUtil::snapDeadendEdges(RoadGraph& roads, float threshold) {
 		RoadVertexDesc nearest_desc;
 		float min_dist = std::numeric_limits<float>::max();
 
-		RoadVertexIter vi2, vend2;
-		for (boost::tie(vi2, vend2) = boost::vertices(roads.graph); vi2 != vend2; ++vi2) {
-			if (!roads.graph[*vi2]->valid) continue;
-			if (*vi2 == *vi) continue;
-			if (*vi2 == tgt) continue;
-			if (GraphUtil::getDegree(roads, *vi2) == 1) continue;
+		// only the vertices within the threshold can be snapped to
+		std::vector<RoadVertexDesc> candidates = getVertices(roads, roads.graph[*vi]->pt, threshold);
+		for (int k = 0; k < candidates.size(); ++k) {
+			RoadVertexDesc vi2 = candidates[k];
+			if (vi2 == *vi) continue;
+			if (vi2 == tgt) continue;
+			if (GraphUtil::getDegree(roads, vi2) == 1) continue;
 
-			float dist = (roads.graph[*vi2]->pt - roads.graph[*vi]->pt).length();
+			float dist = (roads.graph[vi2]->pt - roads.graph[*vi]->pt).length();
 
 			// 近接頂点が、*viよりもtgtの方に近い場合は、当該近接頂点は対象からはずす
-			float dist2 = (roads.graph[*vi2]->pt - roads.graph[tgt]->pt).length();
+			float dist2 = (roads.graph[vi2]->pt - roads.graph[tgt]->pt).length();
 			if (dist > dist2) continue;
 
 			if (dist < min_dist) {
-				nearest_desc = *vi2;
+				nearest_desc = vi2;
 				min_dist = dist;
 			}
 
-			// *vi2から出るエッジとのなす角度の最小値が小さすぎる場合は、対象からはずす
+			// vi2から出るエッジとのなす角度の最小値が小さすぎる場合は、対象からはずす
 			float min_angle = std::numeric_limits<float>::max();
 			RoadOutEdgeIter ei, eend;
-			for (boost::tie(ei, eend) = boost::out_edges(*vi2, roads.graph); ei != eend; ++ei) {
+			for (boost::tie(ei, eend) = boost::out_edges(vi2, roads.graph); ei != eend; ++ei) {
 				if (!roads.graph[*ei]->valid) continue;
 
 				RoadVertexDesc tgt2 = boost::target(*ei, roads.graph);
-				float angle = Util::diffAngle(roads.graph[*vi]->pt - roads.graph[tgt]->pt, roads.graph[*vi2]->pt - roads.graph[tgt2]->pt);
+				float angle = Util::diffAngle(roads.graph[*vi]->pt - roads.graph[tgt]->pt, roads.graph[vi2]->pt - roads.graph[tgt2]->pt);
 				if (angle < min_angle) {
 					min_angle = angle;
 				}
@@ -3509,16 +4076,16 @@ void GraphUtil::snapDeadendEdges(RoadGraph& roads, float threshold) {
 
 		// If no such vertex exists, find the closest vertex of degree 1.
 		if (min_dist > threshold) {
-			for (boost::tie(vi2, vend2) = boost::vertices(roads.graph); vi2 != vend2; ++vi2) {
-				if (!roads.graph[*vi2]->valid) continue;
-				if (*vi2 == *vi) continue;
-				if (*vi2 == tgt) continue;
-				if (GraphUtil::getDegree(roads, *vi2) != 1) continue;
+			for (int k = 0; k < candidates.size(); ++k) {
+				RoadVertexDesc vi2 = candidates[k];
+				if (vi2 == *vi) continue;
+				if (vi2 == tgt) continue;
+				if (GraphUtil::getDegree(roads, vi2) != 1) continue;
 
 				// Find the edge of the vertex
 				RoadEdgeDesc e_desc2;
 				RoadOutEdgeIter ei, eend;
-				for (boost::tie(ei, eend) = boost::out_edges(*vi2, roads.graph); ei != eend; ++ei) {
+				for (boost::tie(ei, eend) = boost::out_edges(vi2, roads.graph); ei != eend; ++ei) {
 					if (!roads.graph[*ei]->valid) continue;
 
 					e_desc2 = *ei;
@@ -3528,24 +4095,24 @@ void GraphUtil::snapDeadendEdges(RoadGraph& roads, float threshold) {
 				// If th edge is too short, skip it.
 				//if (roads->graph[e_desc2]->getLength() < deadend_removal_threshold) continue;
 
-				float dist = (roads.graph[*vi2]->pt - roads.graph[*vi]->pt).length();
+				float dist = (roads.graph[vi2]->pt - roads.graph[*vi]->pt).length();
 
 				// 近接頂点が、*viよりもtgtの方に近い場合は、当該近接頂点は対象からはずす
-				float dist2 = (roads.graph[*vi2]->pt - roads.graph[tgt]->pt).length();
+				float dist2 = (roads.graph[vi2]->pt - roads.graph[tgt]->pt).length();
 				if (dist > dist2) continue;
 
 				if (dist < min_dist) {
-					nearest_desc = *vi2;
+					nearest_desc = vi2;
 					min_dist = dist;
 				}
 
-				// *vi2から出るエッジとのなす角度の最小値が小さすぎる場合は、対象からはずす
+				// vi2から出るエッジとのなす角度の最小値が小さすぎる場合は、対象からはずす
 				float min_angle = std::numeric_limits<float>::max();
-				for (boost::tie(ei, eend) = boost::out_edges(*vi2, roads.graph); ei != eend; ++ei) {
+				for (boost::tie(ei, eend) = boost::out_edges(vi2, roads.graph); ei != eend; ++ei) {
 					if (!roads.graph[*ei]->valid) continue;
 
 					RoadVertexDesc tgt2 = boost::target(*ei, roads.graph);
-					float angle = Util::diffAngle(roads.graph[*vi]->pt - roads.graph[tgt]->pt, roads.graph[*vi2]->pt - roads.graph[tgt2]->pt);
+					float angle = Util::diffAngle(roads.graph[*vi]->pt - roads.graph[tgt]->pt, roads.graph[vi2]->pt - roads.graph[tgt2]->pt);
 					if (angle < min_angle) {
 						min_angle = angle;
 					}
@@ -3563,7 +4130,7 @@ void GraphUtil::snapDeadendEdges(RoadGraph& roads, float threshold) {
 				// もともとエッジがあるが無効となっている場合、それを有効にし、エッジのポリラインを更新する
 				RoadEdgeDesc new_e_desc = GraphUtil::getEdge(roads, nearest_desc, tgt, false);
 				roads.graph[new_e_desc]->valid = true;
-				roads.graph[new_e_desc]->polyline = roads.graph[e_desc]->polyline;
+				GraphUtil::setPolyline(roads, new_e_desc, roads.graph[e_desc]->polyline);
 			} else {
 				// 該当頂点間にエッジがない場合は、新しいエッジを追加する
 				GraphUtil::addEdge(roads, nearest_desc, tgt, RoadEdgePtr(new RoadEdge(*roads.graph[e_desc])));
@@ -3576,6 +4143,8 @@ void GraphUtil::snapDeadendEdges(RoadGraph& roads, float threshold) {
 			roads.graph[*vi]->valid = false;
 		}
 	}
+
+	if (temp_index) clearVertexIndex(roads);
 }
 
 /**
@@ -3585,6 +4154,10 @@ void GraphUtil::snapDeadendEdges(RoadGraph& roads, float threshold) {
 void GraphUtil::snapDeadendEdges2(RoadGraph& roads, int degree, float threshold) {
 	float angle_threshold = 0.34f;
 
+	// use the spatial index to find the close vertices
+	bool temp_index = !roads.vertexIndex;
+	if (temp_index) buildVertexIndex(roads);
+
 	RoadVertexIter vi, vend;
 	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
 		if (!roads.graph[*vi]->valid) continue;
@@ -3608,23 +4181,31 @@ void GraphUtil::snapDeadendEdges2(RoadGraph& roads, int degree, float threshold)
 		RoadVertexDesc nearest_desc;
 		float min_dist = std::numeric_limits<float>::max();
 
-		RoadVertexIter vi2, vend2;
-		for (boost::tie(vi2, vend2) = boost::vertices(roads.graph); vi2 != vend2; ++vi2) {
-			if (!roads.graph[*vi2]->valid) continue;
-			if (*vi2 == *vi) continue;
-			if (*vi2 == tgt) continue;
+		VertexIndex* index = getVertexIndex(roads);
+		if (index != NULL) {
+			if (index->nearest(roads.graph[*vi]->pt, min_dist, [&](RoadVertexDesc v) { return roads.graph[v]->valid && v != *vi && v != tgt; }, nearest_desc)) {
+				min_dist = (roads.graph[nearest_desc]->pt - roads.graph[*vi]->pt).length();
+			}
+		} else {
+			RoadVertexIter vi2, vend2;
+			for (boost::tie(vi2, vend2) = boost::vertices(roads.graph); vi2 != vend2; ++vi2) {
+				if (!roads.graph[*vi2]->valid) continue;
+				if (*vi2 == *vi) continue;
+				if (*vi2 == tgt) continue;
 
-			float dist = (roads.graph[*vi2]->pt - roads.graph[*vi]->pt).length();
+				float dist = (roads.graph[*vi2]->pt - roads.graph[*vi]->pt).length();
 
-			// 近接頂点が、*viよりもtgtの方に近い場合は、当該近接頂点は対象からはずす
-			//float dist2 = (roads->graph[*vi2]->pt - roads->graph[tgt]->pt).length();
-			//if (dist > dist2) continue;
+				// 近接頂点が、*viよりもtgtの方に近い場合は、当該近接頂点は対象からはずす
+				//float dist2 = (roads->graph[*vi2]->pt - roads->graph[tgt]->pt).length();
+				//if (dist > dist2) continue;
 
-			if (dist < min_dist) {
-				nearest_desc = *vi2;
-				min_dist = dist;
+				if (dist < min_dist) {
+					nearest_desc = *vi2;
+					min_dist = dist;
+				}
 			}
 		}
+		if (min_dist == std::numeric_limits<float>::max()) continue;
 		
 		// 近接頂点が、*viよりもtgtの方に近い場合は、スナップしない
 		if ((roads.graph[nearest_desc]->pt - roads.graph[tgt]->pt).length() < (roads.graph[*vi]->pt - roads.graph[tgt]->pt).length()) continue;
@@ -3641,6 +4222,8 @@ void GraphUtil::snapDeadendEdges2(RoadGraph& roads, int degree, float threshold)
 			snapVertex(roads, *vi, nearest_desc);
 		}
 	}
+
+	if (temp_index) clearVertexIndex(roads);
 }
 
 /**
@@ -3649,18 +4232,21 @@ void GraphUtil::snapDeadendEdges2(RoadGraph& roads, int degree, float threshold)
 void GraphUtil::removeShortDeadend(RoadGraph& roads, float threshold) {
 	bool actuallyDeleted = false;
 
-	bool deleted = true;
-	while (deleted) {
-		deleted = false;
-
-		RoadVertexIter vi, vend;
-		for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
-			if (!roads.graph[*vi]->valid) continue;
+	// removeDeadEnd()と同様に、全頂点を走査し直すのと同じ順序で、degreeが1になった頂点だけを処理する
+	std::vector<int> degree = getDegrees(roads);
+	std::set<RoadVertexDesc> queue, next_queue;
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
+		if (degree[*vi] == 1) queue.insert(*vi);
+	}
 
-			if (getDegree(roads, *vi) > 1) continue;
+	while (!queue.empty()) {
+		RoadVertexDesc v = *queue.begin();
+		queue.erase(queue.begin());
 
+		if (roads.graph[v]->valid && degree[v] <= 1) {
 			RoadOutEdgeIter ei, eend;
-			for (boost::tie(ei, eend) = boost::out_edges(*vi, roads.graph); ei != eend; ++ei) {
+			for (boost::tie(ei, eend) = boost::out_edges(v, roads.graph); ei != eend; ++ei) {
 				if (!roads.graph[*ei]->valid) continue;
 
 				// If the edge has a pair, don't remove it.
@@ -3670,13 +4256,19 @@ void GraphUtil::removeShortDeadend(RoadGraph& roads, float threshold) {
 
 				// invalidate the too short edge, and invalidate the dead-end vertex.
 				if (roads.graph[*ei]->getLength() < threshold) {
-					roads.graph[*vi]->valid = false;
+					roads.graph[v]->valid = false;
 					roads.graph[*ei]->valid = false;
-					deleted = true;
+					degree[v]--;
+					if (--degree[tgt] == 1) {
+						if (tgt > v) queue.insert(tgt);
+						else next_queue.insert(tgt);
+					}
 					actuallyDeleted = true;
 				}
 			}
 		}
+
+		if (queue.empty()) queue.swap(next_queue);
 	}
 
 	if (actuallyDeleted) roads.setModified();
@@ -3966,7 +4558,7 @@ void GraphUtil::generateCurvyGrid(RoadGraph &roads, float size, float avenueInte
 								}
 							}
 						}
-						roads.graph[edge]->polyline = polyline;
+						GraphUtil::setPolyline(roads, edge, polyline);
 					}
 
 					// add the vertical edge
@@ -4014,7 +4606,7 @@ void GraphUtil::generateCurvyGrid(RoadGraph &roads, float size, float avenueInte
 							}
 						}
 
-						roads.graph[edge]->polyline = polyline;
+						GraphUtil::setPolyline(roads, edge, polyline);
 					}
 				}
 			}
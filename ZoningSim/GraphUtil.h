@@ -1,17 +1,28 @@
 ﻿#pragma once
 
 #include <vector>
+#include <cstring>
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
 #include "BBox.h"
 #include "Polygon2D.h"
 #include "RoadGraph.h"
 #include "Polyline3D.h"
+#include "VertexIndex.h"
+#include "EdgeIndex.h"
 
 class GraphUtil {
 protected:
 	GraphUtil() {}
 
+	static bool parseRoads(RoadGraph& roads, const uchar* data, qint64 size, int roadType);
+	static bool scanRoads(const uchar* data, qint64 size, int id_size, quint64& max_id);
+
+	// アラインされていない位置から、ファイルに書き出した値を読む
+	template<class T>
+	static T readValue(const uchar* p) { T v; memcpy(&v, p, sizeof(T)); return v; }
+	static quint64 readId(const uchar* p, int id_size) { return id_size == 4 ? readValue<quint32>(p) : readValue<quint64>(p); }
+
 public:
 	// Vertex related functions
 	static int getNumVertices(RoadGraph& roads, bool onlyValidVertex = true);
@@ -30,7 +41,9 @@ public:
 	static RoadVertexDesc addVertex(RoadGraph& roads, RoadVertexPtr v);
 	static void moveVertex(RoadGraph& roads, RoadVertexDesc v, const QVector2D& pt);
 	static int getDegree(RoadGraph& roads, RoadVertexDesc v, bool onlyValidEdge = true);
+	static std::vector<int> getDegrees(RoadGraph& roads, bool onlyValidEdge = true);
 	static std::vector<RoadVertexDesc> getVertices(RoadGraph* roads, bool onlyValidVertex = true);
+	static std::vector<RoadVertexDesc> getVertices(RoadGraph& roads, const QVector2D& pt, float radius, bool onlyValidVertex = true);
 	static void removeIsolatedVertices(RoadGraph& roads, bool onlyValidVertex = true);
 	static void snapVertex(RoadGraph& roads, RoadVertexDesc v1, RoadVertexDesc v2);
 	static RoadVertexDesc getCentralVertex(RoadGraph& roads);
@@ -39,6 +52,16 @@ public:
 	static bool tshape(RoadGraph &roads, RoadVertexDesc v, RoadEdgeDesc edge);
 	static void setVertexType(RoadGraph &roads);
 
+	// Spatial index related functions
+	static void buildVertexIndex(RoadGraph& roads, float cell_size = 100.0f);
+	static void clearVertexIndex(RoadGraph& roads);
+	static VertexIndex* getVertexIndex(RoadGraph& roads);
+	static std::vector<RoadVertexDesc> getNearestVertices(RoadGraph& roads, const QVector2D& pt, int k, bool onlyValidVertex = true);
+	static void buildEdgeIndex(RoadGraph& roads, float cell_size = 100.0f);
+	static void clearEdgeIndex(RoadGraph& roads);
+	static EdgeIndex* getEdgeIndex(RoadGraph& roads);
+	static std::vector<RoadEdgeDesc> getEdges(RoadGraph& roads, const QVector2D& pt, float radius, bool onlyValidEdge = true);
+
 	// Edge related functions
 	static RoadEdgeDesc getEdge(RoadGraph& roads, int index, bool onlyValidEdge = true);
 	static float getTotalEdgeLength(RoadGraph& roads, RoadVertexDesc v);
@@ -55,6 +78,7 @@ public:
 	static void getOrderedPolyLine(RoadGraph& roads, RoadEdgeDesc e, std::vector<QVector2D>& polyline);
 	static Polyline2D orderPolyLine(RoadGraph& roads, RoadEdgeDesc e, RoadVertexDesc src);
 	static Polyline2D orderPolyLine(RoadGraph& roads, RoadEdgeDesc e, RoadVertexDesc src, float angle);
+	static void setPolyline(RoadGraph& roads, RoadEdgeDesc e, const Polyline2D& polyline);
 	static void moveEdge(RoadGraph& roads, RoadEdgeDesc e, QVector2D& src_pos, QVector2D& tgt_pos);
 	static void movePolyline(RoadGraph& roads, Polyline2D &polyline, const QVector2D& src_pos, const QVector2D& tgt_pos);
 	static bool isSimilarPolyline(const Polyline2D &polyline1, const Polyline2D &polyline2);
@@ -65,6 +89,7 @@ public:
 	static RoadVertexDesc splitEdge(RoadGraph &roads, RoadEdgeDesc edge_desc, const QVector2D& pt, RoadEdgeDesc &edge1, RoadEdgeDesc &edge2);
 	static bool hasCloseEdge(RoadGraph* roads, RoadVertexDesc v1, RoadVertexDesc v2, float angle_threshold = 0.3f);
 	static bool isIntersect(RoadGraph &smallRoads, RoadGraph &largeRoads);
+	static RoadEdgeDescs getIntersectCandidates(RoadGraph &roads, const Polyline2D &polyline);
 	static bool isIntersect(RoadGraph &roads, const Polyline2D &polyline);
 	static bool isIntersect(RoadGraph &roads, const Polyline2D &polyline, QVector2D &intPoint);
 	static bool isIntersect(RoadGraph &roads, const Polyline2D &polyline, RoadVertexDesc srcDesc, QVector2D &intPoint);
@@ -88,7 +113,7 @@ public:
 	static Polyline2D getAdjoiningPolyline(RoadGraph& roads, RoadVertexDesc v_desc, RoadVertexDesc& root_desc);
 
 	// File I/O
-	static void loadRoads(RoadGraph& roads, const QString& filename, int roadType = 0);
+	static bool loadRoads(RoadGraph& roads, const QString& filename, int roadType = 0);
 	static void saveRoads(RoadGraph& roads, const QString& filename);
 
 	// The entire graph related functions
@@ -118,6 +143,9 @@ public:
 
 	// The road graph modification functions
 	static void clean(RoadGraph& roads);
+	static std::vector<RoadVertexDesc> compact(RoadGraph& roads, std::vector<int>* edgeRemap = NULL);
+	static float getTombstoneRatio(RoadGraph& roads);
+	static bool compactIfNeeded(RoadGraph& roads, float maxTombstoneRatio = 0.25f, std::vector<RoadVertexDesc>* vertexRemap = NULL);
 	static void reduce(RoadGraph& roads);
 	static bool reduce(RoadGraph& roads, RoadVertexDesc desc);
 	static void simplify(RoadGraph& roads, float dist_threshold);
@@ -128,6 +156,7 @@ public:
 	static void singlify(RoadGraph& roads);
 	static void planarify(RoadGraph& roads);
 	static bool planarifyOne(RoadGraph& roads);
+	static int planarifyBatch(RoadGraph& roads);
 	static void skeltonize(RoadGraph* roads);
 	static void rotate(RoadGraph& roads, float theta, const QVector2D& rotationCenter = QVector2D(0, 0));
 	static void translate(RoadGraph& roads, const QVector2D& offset);
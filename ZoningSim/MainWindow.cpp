@@ -1,5 +1,6 @@
 #include "MainWindow.h"
 #include <QFileDialog>
+#include <QMessageBox>
 #include "ParameterSettingWidget.h"
 
 MainWindow::MainWindow(QWidget *parent, Qt::WFlags flags) : QMainWindow(parent, flags) {
@@ -24,13 +25,21 @@ void MainWindow::onLoadRoads() {
 	QString filename = QFileDialog::getOpenFileName(this, tr("Open Street Map file..."), "", tr("StreetMap Files (*.gsm)"));
 	if (filename.isEmpty()) return;
 
-	glWidget->loadRoads(filename);
+	if (!glWidget->loadRoads(filename)) {
+		QMessageBox::warning(this, tr("Load roads"), tr("%1 could not be loaded.").arg(filename));
+		return;
+	}
 	glWidget->updateGL();
 }
 
 void MainWindow::onParameters() {
-	ParameterSettingWidget dlg(this, glWidget->zoning->weights);
+	QMap<QString, float> weights = glWidget->zoning->weights;
+	ParameterSettingWidget dlg(this, weights);
 	if (dlg.exec() != QDialog::Accepted) {
 		return;
 	}
+
+	glWidget->zoning->setWeights(weights);
+	glWidget->zoning->refresh();
+	glWidget->updateGL();
 }
@@ -0,0 +1,260 @@
+﻿#include "NetworkAccessibility.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include <queue>
+#include <limits>
+#include <functional>
+
+NetworkAccessibility::NetworkAccessibility() {
+	snapDistance = 200.0f;
+	walkSpeed = 1.4f;
+	timeScale = 300.0f;
+	targetTypes = RoadEdge::TYPE_HIGHWAY | RoadEdge::TYPE_AVENUE;
+}
+
+/**
+ * 道路グラフから、逆向きのエッジのCSRと、セルの中心を接続するエッジのポリラインを作成する。
+ */
+void NetworkAccessibility::build(const RoadGraphCSR& roads) {
+	ZONING_TRACE_SCOPE("NetworkAccessibility::build");
+
+	const int num_vertices = roads.numVertices();
+	vertex_valid.resize(num_vertices);
+	sources.assign(num_vertices, false);
+	for (int v = 0; v < num_vertices; ++v) {
+		vertex_valid[v] = roads.vertexValid(v);
+	}
+
+	snap_edges.clear();
+	snap_points.clear();
+	snap_lengths.clear();
+	snap_point_edges.clear();
+
+	// 進める向き (from -> to) ごとに、エッジを列挙する
+	std::vector<int> from, to;
+	std::vector<float> cost;
+	for (int e = 0; e < roads.numEdges(); ++e) {
+		int src = roads.source(e);
+		int tgt = roads.target(e);
+
+		// 削除されたエッジと、削除された頂点に接続するエッジは、通れない
+		if (!roads.edgeValid(e) || !vertex_valid[src] || !vertex_valid[tgt]) continue;
+
+		float time = roads.length(e) / speed(roads.type(e), roads.lanes(e));
+
+		if (roads.type(e) & targetTypes) {
+			sources[src] = true;
+			sources[tgt] = true;
+		}
+
+		bool src_first = true;
+		if (roads.polylineSize(e) > 0) {
+			QVector2D p0 = roads.polyline(e)[0];
+			src_first = (p0 - roads.vertexPt(src)).lengthSquared() <= (p0 - roads.vertexPt(tgt)).lengthSquared();
+		}
+
+		// 一方通行の場合は、ポリラインの始点に近い頂点から、もう一方の頂点へだけ進める
+		bool one_way = roads.oneWay(e) && roads.polylineSize(e) > 0;
+		bool forward = !one_way || src_first;
+		bool backward = !one_way || !src_first;
+
+		SnapEdge snap;
+		snap.from = src_first ? src : tgt;
+		snap.to = src_first ? tgt : src;
+		snap.time = time;
+		snap.oneWay = one_way;
+		snap.first = snap_points.size();
+		if (roads.polylineSize(e) >= 2) {
+			for (int i = 0; i < roads.polylineSize(e); ++i) {
+				addSnapPoint(roads.polyline(e)[i], snap_edges.size());
+			}
+		} else {
+			addSnapPoint(roads.vertexPt(snap.from), snap_edges.size());
+			addSnapPoint(roads.vertexPt(snap.to), snap_edges.size());
+		}
+		snap.last = snap_points.size();
+		snap_edges.push_back(snap);
+
+		if (forward) {
+			from.push_back(src);
+			to.push_back(tgt);
+			cost.push_back(time);
+		}
+		if (backward) {
+			from.push_back(tgt);
+			to.push_back(src);
+			cost.push_back(time);
+		}
+	}
+
+	// 到着側の頂点ごとにまとめる（計数ソート）
+	offsets.assign(num_vertices + 1, 0);
+	for (int i = 0; i < to.size(); ++i) {
+		offsets[to[i] + 1]++;
+	}
+	for (int v = 0; v < num_vertices; ++v) {
+		offsets[v + 1] += offsets[v];
+	}
+	targets.resize(to.size());
+	costs.resize(to.size());
+	std::vector<int> pos(offsets.begin(), offsets.end() - 1);
+	for (int i = 0; i < to.size(); ++i) {
+		int k = pos[to[i]]++;
+		targets[k] = from[i];
+		costs[k] = cost[i];
+	}
+}
+
+/**
+ * 目的地の道路に接している全ての頂点を始点として、逆向きのエッジで多始点ダイクストラ法を実行し、
+ * 各頂点から最も近い目的地までの移動時間を求める。
+ */
+void NetworkAccessibility::computeTravelTimes() {
+	ZONING_TRACE_SCOPE("NetworkAccessibility::computeTravelTimes");
+
+	typedef std::pair<float, int> Entry;
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> > queue;
+
+	times.assign(vertex_valid.size(), std::numeric_limits<float>::infinity());
+	for (int v = 0; v < vertex_valid.size(); ++v) {
+		if (!sources[v]) continue;
+		times[v] = 0.0f;
+		queue.push(Entry(0.0f, v));
+	}
+
+	while (!queue.empty()) {
+		Entry entry = queue.top();
+		queue.pop();
+		int v = entry.second;
+		if (entry.first > times[v]) continue;
+
+		for (int k = offsets[v]; k < offsets[v + 1]; ++k) {
+			int u = targets[k];
+			float t = entry.first + costs[k];
+			if (t < times[u]) {
+				times[u] = t;
+				queue.push(Entry(t, u));
+			}
+		}
+	}
+}
+
+/**
+ * 各セルの中心を近くの道路上の点に接続し、移動時間からアクセシビリティを計算する。
+ * computeTravelTimes()の後に呼び出すこと。
+ *
+ * @param city_length		都市の一辺の長さ [m]
+ * @param grid_size			グリッドの一辺のサイズ
+ * @param accessibility		[OUT] アクセシビリティ
+ */
+void NetworkAccessibility::apply(float city_length, int grid_size, cv::Mat_<float>& accessibility) const {
+	ZONING_TRACE_SCOPE("NetworkAccessibility::apply");
+
+	// snapDistance四方のバケットに線分を分けておけば、接続できる線分は周囲3x3のバケットに全て含まれる
+	// 各線分は、バウンディングボックスが重なる全てのバケットに登録する
+	const float bucket_length = std::max(snapDistance, city_length / grid_size);
+	const int num_buckets = std::max(1, (int)ceil(city_length / bucket_length));
+	auto forEachBucket = [&](int i, std::function<void(int)> func) {
+		const SnapEdge& edge = snap_edges[snap_point_edges[i]];
+		if (times[edge.to] == std::numeric_limits<float>::infinity() && (edge.oneWay || times[edge.from] == std::numeric_limits<float>::infinity())) return;
+
+		const QVector2D& a = snap_points[i];
+		const QVector2D& b = snap_points[i + 1];
+		int bx0 = std::max(0, (int)floor((std::min(a.x(), b.x()) + city_length * 0.5f) / bucket_length));
+		int bx1 = std::min(num_buckets - 1, (int)floor((std::max(a.x(), b.x()) + city_length * 0.5f) / bucket_length));
+		int by0 = std::max(0, (int)floor((std::min(a.y(), b.y()) + city_length * 0.5f) / bucket_length));
+		int by1 = std::min(num_buckets - 1, (int)floor((std::max(a.y(), b.y()) + city_length * 0.5f) / bucket_length));
+		for (int by = by0; by <= by1; ++by) {
+			for (int bx = bx0; bx <= bx1; ++bx) {
+				func(by * num_buckets + bx);
+			}
+		}
+	};
+
+	std::vector<int> bucket_offsets(num_buckets * num_buckets + 1, 0);
+	for (int i = 0; i + 1 < snap_points.size(); ++i) {
+		if (i + 1 == snap_edges[snap_point_edges[i]].last) continue;
+		forEachBucket(i, [&](int b) { bucket_offsets[b + 1]++; });
+	}
+	for (int b = 0; b < num_buckets * num_buckets; ++b) {
+		bucket_offsets[b + 1] += bucket_offsets[b];
+	}
+	std::vector<int> bucket_segments(bucket_offsets.back());
+	std::vector<int> pos(bucket_offsets.begin(), bucket_offsets.end() - 1);
+	for (int i = 0; i + 1 < snap_points.size(); ++i) {
+		if (i + 1 == snap_edges[snap_point_edges[i]].last) continue;
+		forEachBucket(i, [&](int b) { bucket_segments[pos[b]++] = i; });
+	}
+
+	const float cell_length = city_length / grid_size;
+	const float snap2 = snapDistance * snapDistance;
+	ThreadPool::forEachTile(grid_size, grid_size, [&](int tile, int r0, int r1) {
+		for (int r = r0; r < r1; ++r) {
+			float y = (r + 0.5f) * cell_length - city_length * 0.5f;
+			int by = (int)floor((y + city_length * 0.5f) / bucket_length);
+			for (int c = 0; c < grid_size; ++c) {
+				float x = (c + 0.5f) * cell_length - city_length * 0.5f;
+				int bx = (int)floor((x + city_length * 0.5f) / bucket_length);
+
+				float best = std::numeric_limits<float>::infinity();
+				for (int b2 = std::max(0, by - 1); b2 <= std::min(num_buckets - 1, by + 1); ++b2) {
+					for (int b1 = std::max(0, bx - 1); b1 <= std::min(num_buckets - 1, bx + 1); ++b1) {
+						int b = b2 * num_buckets + b1;
+						for (int k = bucket_offsets[b]; k < bucket_offsets[b + 1]; ++k) {
+							int i = bucket_segments[k];
+							const QVector2D& p0 = snap_points[i];
+							const QVector2D& p1 = snap_points[i + 1];
+
+							// 線分上の最も近い点
+							float dx = p1.x() - p0.x();
+							float dy = p1.y() - p0.y();
+							float len2 = SQR(dx) + SQR(dy);
+							float t = len2 > 0.0f ? std::min(std::max(((x - p0.x()) * dx + (y - p0.y()) * dy) / len2, 0.0f), 1.0f) : 0.0f;
+							float d2 = SQR(p0.x() + t * dx - x) + SQR(p0.y() + t * dy - y);
+							if (d2 > snap2) continue;
+
+							// その点の移動時間を、エッジの両端の頂点の移動時間から求める
+							const SnapEdge& edge = snap_edges[snap_point_edges[i]];
+							float total = snap_lengths[edge.last - 1];
+							float ratio = total > 0.0f ? (snap_lengths[i] + t * (snap_lengths[i + 1] - snap_lengths[i])) / total : 0.0f;
+							float time = times[edge.to] + (1.0f - ratio) * edge.time;
+							if (!edge.oneWay) time = std::min(time, times[edge.from] + ratio * edge.time);
+
+							best = std::min(best, sqrtf(d2) / walkSpeed + time);
+						}
+					}
+				}
+
+				accessibility(r, c) = best == std::numeric_limits<float>::infinity() ? 0.0f : expf(-best / timeScale);
+			}
+		}
+	});
+}
+
+/**
+ * セルの中心を接続するエッジのポリラインに、点を追加する。
+ */
+void NetworkAccessibility::addSnapPoint(const QVector2D& pt, int edge) {
+	float length = 0.0f;
+	if (!snap_points.empty() && snap_point_edges.back() == edge) {
+		length = snap_lengths.back() + (pt - snap_points.back()).length();
+	}
+	snap_points.push_back(pt);
+	snap_lengths.push_back(length);
+	snap_point_edges.push_back(edge);
+}
+
+/**
+ * 道路の種類と車線数から、走行速度 [m/s] を返却する。
+ */
+float NetworkAccessibility::speed(int type, int lanes) {
+	float speed;
+	if (type == RoadEdge::TYPE_HIGHWAY) speed = 25.0f;
+	else if (type == RoadEdge::TYPE_BOULEVARD) speed = 17.0f;
+	else if (type == RoadEdge::TYPE_AVENUE) speed = 14.0f;
+	else if (type == RoadEdge::TYPE_STREET) speed = 8.0f;
+	else speed = 5.0f;
+
+	// 車線が多いほど、少し速く走れる
+	return speed * (1.0f + 0.1f * (std::min(std::max(lanes, 1), 4) - 1));
+}
@@ -0,0 +1,68 @@
+﻿#pragma once
+
+#include <vector>
+#include <opencv/cv.h>
+#include "RoadGraphCSR.h"
+
+/**
+ * 道路ネットワーク上の移動時間から、アクセシビリティを計算する。
+ *
+ * 道路グラフのスナップショット（RoadGraphCSR）から、逆向きのエッジのCSRを作り、対象の種類の道路（既定では高速道路と幹線道路）の頂点から、
+ * 逆向きに多始点ダイクストラ法で、各頂点から最も近い対象の道路までの移動時間を求める。
+ * エッジの移動時間は、道路長を、道路の種類と車線数から決めた速度で割ったもの。一方通行の道路は、ポリラインの向きにだけ進める。
+ *
+ * 各セルの中心は、snapDistance以内にある道路上の最も近い点に徒歩で接続し、(徒歩の時間 + その点の移動時間) の最小値を、
+ * そのセルの移動時間とする。道路上の点の移動時間は、エッジに沿って両端の頂点まで進み、その頂点の移動時間を足したもの。
+ * アクセシビリティは exp(-移動時間 / timeScale) で、どの道路にも接続できないセルは0になる。
+ */
+class NetworkAccessibility {
+public:
+	float snapDistance;		// セルの中心から道路まで、徒歩で接続できる最大距離 [m]
+	float walkSpeed;		// 徒歩の速度 [m/s]
+	float timeScale;		// アクセシビリティが1/eになる移動時間 [sec]
+	int targetTypes;		// 目的地とする道路の種類（RoadEdge::TYPE_xxxのOR）
+
+private:
+	/**
+	 * セルの中心を接続するエッジ。ポリラインの点は、snap_pointsの[first, last)。
+	 */
+	struct SnapEdge {
+		int from;		// ポリラインの始点に近い頂点
+		int to;			// ポリラインの終点に近い頂点
+		float time;		// エッジの移動時間 [sec]
+		bool oneWay;	// fromからtoへだけ進めるか
+		int first;
+		int last;
+	};
+
+	// 道路グラフのCSR（逆向きのエッジ：頂点vの隣接は、vへ進めるエッジの始点）
+	std::vector<bool> vertex_valid;
+	std::vector<int> offsets;
+	std::vector<int> targets;
+	std::vector<float> costs;		// エッジの移動時間 [sec]
+	std::vector<bool> sources;		// 目的地の道路に接している頂点
+
+	// セルの中心を接続する、有効なエッジのポリライン
+	std::vector<SnapEdge> snap_edges;
+	std::vector<QVector2D> snap_points;
+	std::vector<float> snap_lengths;	// ポリラインの始点から各点までの長さ
+	std::vector<int> snap_point_edges;	// 各点が属するエッジ（snap_edgesの番号）
+
+	std::vector<float> times;		// 各頂点から目的地までの移動時間 [sec]
+
+public:
+	NetworkAccessibility();
+
+	void build(const RoadGraphCSR& roads);
+	void computeTravelTimes();
+	void apply(float city_length, int grid_size, cv::Mat_<float>& accessibility) const;
+
+	int numVertices() const { return vertex_valid.size(); }
+	int numEdges() const { return targets.size(); }
+	float travelTime(int v) const { return times[v]; }
+
+	static float speed(int type, int lanes);
+
+private:
+	void addSnapPoint(const QVector2D& pt, int edge);
+};
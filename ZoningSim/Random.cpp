@@ -0,0 +1,272 @@
+﻿#include "Random.h"
+#include <cmath>
+#include <atomic>
+#include <algorithm>
+
+namespace {
+	const uint32_t PHILOX_M0 = 0xD2511F53;
+	const uint32_t PHILOX_M1 = 0xCD9E8D57;
+	const uint32_t PHILOX_W0 = 0x9E3779B9;
+	const uint32_t PHILOX_W1 = 0xBB67AE85;
+	const double TWO_PI = 6.283185307179586;
+
+	/**
+	 * SplitMix64で、シードをキーに変換する。
+	 */
+	uint64_t splitmix64(uint64_t x) {
+		x += 0x9E3779B97F4A7C15ULL;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+		return x ^ (x >> 31);
+	}
+
+	inline void philoxRound(uint32_t ctr[4], const uint32_t key[2]) {
+		uint64_t p0 = (uint64_t)PHILOX_M0 * ctr[0];
+		uint64_t p1 = (uint64_t)PHILOX_M1 * ctr[2];
+		uint32_t c0 = (uint32_t)(p1 >> 32) ^ ctr[1] ^ key[0];
+		uint32_t c1 = (uint32_t)p1;
+		uint32_t c2 = (uint32_t)(p0 >> 32) ^ ctr[3] ^ key[1];
+		uint32_t c3 = (uint32_t)p0;
+		ctr[0] = c0;
+		ctr[1] = c1;
+		ctr[2] = c2;
+		ctr[3] = c3;
+	}
+}
+
+Random::Random() {
+	*this = Random(0);
+}
+
+/**
+ * 乱数列を (seed, step, id) で初期化する。
+ *
+ * @param seed		乱数シード
+ * @param step		シミュレーションのステップ番号など
+ * @param id		セル番号、スレッド番号など
+ */
+Random::Random(uint64_t seed, uint32_t step, uint32_t id) {
+	uint64_t k = splitmix64(seed);
+	key[0] = (uint32_t)k;
+	key[1] = (uint32_t)(k >> 32);
+	counter[0] = 0;
+	counter[1] = 0;
+	counter[2] = step;
+	counter[3] = id;
+	block_pos = 4;
+}
+
+/**
+ * 32bitの乱数を返却する。
+ */
+uint32_t Random::nextUInt() {
+	if (block_pos >= 4) generateBlock();
+	return block[block_pos++];
+}
+
+/**
+ * [0, 1)のUniform乱数を返却する。
+ */
+float Random::uniform() {
+	return (nextUInt() >> 8) * (1.0f / 16777216.0f);
+}
+
+/**
+ * [a, b)のUniform乱数を返却する。
+ */
+float Random::uniform(float a, float b) {
+	return uniform() * (b - a) + a;
+}
+
+/**
+ * 53bitの精度を持つ、[0, 1)のUniform乱数を返却する。
+ */
+double Random::uniformDouble() {
+	uint64_t hi = nextUInt() >> 5;
+	uint64_t lo = nextUInt() >> 6;
+	return (hi * 67108864.0 + lo) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * 正規分布N(mean, variance)に従う乱数を返却する。
+ */
+float Random::normal(float mean, float variance) {
+	float n;
+	fillNormal(&n, 1, mean, variance);
+	return n;
+}
+
+/**
+ * 二項分布B(n, p)に従う乱数を生成する。
+ * 平均が小さい場合はwaiting time法で正確にサンプリングし、大きい場合は正規分布で近似する。
+ */
+int Random::binomial(int n, float p) {
+	if (n <= 0 || p <= 0.0f) return 0;
+	if (p >= 1.0f) return n;
+
+	// p > 0.5の場合は、失敗の回数をサンプリングする
+	if (p > 0.5f) return n - binomial(n, 1.0f - p);
+
+	float mean = n * p;
+	if (mean < 30.0f) {
+		float q = -log(1.0f - p);
+		float sum = 0.0f;
+		int x = 0;
+		while (x < n) {
+			sum += -log(1.0f - uniform()) / (n - x);
+			if (sum > q) break;
+			x++;
+		}
+		return x;
+	} else {
+		int x = (int)floor(normal(mean, mean * (1.0f - p)) + 0.5f);
+		return std::min(std::max(x, 0), n);
+	}
+}
+
+int Random::sampleFromCdf(const std::vector<float> &cdf) {
+	float rnd = uniform(0, cdf.back());
+
+	for (int i = 0; i < cdf.size(); ++i) {
+		if (rnd <= cdf[i]) return i;
+	}
+
+	return cdf.size() - 1;
+}
+
+int Random::sampleFromPdf(const std::vector<float> &pdf) {
+	if (pdf.size() == 0) return 0;
+
+	std::vector<float> cdf(pdf.size(), 0.0f);
+	cdf[0] = pdf[0];
+	for (int i = 1; i < pdf.size(); ++i) {
+		if (pdf[i] >= 0) {
+			cdf[i] = cdf[i - 1] + pdf[i];
+		} else {
+			cdf[i] = cdf[i - 1];
+		}
+	}
+
+	return sampleFromCdf(cdf);
+}
+
+/**
+ * n個を、pdfの比率に従って多項分布でサンプリングし、各要素の個数をcountsに格納する。
+ * 条件付き二項分布を順番にサンプリングするので、計算量はpdfのサイズに比例する。
+ * pdfの負の値は0として扱う。pdfが全て0の場合は、一様分布とみなす。
+ */
+void Random::sampleMultinomial(int n, const std::vector<float> &pdf, std::vector<int> &counts) {
+	counts.assign(pdf.size(), 0);
+	if (pdf.size() == 0 || n <= 0) return;
+
+	double total = 0.0;
+	int last = pdf.size() - 1;
+	for (int i = 0; i < pdf.size(); ++i) {
+		if (pdf[i] > 0) {
+			total += pdf[i];
+			last = i;
+		}
+	}
+
+	double mass = total;
+	for (int i = 0; i <= last && n > 0; ++i) {
+		// 最後の要素には、残りを全て割り当てる
+		if (i == last) {
+			counts[i] = n;
+			break;
+		}
+
+		float p;
+		if (total > 0.0) {
+			if (pdf[i] <= 0) continue;
+			p = (float)(pdf[i] / mass);
+			mass -= pdf[i];
+		} else {
+			p = 1.0f / (pdf.size() - i);
+		}
+
+		counts[i] = binomial(n, p);
+		n -= counts[i];
+	}
+}
+
+/**
+ * [a, b)のUniform乱数をn個、まとめて生成する。
+ */
+void Random::fillUniform(float* out, int n, float a, float b) {
+	float scale = (b - a) * (1.0f / 16777216.0f);
+
+	int i = 0;
+
+	// 残っているブロックを使い切る
+	while (i < n && block_pos < 4) {
+		out[i++] = (block[block_pos++] >> 8) * scale + a;
+	}
+
+	// ブロック単位で生成する
+	for (; i + 4 <= n; i += 4) {
+		generateBlock();
+		out[i] = (block[0] >> 8) * scale + a;
+		out[i + 1] = (block[1] >> 8) * scale + a;
+		out[i + 2] = (block[2] >> 8) * scale + a;
+		out[i + 3] = (block[3] >> 8) * scale + a;
+	}
+	block_pos = 4;
+
+	for (; i < n; ++i) {
+		out[i] = (nextUInt() >> 8) * scale + a;
+	}
+}
+
+/**
+ * 正規分布N(mean, variance)に従う乱数をn個、Box-Muller法でまとめて生成する。
+ */
+void Random::fillNormal(float* out, int n, float mean, float variance) {
+	float s = sqrtf(variance);
+
+	for (int i = 0; i < n; i += 2) {
+		// u1は(0, 1]にして、logが発散しないようにする
+		double u1 = 1.0 - uniformDouble();
+		double u2 = uniformDouble();
+		double r = sqrt(-2.0 * log(u1));
+		out[i] = (float)(mean + s * r * cos(TWO_PI * u2));
+		if (i + 1 < n) {
+			out[i + 1] = (float)(mean + s * r * sin(TWO_PI * u2));
+		}
+	}
+}
+
+/**
+ * 呼び出したスレッド専用の乱数列を返却する。
+ * 乱数列を明示的に持たないコード（Util::genRandなど）から使用する。
+ * スレッドごとに別の乱数列になるので、ロックは不要だが、スレッドをまたいだ再現性はない。
+ */
+Random& Random::threadDefault() {
+	static std::atomic<uint32_t> num_threads(0);
+	thread_local Random rng(0, 0, num_threads++);
+	return rng;
+}
+
+/**
+ * 次のブロック（32bit x 4）を生成し、カウンタを進める。
+ */
+void Random::generateBlock() {
+	uint32_t ctr[4] = { counter[0], counter[1], counter[2], counter[3] };
+	uint32_t k[2] = { key[0], key[1] };
+
+	for (int round = 0; round < 10; ++round) {
+		if (round > 0) {
+			k[0] += PHILOX_W0;
+			k[1] += PHILOX_W1;
+		}
+		philoxRound(ctr, k);
+	}
+
+	block[0] = ctr[0];
+	block[1] = ctr[1];
+	block[2] = ctr[2];
+	block[3] = ctr[3];
+	block_pos = 0;
+
+	if (++counter[0] == 0) counter[1]++;
+}
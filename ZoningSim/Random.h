@@ -0,0 +1,42 @@
+﻿#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+/**
+ * Counter-basedの乱数生成器 (Philox4x32-10)。
+ *
+ * 乱数列は (seed, step, id) の組で決まり、内部状態はカウンタだけなので、
+ * ステップごと・セルごと・スレッドごとに独立な乱数列を、お互いに干渉せずに作ることができる。
+ * 同じ (seed, step, id) からは、スレッド数や実行順序に関係なく、常に同じ乱数列が得られる。
+ */
+class Random {
+private:
+	uint32_t key[2];
+	uint32_t counter[4];	// [0], [1]: ブロック番号, [2]: step, [3]: id
+	uint32_t block[4];		// 最後に生成したブロック
+	int block_pos;			// blockの中で、次に使う位置
+
+public:
+	Random();
+	Random(uint64_t seed, uint32_t step = 0, uint32_t id = 0);
+
+	uint32_t nextUInt();
+	float uniform();
+	float uniform(float a, float b);
+	double uniformDouble();
+	float normal(float mean, float variance);
+	int binomial(int n, float p);
+	int sampleFromCdf(const std::vector<float> &cdf);
+	int sampleFromPdf(const std::vector<float> &pdf);
+	void sampleMultinomial(int n, const std::vector<float> &pdf, std::vector<int> &counts);
+
+	// 一括生成
+	void fillUniform(float* out, int n, float a = 0.0f, float b = 1.0f);
+	void fillNormal(float* out, int n, float mean, float variance);
+
+	static Random& threadDefault();
+
+private:
+	void generateBlock();
+};
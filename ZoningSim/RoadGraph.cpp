@@ -1,16 +1,39 @@
 ﻿#include "RoadGraph.h"
-#include <QGLWidget>
 #include "Util.h"
+#include "VertexIndex.h"
+#include "EdgeIndex.h"
 
 RoadGraph::RoadGraph() {
 	modified = false;
 }
 
+/**
+ * Copy the graph. The spatial indices are not copied.
+ */
+RoadGraph::RoadGraph(const RoadGraph& ref) : modified(ref.modified), graph(ref.graph) {
+}
+
 RoadGraph::~RoadGraph() {
 }
 
+/**
+ * Copy the graph. The spatial indices of this graph, if any, are kept and rebuilt on their next use.
+ */
+RoadGraph& RoadGraph::operator=(const RoadGraph& ref) {
+	if (this == &ref) return *this;
+
+	graph = ref.graph;
+	modified = ref.modified;
+	if (vertexIndex) vertexIndex->invalidate();
+	if (edgeIndex) edgeIndex->invalidate();
+
+	return *this;
+}
+
 void RoadGraph::clear() {
 	graph.clear();
 	modified = true;
+	if (vertexIndex) vertexIndex->invalidate();
+	if (edgeIndex) edgeIndex->invalidate();
 }
 
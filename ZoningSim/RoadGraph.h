@@ -19,15 +19,23 @@ typedef graph_traits<BGLGraph>::in_edge_iterator RoadInEdgeIter;
 typedef std::vector<RoadEdgeDesc> RoadEdgeDescs;
 typedef std::vector<RoadVertexDesc> RoadVertexDescs;
 
+class VertexIndex;
+class EdgeIndex;
+
 class RoadGraph {
 public:
 	bool modified;
 	BGLGraph graph;
+	boost::shared_ptr<VertexIndex> vertexIndex;	// optional spatial index of the vertices (see GraphUtil::buildVertexIndex)
+	boost::shared_ptr<EdgeIndex> edgeIndex;		// optional spatial index of the edge segments (see GraphUtil::buildEdgeIndex)
 
 public:
 	RoadGraph();
+	RoadGraph(const RoadGraph& ref);
 	~RoadGraph();
 
+	RoadGraph& operator=(const RoadGraph& ref);
+
 	void setModified() { modified = true; }
 
 	void clear();
@@ -0,0 +1,107 @@
+﻿#include "RoadGraphCSR.h"
+#include "Trace.h"
+
+RoadGraphCSR::RoadGraphCSR() {
+	built = false;
+}
+
+/**
+ * RoadGraphが変更されていれば、作り直す。
+ *
+ * @return		作り直したらtrue
+ */
+bool RoadGraphCSR::sync(RoadGraph& roads) {
+	if (built && !roads.modified) return false;
+
+	build(roads);
+	roads.modified = false;
+	return true;
+}
+
+/**
+ * RoadGraphから作り直す。
+ */
+void RoadGraphCSR::build(const RoadGraph& roads) {
+	ZONING_TRACE_SCOPE("RoadGraphCSR::build");
+
+	const int num_vertices = boost::num_vertices(roads.graph);
+	const int num_edges = boost::num_edges(roads.graph);
+
+	vertex_pts.resize(num_vertices);
+	vertex_flags.resize(num_vertices);
+	for (int v = 0; v < num_vertices; ++v) {
+		vertex_pts[v] = roads.graph[v]->pt;
+		vertex_flags[v] = roads.graph[v]->valid ? FLAG_VALID : 0;
+	}
+
+	edge_sources.resize(num_edges);
+	edge_targets.resize(num_edges);
+	edge_types.resize(num_edges);
+	edge_lanes.resize(num_edges);
+	edge_flags.resize(num_edges);
+	edge_lengths.resize(num_edges);
+	polyline_offsets.resize(num_edges + 1);
+	points.clear();
+
+	int e = 0;
+	polyline_offsets[0] = 0;
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ++ei, ++e) {
+		const RoadEdge& edge = *roads.graph[*ei];
+		edge_sources[e] = boost::source(*ei, roads.graph);
+		edge_targets[e] = boost::target(*ei, roads.graph);
+		edge_types[e] = edge.type;
+		edge_lanes[e] = edge.lanes;
+		edge_flags[e] = (edge.valid ? FLAG_VALID : 0) | (edge.oneWay ? FLAG_ONEWAY : 0) | (edge.link ? FLAG_LINK : 0) | (edge.roundabout ? FLAG_ROUNDABOUT : 0);
+
+		float length = 0.0f;
+		for (int i = 0; i < edge.polyline.size(); ++i) {
+			if (i > 0) length += (edge.polyline[i] - edge.polyline[i - 1]).length();
+			points.push_back(edge.polyline[i]);
+		}
+		edge_lengths[e] = length;
+		polyline_offsets[e + 1] = points.size();
+	}
+
+	// 頂点ごとに、接続するエッジをまとめる（計数ソート）
+	adj_offsets.assign(num_vertices + 1, 0);
+	for (int e = 0; e < num_edges; ++e) {
+		adj_offsets[edge_sources[e] + 1]++;
+		if (edge_targets[e] != edge_sources[e]) adj_offsets[edge_targets[e] + 1]++;
+	}
+	for (int v = 0; v < num_vertices; ++v) {
+		adj_offsets[v + 1] += adj_offsets[v];
+	}
+	adj_edges.resize(adj_offsets.back());
+	adj_vertices.resize(adj_offsets.back());
+	std::vector<int> pos(adj_offsets.begin(), adj_offsets.end() - 1);
+	for (int e = 0; e < num_edges; ++e) {
+		int src = edge_sources[e];
+		int tgt = edge_targets[e];
+		adj_edges[pos[src]] = e;
+		adj_vertices[pos[src]++] = tgt;
+		if (tgt != src) {
+			adj_edges[pos[tgt]] = e;
+			adj_vertices[pos[tgt]++] = src;
+		}
+	}
+
+	built = true;
+}
+
+void RoadGraphCSR::clear() {
+	vertex_pts.clear();
+	vertex_flags.clear();
+	edge_sources.clear();
+	edge_targets.clear();
+	edge_types.clear();
+	edge_lanes.clear();
+	edge_flags.clear();
+	edge_lengths.clear();
+	polyline_offsets.clear();
+	points.clear();
+	adj_offsets.clear();
+	adj_edges.clear();
+	adj_vertices.clear();
+	built = false;
+}
@@ -0,0 +1,73 @@
+﻿#pragma once
+
+#include <vector>
+#include <QVector2D>
+#include "RoadGraph.h"
+
+/**
+ * RoadGraphを、連続した配列（CSR）にコピーした、読み込み専用のスナップショット。
+ *
+ * 頂点の座標、エッジの種類・車線数・フラグ・長さはそれぞれ1つの配列に、
+ * 全てのエッジのポリラインの点は1つのバッファにまとめる。隣接関係は、頂点ごとのオフセットと、
+ * 接続するエッジ・隣接頂点の配列で表す（無向グラフなので、各エッジは両端の頂点に現れる）。
+ * 頂点の番号はRoadVertexDescと同じで、エッジの番号はboost::edges()の列挙順。
+ *
+ * sync()は、RoadGraph::modifiedがセットされている場合だけ作り直し、modifiedをクリアする。
+ * RoadGraphを直接書き換えた場合は、setModified()を呼んでおくこと。
+ */
+class RoadGraphCSR {
+public:
+	static enum { FLAG_VALID = 1, FLAG_ONEWAY = 2, FLAG_LINK = 4, FLAG_ROUNDABOUT = 8 };
+
+private:
+	// 頂点
+	std::vector<QVector2D> vertex_pts;
+	std::vector<unsigned char> vertex_flags;
+
+	// エッジ
+	std::vector<int> edge_sources;
+	std::vector<int> edge_targets;
+	std::vector<int> edge_types;
+	std::vector<int> edge_lanes;
+	std::vector<unsigned char> edge_flags;
+	std::vector<float> edge_lengths;
+	std::vector<int> polyline_offsets;		// エッジeのポリラインは points[polyline_offsets[e], polyline_offsets[e + 1])
+	std::vector<QVector2D> points;
+
+	// 隣接関係
+	std::vector<int> adj_offsets;			// 頂点vの隣接は [adj_offsets[v], adj_offsets[v + 1])
+	std::vector<int> adj_edges;
+	std::vector<int> adj_vertices;
+
+	bool built;
+
+public:
+	RoadGraphCSR();
+
+	bool sync(RoadGraph& roads);
+	void build(const RoadGraph& roads);
+	void clear();
+
+	int numVertices() const { return vertex_pts.size(); }
+	const QVector2D& vertexPt(int v) const { return vertex_pts[v]; }
+	bool vertexValid(int v) const { return (vertex_flags[v] & FLAG_VALID) != 0; }
+
+	int numEdges() const { return edge_sources.size(); }
+	int source(int e) const { return edge_sources[e]; }
+	int target(int e) const { return edge_targets[e]; }
+	int type(int e) const { return edge_types[e]; }
+	int lanes(int e) const { return edge_lanes[e]; }
+	bool edgeValid(int e) const { return (edge_flags[e] & FLAG_VALID) != 0; }
+	bool oneWay(int e) const { return (edge_flags[e] & FLAG_ONEWAY) != 0; }
+	bool link(int e) const { return (edge_flags[e] & FLAG_LINK) != 0; }
+	bool roundabout(int e) const { return (edge_flags[e] & FLAG_ROUNDABOUT) != 0; }
+	float length(int e) const { return edge_lengths[e]; }
+	int polylineSize(int e) const { return polyline_offsets[e + 1] - polyline_offsets[e]; }
+	const QVector2D* polyline(int e) const { return points.data() + polyline_offsets[e]; }
+
+	int degree(int v) const { return adj_offsets[v + 1] - adj_offsets[v]; }
+	int adjBegin(int v) const { return adj_offsets[v]; }
+	int adjEnd(int v) const { return adj_offsets[v + 1]; }
+	int adjEdge(int k) const { return adj_edges[k]; }
+	int adjVertex(int k) const { return adj_vertices[k]; }
+};
@@ -0,0 +1,203 @@
+﻿#include "RoadRasterizer.h"
+#include "common.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+const int RoadRasterizer::EDGES_PER_CHUNK = 256;
+
+/**
+ * 道路をラスタライズし、道路の種類ごとに、各セルの道路長を計算する。
+ * 一方通行の道路は、長さを半分として数える。
+ *
+ * @param roads			道路
+ * @param city_length	都市の一辺の長さ [m]
+ * @param grid_size		グリッドの一辺のサイズ
+ * @param road_length	[OUT] 道路の種類ごとの道路長（3つ）
+ */
+void RoadRasterizer::rasterize(const RoadGraphCSR& roads, float city_length, int grid_size, cv::Mat_<float>* road_length) {
+	const int num_edges = roads.numEdges();
+	const int num_tiles = ThreadPool::numTiles(grid_size, grid_size);
+	const int tile_rows = ThreadPool::tileRows(grid_size, grid_size);
+	const int num_chunks = (num_edges + EDGES_PER_CHUNK - 1) / EDGES_PER_CHUNK;
+	const float scale = grid_size / city_length;
+
+	// チャンクごとに、各セルに含まれる道路長を、タイルごとに分けて記録する
+	std::vector<Buckets> chunks(num_chunks, Buckets(num_tiles));
+	{
+		ZONING_TRACE_SCOPE("rasterizeRoads.walk");
+		ThreadPool::parallelFor(num_chunks, [&](int chunk) {
+			Buckets& buckets = chunks[chunk];
+			int end = std::min(num_edges, (chunk + 1) * EDGES_PER_CHUNK);
+			for (int e = chunk * EDGES_PER_CHUNK; e < end; ++e) {
+				int type = typeIndex(roads.type(e));
+				if (type < 0) continue;
+				float oneWay = roads.oneWay(e) ? 0.5f : 1.0f;
+
+				const QVector2D* polyline = roads.polyline(e);
+				for (int i = 0; i + 1 < roads.polylineSize(e); ++i) {
+					const QVector2D& a = polyline[i];
+					const QVector2D& b = polyline[i + 1];
+					float len = (b - a).length() * oneWay;
+					if (len <= 0.0f) continue;
+
+					QVector2D p0(a.x() * scale + grid_size * 0.5f, a.y() * scale + grid_size * 0.5f);
+					QVector2D p1(b.x() * scale + grid_size * 0.5f, b.y() * scale + grid_size * 0.5f);
+					walkSegment(p0, p1, len, type, grid_size, tile_rows, buckets);
+				}
+			}
+		});
+	}
+
+	// タイルごとに、チャンクの順に足し合わせる
+	cv::Mat_<float> density[3];
+	for (int i = 0; i < 3; ++i) {
+		density[i] = cv::Mat_<float>::zeros(grid_size, grid_size);
+	}
+	ThreadPool::forEachTile(grid_size, grid_size, [&](int tile, int r0, int r1) {
+		for (int chunk = 0; chunk < num_chunks; ++chunk) {
+			const std::vector<Sample>& samples = chunks[chunk][tile];
+			for (int k = 0; k < samples.size(); ++k) {
+				density[samples[k].type].ptr<float>()[samples[k].cell] += samples[k].length;
+			}
+		}
+	});
+
+	ZONING_TRACE_SCOPE("rasterizeRoads.falloff");
+	for (int i = 0; i < 3; ++i) {
+		road_length[i] = cv::Mat_<float>(grid_size, grid_size);
+		applyFalloff(density[i], road_length[i]);
+	}
+}
+
+/**
+ * 道路の種類から、道路長の種類を返却する。対象外の道路なら-1を返却する。
+ */
+int RoadRasterizer::typeIndex(int type) {
+	if (type == RoadEdge::TYPE_HIGHWAY) return 0;
+	else if (type == RoadEdge::TYPE_AVENUE) return 1;
+	else if (type == RoadEdge::TYPE_STREET) return 2;
+	else return -1;
+}
+
+/**
+ * グリッド座標のセグメントを、DDAでセルごとに辿り、各セルに含まれる部分の長さを記録する。
+ * グリッドの外の部分は無視する。
+ *
+ * @param p0		始点（グリッド座標）
+ * @param p1		終点（グリッド座標）
+ * @param length	セグメント全体の道路長 [m]
+ * @param type		道路長の種類
+ * @param grid_size	グリッドの一辺のサイズ
+ * @param tile_rows	1タイルの行数
+ * @param buckets	[OUT] タイルごとのサンプル
+ */
+void RoadRasterizer::walkSegment(const QVector2D& p0, const QVector2D& p1, float length, int type, int grid_size, int tile_rows, Buckets& buckets) {
+	const double x0 = p0.x();
+	const double y0 = p0.y();
+	const double dx = p1.x() - x0;
+	const double dy = p1.y() - y0;
+
+	// グリッドの範囲 [0, grid_size] x [0, grid_size] にクリップする
+	double t0 = 0.0;
+	double t1 = 1.0;
+	if (!clip(-dx, x0, t0, t1) || !clip(dx, grid_size - x0, t0, t1)) return;
+	if (!clip(-dy, y0, t0, t1) || !clip(dy, grid_size - y0, t0, t1)) return;
+	if (t0 >= t1) return;
+
+	// 軸に平行なセグメントが、グリッドの上端（または右端）の境界線上にある場合は、グリッドの外とみなす
+	if ((dx == 0.0 && x0 >= grid_size) || (dy == 0.0 && y0 >= grid_size)) return;
+
+	int col = std::min(std::max((int)floor(x0 + dx * t0), 0), grid_size - 1);
+	int row = std::min(std::max((int)floor(y0 + dy * t0), 0), grid_size - 1);
+	const int step_x = dx > 0 ? 1 : -1;
+	const int step_y = dy > 0 ? 1 : -1;
+	const double t_delta_x = dx != 0.0 ? 1.0 / fabs(dx) : std::numeric_limits<double>::infinity();
+	const double t_delta_y = dy != 0.0 ? 1.0 / fabs(dy) : std::numeric_limits<double>::infinity();
+	double t_max_x = dx != 0.0 ? ((dx > 0 ? col + 1 : col) - x0) / dx : std::numeric_limits<double>::infinity();
+	double t_max_y = dy != 0.0 ? ((dy > 0 ? row + 1 : row) - y0) / dy : std::numeric_limits<double>::infinity();
+
+	double t = t0;
+	while (true) {
+		double t_next = std::min(std::min(t_max_x, t_max_y), t1);
+		if (t_next > t) {
+			std::vector<Sample>& samples = buckets[row / tile_rows];
+			int cell = row * grid_size + col;
+			float len = (float)((t_next - t) * length);
+
+			// 同じセルが続く場合は、1つのサンプルにまとめる
+			if (!samples.empty() && samples.back().cell == cell && samples.back().type == type) {
+				samples.back().length += len;
+			} else {
+				Sample sample = { cell, type, len };
+				samples.push_back(sample);
+			}
+			t = t_next;
+		}
+		if (t_next >= t1) break;
+
+		if (t_max_x < t_max_y) {
+			col += step_x;
+			t_max_x += t_delta_x;
+		} else {
+			row += step_y;
+			t_max_y += t_delta_y;
+		}
+		if (col < 0 || col >= grid_size || row < 0 || row >= grid_size) break;
+	}
+}
+
+/**
+ * Liang-Barskyのクリッピングで、p * t <= q を満たすようにパラメータの範囲 [t0, t1] を狭める。
+ *
+ * @return		範囲が空になったらfalse
+ */
+bool RoadRasterizer::clip(double p, double q, double& t0, double& t1) {
+	if (p == 0.0) return q >= 0.0;
+
+	double r = q / p;
+	if (p < 0.0) {
+		if (r > t1) return false;
+		if (r > t0) t0 = r;
+	} else {
+		if (r < t0) return false;
+		if (r < t1) t1 = r;
+	}
+	return true;
+}
+
+/**
+ * 各セルの道路長を、5x5セルの範囲に、距離に応じた重み 1 / (1 + dist) で広げる。
+ * このカーネルは分離可能ではない（ランク3）ので、1次元に分けると却って遅くなる。
+ * そのため、各タイルで直接足し合わせる。グリッドの外のセルは0とみなす。
+ */
+void RoadRasterizer::applyFalloff(const cv::Mat_<float>& src, cv::Mat_<float>& dst) {
+	const int R = FALLOFF_RADIUS;
+	const int grid_size = src.rows;
+
+	float w[2 * R + 1][2 * R + 1];
+	for (int dy = -R; dy <= R; ++dy) {
+		for (int dx = -R; dx <= R; ++dx) {
+			w[dy + R][dx + R] = 1.0f / (1.0f + sqrtf(SQR(dx) + SQR(dy)));
+		}
+	}
+
+	ThreadPool::forEachTile(grid_size, grid_size, [&](int tile, int r0, int r1) {
+		for (int r = r0; r < r1; ++r) {
+			float* out = dst.ptr<float>(r);
+			for (int c = 0; c < grid_size; ++c) out[c] = 0.0f;
+
+			for (int dy = -R; dy <= R; ++dy) {
+				if (r + dy < 0 || r + dy >= grid_size) continue;
+				const float* in = src.ptr<float>(r + dy);
+				for (int dx = -R; dx <= R; ++dx) {
+					const float wt = w[dy + R][dx + R];
+					int c0 = std::max(0, -dx);
+					int c1 = std::min(grid_size, grid_size - dx);
+					for (int c = c0; c < c1; ++c) {
+						out[c] += wt * in[c + dx];
+					}
+				}
+			}
+		}
+	});
+}
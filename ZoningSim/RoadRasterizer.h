@@ -0,0 +1,42 @@
+﻿#pragma once
+
+#include <vector>
+#include <limits>
+#include <opencv/cv.h>
+#include <QVector2D>
+#include "RoadGraphCSR.h"
+
+/**
+ * 道路をグリッドにラスタライズし、道路の種類（高速道路、幹線道路、一般道路）ごとに、各セルの道路長を計算する。
+ *
+ * 各ポリラインのセグメントをDDAでセルごとに辿り、セルに含まれる部分の長さを正確に求める。
+ * その後、5x5セルの距離減衰 1 / (1 + dist) を畳み込む。
+ * エッジは固定サイズのチャンクに分けて並列に処理し、チャンクごとの結果をチャンクの順に足し合わせるので、
+ * 結果はスレッド数によらず一致する。
+ */
+class RoadRasterizer {
+public:
+	static const int EDGES_PER_CHUNK;
+	static const int FALLOFF_RADIUS = 2;
+
+private:
+	struct Sample {
+		int cell;		// row * grid_size + col
+		int type;		// 道路長の種類（0: 高速道路、1: 幹線道路、2: 一般道路）
+		float length;
+	};
+
+	typedef std::vector<std::vector<Sample> > Buckets;	// タイルごとのサンプル
+
+protected:
+	RoadRasterizer() {}
+
+public:
+	static void rasterize(const RoadGraphCSR& roads, float city_length, int grid_size, cv::Mat_<float>* road_length);
+	static int typeIndex(int type);
+
+private:
+	static void walkSegment(const QVector2D& p0, const QVector2D& p1, float length, int type, int grid_size, int tile_rows, Buckets& buckets);
+	static bool clip(double p, double q, double& t0, double& t1);
+	static void applyFalloff(const cv::Mat_<float>& src, cv::Mat_<float>& dst);
+};
@@ -0,0 +1,672 @@
+﻿#include "SimdKernels.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#else
+#define SIMD_X86 0
+#endif
+
+// GCC/Clangでは、関数ごとに命令セットを指定する。MSVCは、指定しなくても全ての組み込み関数を使える。
+// 乗算と加算がFMAにまとめられると、スカラー版と結果が一致しなくなるので、まとめないようにする。
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#define SIMD_TARGET(x) __attribute__((target(x)))
+#elif defined(__GNUC__)
+#define SIMD_TARGET(x) __attribute__((target(x), optimize("fp-contract=off")))
+#else
+#define SIMD_TARGET(x)
+#endif
+
+// MSVCは、VS2017 (_MSC_VER 1910) からAVX-512の組み込み関数を持つ。v140 (VS2015) では、AVX2までを使う。
+#if SIMD_X86 && (defined(_MSC_VER) ? _MSC_VER >= 1910 : (defined(__AVX512F__) || (defined(__GNUC__) && __GNUC__ >= 5) || defined(__clang__)))
+#define SIMD_AVX512 1
+#else
+#define SIMD_AVX512 0
+#endif
+
+namespace {
+
+// expfの多項式近似の係数（Cephes）
+// 入力はEXP_LOからEXP_HIに制限する。この範囲の外では、expfと同じく0と+infになる。
+const float EXP_HI = 89.0f;
+const float EXP_LO = -104.0f;
+const float LOG2E = 1.44269504088896341f;
+const float EXP_C1 = 0.693359375f;
+const float EXP_C2 = -2.12194440e-4f;
+const float EXP_P0 = 1.9875691500E-4f;
+const float EXP_P1 = 1.3981999507E-3f;
+const float EXP_P2 = 8.3334519073E-3f;
+const float EXP_P3 = 4.1665795894E-2f;
+const float EXP_P4 = 1.6666665459E-1f;
+const float EXP_P5 = 5.0000001201E-1f;
+
+// スコアの部分和を、floatで何要素ずつ足してからdoubleに足し込むか
+const int SCORE_BLOCK = 1024;
+
+// ゾーンの種類のインデックス（codesの並び）
+enum { CODE_RESIDENTIAL = 0, CODE_COMMERCIAL, CODE_INDUSTRIAL, CODE_MIXED, CODE_PARK };
+
+struct Kernels {
+	void (*axpy)(float*, const float*, float, int);
+	void (*clamp)(float*, float, float, int);
+	void (*expShift)(float*, const float*, float, int);
+	void (*classifyZones)(unsigned char*, const float*, const float*, const float*, int, float, float, const unsigned char*);
+	void (*scoreTerms)(const float*, const float*, const float*, const float*, const float*, const float*, int, double&, double&);
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// スカラー版（参照実装）
+
+void axpyScalar(float* y, const float* x, float a, int n) {
+	for (int i = 0; i < n; ++i) y[i] += a * x[i];
+}
+
+void clampScalar(float* x, float lo, float hi, int n) {
+	for (int i = 0; i < n; ++i) {
+		if (x[i] < lo) x[i] = lo;
+		if (x[i] > hi) x[i] = hi;
+	}
+}
+
+void expShiftScalar(float* y, const float* x, float shift, int n) {
+	for (int i = 0; i < n; ++i) y[i] = expf(x[i] - shift);
+}
+
+inline unsigned char classifyZone(float population, float commercialJobs, float industrialJobs, float max_population, float max_jobs, const unsigned char* codes) {
+	float p = population / max_population;
+	float c = commercialJobs / max_jobs;
+	float i = industrialJobs / max_jobs;
+
+	if (i > p && industrialJobs > commercialJobs) {
+		return codes[CODE_INDUSTRIAL];
+	} else if (p < 0.1f && c < 0.1f && i < 0.1f) {
+		return codes[CODE_PARK];
+	} else if (p > c * 2) {
+		return codes[CODE_RESIDENTIAL];
+	} else if (c > p * 2) {
+		return codes[CODE_COMMERCIAL];
+	} else {
+		return codes[CODE_MIXED];
+	}
+}
+
+void classifyZonesScalar(unsigned char* zones, const float* population, const float* commercialJobs, const float* industrialJobs, int n, float max_population, float max_jobs, const unsigned char* codes) {
+	for (int k = 0; k < n; ++k) {
+		zones[k] = classifyZone(population[k], commercialJobs[k], industrialJobs[k], max_population, max_jobs, codes);
+	}
+}
+
+void scoreTermsScalar(const float* life, const float* shop, const float* factory, const float* population, const float* commercialJobs, const float* industrialJobs, int n, double& score, double& total) {
+	float s = 0.0f;
+	float t = 0.0f;
+	for (int k = 0; k < n; ++k) {
+		s += life[k] * population[k];
+		s += shop[k] * commercialJobs[k];
+		s += factory[k] * industrialJobs[k];
+		t += population[k] + commercialJobs[k] + industrialJobs[k];
+	}
+	score = s;
+	total = t;
+}
+
+#if SIMD_X86
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// SSE4.1版
+
+SIMD_TARGET("sse4.1")
+inline __m128 exp128(__m128 x) {
+	x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(EXP_LO)), _mm_set1_ps(EXP_HI));
+	__m128 fx = _mm_floor_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(LOG2E)), _mm_set1_ps(0.5f)));
+	x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(EXP_C1)));
+	x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(EXP_C2)));
+
+	__m128 y = _mm_set1_ps(EXP_P0);
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P1));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P2));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P3));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P4));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P5));
+	y = _mm_add_ps(_mm_mul_ps(y, _mm_mul_ps(x, x)), _mm_add_ps(x, _mm_set1_ps(1.0f)));
+
+	// 2^fxを2回に分けて掛けると、非正規化数やオーバーフローも、expfと同じように丸められる
+	__m128i n = _mm_cvttps_epi32(fx);
+	__m128i n1 = _mm_srai_epi32(n, 1);
+	__m128i e1 = _mm_slli_epi32(_mm_add_epi32(n1, _mm_set1_epi32(127)), 23);
+	__m128i e2 = _mm_slli_epi32(_mm_add_epi32(_mm_sub_epi32(n, n1), _mm_set1_epi32(127)), 23);
+	return _mm_mul_ps(_mm_mul_ps(y, _mm_castsi128_ps(e1)), _mm_castsi128_ps(e2));
+}
+
+SIMD_TARGET("sse4.1")
+void axpySse4(float* y, const float* x, float a, int n) {
+	__m128 va = _mm_set1_ps(a);
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		_mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(va, _mm_loadu_ps(x + i))));
+	}
+	axpyScalar(y + i, x + i, a, n - i);
+}
+
+SIMD_TARGET("sse4.1")
+void clampSse4(float* x, float lo, float hi, int n) {
+	__m128 vlo = _mm_set1_ps(lo);
+	__m128 vhi = _mm_set1_ps(hi);
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		_mm_storeu_ps(x + i, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(x + i), vlo), vhi));
+	}
+	clampScalar(x + i, lo, hi, n - i);
+}
+
+SIMD_TARGET("sse4.1")
+void expShiftSse4(float* y, const float* x, float shift, int n) {
+	__m128 vs = _mm_set1_ps(shift);
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		_mm_storeu_ps(y + i, exp128(_mm_sub_ps(_mm_loadu_ps(x + i), vs)));
+	}
+	expShiftScalar(y + i, x + i, shift, n - i);
+}
+
+SIMD_TARGET("sse4.1")
+void classifyZonesSse4(unsigned char* zones, const float* population, const float* commercialJobs, const float* industrialJobs, int n, float max_population, float max_jobs, const unsigned char* codes) {
+	__m128 vmp = _mm_set1_ps(max_population);
+	__m128 vmj = _mm_set1_ps(max_jobs);
+	__m128 v01 = _mm_set1_ps(0.1f);
+	__m128 v2 = _mm_set1_ps(2.0f);
+
+	int k = 0;
+	for (; k + 4 <= n; k += 4) {
+		__m128 pop = _mm_loadu_ps(population + k);
+		__m128 com = _mm_loadu_ps(commercialJobs + k);
+		__m128 ind = _mm_loadu_ps(industrialJobs + k);
+		__m128 p = _mm_div_ps(pop, vmp);
+		__m128 c = _mm_div_ps(com, vmj);
+		__m128 i = _mm_div_ps(ind, vmj);
+
+		__m128 is_ind = _mm_and_ps(_mm_cmpgt_ps(i, p), _mm_cmpgt_ps(ind, com));
+		__m128 is_park = _mm_and_ps(_mm_and_ps(_mm_cmplt_ps(p, v01), _mm_cmplt_ps(c, v01)), _mm_cmplt_ps(i, v01));
+		__m128 is_res = _mm_cmpgt_ps(p, _mm_mul_ps(c, v2));
+		__m128 is_com = _mm_cmpgt_ps(c, _mm_mul_ps(p, v2));
+
+		// 優先度の低い順に上書きする
+		__m128i code = _mm_set1_epi32(codes[CODE_MIXED]);
+		code = _mm_blendv_epi8(code, _mm_set1_epi32(codes[CODE_COMMERCIAL]), _mm_castps_si128(is_com));
+		code = _mm_blendv_epi8(code, _mm_set1_epi32(codes[CODE_RESIDENTIAL]), _mm_castps_si128(is_res));
+		code = _mm_blendv_epi8(code, _mm_set1_epi32(codes[CODE_PARK]), _mm_castps_si128(is_park));
+		code = _mm_blendv_epi8(code, _mm_set1_epi32(codes[CODE_INDUSTRIAL]), _mm_castps_si128(is_ind));
+
+		__m128i bytes = _mm_packus_epi16(_mm_packs_epi32(code, code), code);
+		int packed = _mm_cvtsi128_si32(bytes);
+		memcpy(zones + k, &packed, 4);
+	}
+	classifyZonesScalar(zones + k, population + k, commercialJobs + k, industrialJobs + k, n - k, max_population, max_jobs, codes);
+}
+
+SIMD_TARGET("sse4.1")
+void scoreTermsSse4(const float* life, const float* shop, const float* factory, const float* population, const float* commercialJobs, const float* industrialJobs, int n, double& score, double& total) {
+	score = 0.0;
+	total = 0.0;
+
+	for (int begin = 0; begin < n; begin += SCORE_BLOCK) {
+		int end = std::min(begin + SCORE_BLOCK, n);
+		__m128 s = _mm_setzero_ps();
+		__m128 t = _mm_setzero_ps();
+		int k = begin;
+		for (; k + 4 <= end; k += 4) {
+			__m128 pop = _mm_loadu_ps(population + k);
+			__m128 com = _mm_loadu_ps(commercialJobs + k);
+			__m128 ind = _mm_loadu_ps(industrialJobs + k);
+			s = _mm_add_ps(s, _mm_mul_ps(_mm_loadu_ps(life + k), pop));
+			s = _mm_add_ps(s, _mm_mul_ps(_mm_loadu_ps(shop + k), com));
+			s = _mm_add_ps(s, _mm_mul_ps(_mm_loadu_ps(factory + k), ind));
+			t = _mm_add_ps(t, _mm_add_ps(_mm_add_ps(pop, com), ind));
+		}
+
+		float ls[4], lt[4];
+		_mm_storeu_ps(ls, s);
+		_mm_storeu_ps(lt, t);
+		score += (double)ls[0] + ls[1] + ls[2] + ls[3];
+		total += (double)lt[0] + lt[1] + lt[2] + lt[3];
+
+		double rs, rt;
+		scoreTermsScalar(life + k, shop + k, factory + k, population + k, commercialJobs + k, industrialJobs + k, end - k, rs, rt);
+		score += rs;
+		total += rt;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// AVX2版
+
+SIMD_TARGET("avx2")
+inline __m256 exp256(__m256 x) {
+	x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(EXP_LO)), _mm256_set1_ps(EXP_HI));
+	__m256 fx = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(LOG2E)), _mm256_set1_ps(0.5f)));
+	x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(EXP_C1)));
+	x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(EXP_C2)));
+
+	__m256 y = _mm256_set1_ps(EXP_P0);
+	y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(EXP_P1));
+	y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(EXP_P2));
+	y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(EXP_P3));
+	y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(EXP_P4));
+	y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(EXP_P5));
+	y = _mm256_add_ps(_mm256_mul_ps(y, _mm256_mul_ps(x, x)), _mm256_add_ps(x, _mm256_set1_ps(1.0f)));
+
+	__m256i n = _mm256_cvttps_epi32(fx);
+	__m256i n1 = _mm256_srai_epi32(n, 1);
+	__m256i e1 = _mm256_slli_epi32(_mm256_add_epi32(n1, _mm256_set1_epi32(127)), 23);
+	__m256i e2 = _mm256_slli_epi32(_mm256_add_epi32(_mm256_sub_epi32(n, n1), _mm256_set1_epi32(127)), 23);
+	return _mm256_mul_ps(_mm256_mul_ps(y, _mm256_castsi256_ps(e1)), _mm256_castsi256_ps(e2));
+}
+
+SIMD_TARGET("avx2")
+void axpyAvx2(float* y, const float* x, float a, int n) {
+	__m256 va = _mm256_set1_ps(a);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		_mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_loadu_ps(y + i), _mm256_mul_ps(va, _mm256_loadu_ps(x + i))));
+	}
+	axpyScalar(y + i, x + i, a, n - i);
+}
+
+SIMD_TARGET("avx2")
+void clampAvx2(float* x, float lo, float hi, int n) {
+	__m256 vlo = _mm256_set1_ps(lo);
+	__m256 vhi = _mm256_set1_ps(hi);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		_mm256_storeu_ps(x + i, _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(x + i), vlo), vhi));
+	}
+	clampScalar(x + i, lo, hi, n - i);
+}
+
+SIMD_TARGET("avx2")
+void expShiftAvx2(float* y, const float* x, float shift, int n) {
+	__m256 vs = _mm256_set1_ps(shift);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		_mm256_storeu_ps(y + i, exp256(_mm256_sub_ps(_mm256_loadu_ps(x + i), vs)));
+	}
+	expShiftScalar(y + i, x + i, shift, n - i);
+}
+
+SIMD_TARGET("avx2")
+void classifyZonesAvx2(unsigned char* zones, const float* population, const float* commercialJobs, const float* industrialJobs, int n, float max_population, float max_jobs, const unsigned char* codes) {
+	__m256 vmp = _mm256_set1_ps(max_population);
+	__m256 vmj = _mm256_set1_ps(max_jobs);
+	__m256 v01 = _mm256_set1_ps(0.1f);
+	__m256 v2 = _mm256_set1_ps(2.0f);
+
+	int k = 0;
+	for (; k + 8 <= n; k += 8) {
+		__m256 pop = _mm256_loadu_ps(population + k);
+		__m256 com = _mm256_loadu_ps(commercialJobs + k);
+		__m256 ind = _mm256_loadu_ps(industrialJobs + k);
+		__m256 p = _mm256_div_ps(pop, vmp);
+		__m256 c = _mm256_div_ps(com, vmj);
+		__m256 i = _mm256_div_ps(ind, vmj);
+
+		__m256 is_ind = _mm256_and_ps(_mm256_cmp_ps(i, p, _CMP_GT_OQ), _mm256_cmp_ps(ind, com, _CMP_GT_OQ));
+		__m256 is_park = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(p, v01, _CMP_LT_OQ), _mm256_cmp_ps(c, v01, _CMP_LT_OQ)), _mm256_cmp_ps(i, v01, _CMP_LT_OQ));
+		__m256 is_res = _mm256_cmp_ps(p, _mm256_mul_ps(c, v2), _CMP_GT_OQ);
+		__m256 is_com = _mm256_cmp_ps(c, _mm256_mul_ps(p, v2), _CMP_GT_OQ);
+
+		// 優先度の低い順に上書きする
+		__m256i code = _mm256_set1_epi32(codes[CODE_MIXED]);
+		code = _mm256_blendv_epi8(code, _mm256_set1_epi32(codes[CODE_COMMERCIAL]), _mm256_castps_si256(is_com));
+		code = _mm256_blendv_epi8(code, _mm256_set1_epi32(codes[CODE_RESIDENTIAL]), _mm256_castps_si256(is_res));
+		code = _mm256_blendv_epi8(code, _mm256_set1_epi32(codes[CODE_PARK]), _mm256_castps_si256(is_park));
+		code = _mm256_blendv_epi8(code, _mm256_set1_epi32(codes[CODE_INDUSTRIAL]), _mm256_castps_si256(is_ind));
+
+		// 32bit x 8 を 8bit x 8 に詰める
+		__m128i lo = _mm256_castsi256_si128(code);
+		__m128i hi = _mm256_extracti128_si256(code, 1);
+		__m128i words = _mm_packs_epi32(lo, hi);
+		__m128i bytes = _mm_packus_epi16(words, words);
+		_mm_storel_epi64((__m128i*)(zones + k), bytes);
+	}
+	classifyZonesScalar(zones + k, population + k, commercialJobs + k, industrialJobs + k, n - k, max_population, max_jobs, codes);
+}
+
+SIMD_TARGET("avx2")
+void scoreTermsAvx2(const float* life, const float* shop, const float* factory, const float* population, const float* commercialJobs, const float* industrialJobs, int n, double& score, double& total) {
+	score = 0.0;
+	total = 0.0;
+
+	for (int begin = 0; begin < n; begin += SCORE_BLOCK) {
+		int end = std::min(begin + SCORE_BLOCK, n);
+		__m256 s = _mm256_setzero_ps();
+		__m256 t = _mm256_setzero_ps();
+		int k = begin;
+		for (; k + 8 <= end; k += 8) {
+			__m256 pop = _mm256_loadu_ps(population + k);
+			__m256 com = _mm256_loadu_ps(commercialJobs + k);
+			__m256 ind = _mm256_loadu_ps(industrialJobs + k);
+			s = _mm256_add_ps(s, _mm256_mul_ps(_mm256_loadu_ps(life + k), pop));
+			s = _mm256_add_ps(s, _mm256_mul_ps(_mm256_loadu_ps(shop + k), com));
+			s = _mm256_add_ps(s, _mm256_mul_ps(_mm256_loadu_ps(factory + k), ind));
+			t = _mm256_add_ps(t, _mm256_add_ps(_mm256_add_ps(pop, com), ind));
+		}
+
+		float ls[8], lt[8];
+		_mm256_storeu_ps(ls, s);
+		_mm256_storeu_ps(lt, t);
+		for (int j = 0; j < 8; ++j) {
+			score += ls[j];
+			total += lt[j];
+		}
+
+		double rs, rt;
+		scoreTermsScalar(life + k, shop + k, factory + k, population + k, commercialJobs + k, industrialJobs + k, end - k, rs, rt);
+		score += rs;
+		total += rt;
+	}
+}
+
+#if SIMD_AVX512
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// AVX-512版
+
+SIMD_TARGET("avx512f")
+inline __m512 exp512(__m512 x) {
+	x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(EXP_LO)), _mm512_set1_ps(EXP_HI));
+	__m512 fx = _mm512_roundscale_ps(_mm512_add_ps(_mm512_mul_ps(x, _mm512_set1_ps(LOG2E)), _mm512_set1_ps(0.5f)), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+	x = _mm512_sub_ps(x, _mm512_mul_ps(fx, _mm512_set1_ps(EXP_C1)));
+	x = _mm512_sub_ps(x, _mm512_mul_ps(fx, _mm512_set1_ps(EXP_C2)));
+
+	__m512 y = _mm512_set1_ps(EXP_P0);
+	y = _mm512_add_ps(_mm512_mul_ps(y, x), _mm512_set1_ps(EXP_P1));
+	y = _mm512_add_ps(_mm512_mul_ps(y, x), _mm512_set1_ps(EXP_P2));
+	y = _mm512_add_ps(_mm512_mul_ps(y, x), _mm512_set1_ps(EXP_P3));
+	y = _mm512_add_ps(_mm512_mul_ps(y, x), _mm512_set1_ps(EXP_P4));
+	y = _mm512_add_ps(_mm512_mul_ps(y, x), _mm512_set1_ps(EXP_P5));
+	y = _mm512_add_ps(_mm512_mul_ps(y, _mm512_mul_ps(x, x)), _mm512_add_ps(x, _mm512_set1_ps(1.0f)));
+
+	__m512i n = _mm512_cvttps_epi32(fx);
+	__m512i n1 = _mm512_srai_epi32(n, 1);
+	__m512i e1 = _mm512_slli_epi32(_mm512_add_epi32(n1, _mm512_set1_epi32(127)), 23);
+	__m512i e2 = _mm512_slli_epi32(_mm512_add_epi32(_mm512_sub_epi32(n, n1), _mm512_set1_epi32(127)), 23);
+	return _mm512_mul_ps(_mm512_mul_ps(y, _mm512_castsi512_ps(e1)), _mm512_castsi512_ps(e2));
+}
+
+SIMD_TARGET("avx512f")
+void axpyAvx512(float* y, const float* x, float a, int n) {
+	__m512 va = _mm512_set1_ps(a);
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		_mm512_storeu_ps(y + i, _mm512_add_ps(_mm512_loadu_ps(y + i), _mm512_mul_ps(va, _mm512_loadu_ps(x + i))));
+	}
+	axpyScalar(y + i, x + i, a, n - i);
+}
+
+SIMD_TARGET("avx512f")
+void clampAvx512(float* x, float lo, float hi, int n) {
+	__m512 vlo = _mm512_set1_ps(lo);
+	__m512 vhi = _mm512_set1_ps(hi);
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		_mm512_storeu_ps(x + i, _mm512_min_ps(_mm512_max_ps(_mm512_loadu_ps(x + i), vlo), vhi));
+	}
+	clampScalar(x + i, lo, hi, n - i);
+}
+
+SIMD_TARGET("avx512f")
+void expShiftAvx512(float* y, const float* x, float shift, int n) {
+	__m512 vs = _mm512_set1_ps(shift);
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		_mm512_storeu_ps(y + i, exp512(_mm512_sub_ps(_mm512_loadu_ps(x + i), vs)));
+	}
+	expShiftScalar(y + i, x + i, shift, n - i);
+}
+
+SIMD_TARGET("avx512f")
+void classifyZonesAvx512(unsigned char* zones, const float* population, const float* commercialJobs, const float* industrialJobs, int n, float max_population, float max_jobs, const unsigned char* codes) {
+	__m512 vmp = _mm512_set1_ps(max_population);
+	__m512 vmj = _mm512_set1_ps(max_jobs);
+	__m512 v01 = _mm512_set1_ps(0.1f);
+	__m512 v2 = _mm512_set1_ps(2.0f);
+
+	int k = 0;
+	for (; k + 16 <= n; k += 16) {
+		__m512 pop = _mm512_loadu_ps(population + k);
+		__m512 com = _mm512_loadu_ps(commercialJobs + k);
+		__m512 ind = _mm512_loadu_ps(industrialJobs + k);
+		__m512 p = _mm512_div_ps(pop, vmp);
+		__m512 c = _mm512_div_ps(com, vmj);
+		__m512 i = _mm512_div_ps(ind, vmj);
+
+		__mmask16 is_ind = _mm512_cmp_ps_mask(i, p, _CMP_GT_OQ) & _mm512_cmp_ps_mask(ind, com, _CMP_GT_OQ);
+		__mmask16 is_park = _mm512_cmp_ps_mask(p, v01, _CMP_LT_OQ) & _mm512_cmp_ps_mask(c, v01, _CMP_LT_OQ) & _mm512_cmp_ps_mask(i, v01, _CMP_LT_OQ);
+		__mmask16 is_res = _mm512_cmp_ps_mask(p, _mm512_mul_ps(c, v2), _CMP_GT_OQ);
+		__mmask16 is_com = _mm512_cmp_ps_mask(c, _mm512_mul_ps(p, v2), _CMP_GT_OQ);
+
+		// 優先度の低い順に上書きする
+		__m512i code = _mm512_set1_epi32(codes[CODE_MIXED]);
+		code = _mm512_mask_mov_epi32(code, is_com, _mm512_set1_epi32(codes[CODE_COMMERCIAL]));
+		code = _mm512_mask_mov_epi32(code, is_res, _mm512_set1_epi32(codes[CODE_RESIDENTIAL]));
+		code = _mm512_mask_mov_epi32(code, is_park, _mm512_set1_epi32(codes[CODE_PARK]));
+		code = _mm512_mask_mov_epi32(code, is_ind, _mm512_set1_epi32(codes[CODE_INDUSTRIAL]));
+
+		_mm_storeu_si128((__m128i*)(zones + k), _mm512_cvtepi32_epi8(code));
+	}
+	classifyZonesScalar(zones + k, population + k, commercialJobs + k, industrialJobs + k, n - k, max_population, max_jobs, codes);
+}
+
+SIMD_TARGET("avx512f")
+void scoreTermsAvx512(const float* life, const float* shop, const float* factory, const float* population, const float* commercialJobs, const float* industrialJobs, int n, double& score, double& total) {
+	score = 0.0;
+	total = 0.0;
+
+	for (int begin = 0; begin < n; begin += SCORE_BLOCK) {
+		int end = std::min(begin + SCORE_BLOCK, n);
+		__m512 s = _mm512_setzero_ps();
+		__m512 t = _mm512_setzero_ps();
+		int k = begin;
+		for (; k + 16 <= end; k += 16) {
+			__m512 pop = _mm512_loadu_ps(population + k);
+			__m512 com = _mm512_loadu_ps(commercialJobs + k);
+			__m512 ind = _mm512_loadu_ps(industrialJobs + k);
+			s = _mm512_add_ps(s, _mm512_mul_ps(_mm512_loadu_ps(life + k), pop));
+			s = _mm512_add_ps(s, _mm512_mul_ps(_mm512_loadu_ps(shop + k), com));
+			s = _mm512_add_ps(s, _mm512_mul_ps(_mm512_loadu_ps(factory + k), ind));
+			t = _mm512_add_ps(t, _mm512_add_ps(_mm512_add_ps(pop, com), ind));
+		}
+
+		float ls[16], lt[16];
+		_mm512_storeu_ps(ls, s);
+		_mm512_storeu_ps(lt, t);
+		for (int j = 0; j < 16; ++j) {
+			score += ls[j];
+			total += lt[j];
+		}
+
+		double rs, rt;
+		scoreTermsScalar(life + k, shop + k, factory + k, population + k, commercialJobs + k, industrialJobs + k, end - k, rs, rt);
+		score += rs;
+		total += rt;
+	}
+}
+
+#endif // SIMD_AVX512
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// CPUの機能の検出
+
+void cpuid(int leaf, int subleaf, unsigned int regs[4]) {
+#if defined(_MSC_VER)
+	int r[4];
+	__cpuidex(r, leaf, subleaf);
+	for (int i = 0; i < 4; ++i) regs[i] = r[i];
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+unsigned long long xgetbv0() {
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	unsigned int eax, edx;
+	__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+
+#endif // SIMD_X86
+
+const Kernels KERNELS[SimdKernels::NUM_LEVELS] = {
+	{ axpyScalar, clampScalar, expShiftScalar, classifyZonesScalar, scoreTermsScalar },
+#if SIMD_X86
+	{ axpySse4, clampSse4, expShiftSse4, classifyZonesSse4, scoreTermsSse4 },
+	{ axpyAvx2, clampAvx2, expShiftAvx2, classifyZonesAvx2, scoreTermsAvx2 },
+#if SIMD_AVX512
+	{ axpyAvx512, clampAvx512, expShiftAvx512, classifyZonesAvx512, scoreTermsAvx512 },
+#else
+	{ axpyAvx2, clampAvx2, expShiftAvx2, classifyZonesAvx2, scoreTermsAvx2 },
+#endif
+#else
+	{ axpyScalar, clampScalar, expShiftScalar, classifyZonesScalar, scoreTermsScalar },
+	{ axpyScalar, clampScalar, expShiftScalar, classifyZonesScalar, scoreTermsScalar },
+	{ axpyScalar, clampScalar, expShiftScalar, classifyZonesScalar, scoreTermsScalar },
+#endif
+};
+
+const char* LEVEL_NAMES[SimdKernels::NUM_LEVELS] = { "scalar", "sse4", "avx2", "avx512" };
+
+/**
+ * 現在選ばれている実装。最初に使う時に、検出した最も速い実装で初期化する。
+ */
+int& currentLevel() {
+	static int level = SimdKernels::detectLevel();
+	return level;
+}
+
+const Kernels& current() {
+	return KERNELS[currentLevel()];
+}
+
+}
+
+/**
+ * このCPUとOSで使える、最も速い実装のレベルを返却する。
+ */
+int SimdKernels::detectLevel() {
+#if SIMD_X86
+	unsigned int regs[4];
+	cpuid(0, 0, regs);
+	unsigned int max_leaf = regs[0];
+	if (max_leaf < 1) return LEVEL_SCALAR;
+
+	cpuid(1, 0, regs);
+	bool sse41 = (regs[2] & (1 << 19)) != 0;
+	bool osxsave = (regs[2] & (1 << 27)) != 0;
+	bool avx = (regs[2] & (1 << 28)) != 0;
+	if (!sse41) return LEVEL_SCALAR;
+
+	// AVX系は、OSがYMM/ZMMレジスタを保存する場合のみ使える
+	unsigned long long xcr0 = osxsave ? xgetbv0() : 0;
+	bool ymm = (xcr0 & 0x6) == 0x6;
+	bool zmm = (xcr0 & 0xe6) == 0xe6;
+
+	bool avx2 = false;
+	bool avx512f = false;
+	if (max_leaf >= 7) {
+		cpuid(7, 0, regs);
+		avx2 = (regs[1] & (1 << 5)) != 0;
+		avx512f = (regs[1] & (1 << 16)) != 0;
+	}
+
+#if SIMD_AVX512
+	if (avx512f && zmm) return LEVEL_AVX512;
+#endif
+	if (avx && avx2 && ymm) return LEVEL_AVX2;
+	return LEVEL_SSE4;
+#else
+	return LEVEL_SCALAR;
+#endif
+}
+
+/**
+ * 現在使用している実装のレベルを返却する。
+ */
+int SimdKernels::level() {
+	return currentLevel();
+}
+
+/**
+ * 使用する実装を指定する。CPUが対応していないレベルは、対応している最も高いレベルに下げる。
+ * 差分テストでは、LEVEL_SCALARを指定して参照実装と比較する。
+ * 全スレッドで共有する設定なので、計算中には呼び出さないこと。
+ *
+ * @return		実際に選ばれたレベル
+ */
+int SimdKernels::setLevel(int level) {
+	level = std::max((int)LEVEL_SCALAR, std::min(level, detectLevel()));
+	currentLevel() = level;
+	return level;
+}
+
+const char* SimdKernels::levelName(int level) {
+	if (level < 0 || level >= NUM_LEVELS) return "unknown";
+	return LEVEL_NAMES[level];
+}
+
+/**
+ * 名前（scalar / sse4 / avx2 / avx512）からレベルを返却する。該当しなければ-1を返却する。
+ */
+int SimdKernels::levelFromName(const char* name) {
+	for (int i = 0; i < NUM_LEVELS; ++i) {
+		if (strcmp(name, LEVEL_NAMES[i]) == 0) return i;
+	}
+	return -1;
+}
+
+/**
+ * y += a * x
+ */
+void SimdKernels::axpy(float* y, const float* x, float a, int n) {
+	current().axpy(y, x, a, n);
+}
+
+/**
+ * xを[lo, hi]にクリップする。
+ */
+void SimdKernels::clamp(float* x, float lo, float hi, int n) {
+	current().clamp(x, lo, hi, n);
+}
+
+/**
+ * y = exp(x - shift)
+ */
+void SimdKernels::expShift(float* y, const float* x, float shift, int n) {
+	current().expShift(y, x, shift, n);
+}
+
+/**
+ * 人口と仕事量から、各セルのゾーンの種類を決める（Zoning::updateZones()の判定）。
+ *
+ * @param codes		ゾーンの種類の値（住宅、商業、工業、混合、公園の順）
+ */
+void SimdKernels::classifyZones(unsigned char* zones, const float* population, const float* commercialJobs, const float* industrialJobs, int n, float max_population, float max_jobs, const unsigned char codes[5]) {
+	current().classifyZones(zones, population, commercialJobs, industrialJobs, n, max_population, max_jobs, codes);
+}
+
+/**
+ * スコアの分子（効用 × 人・仕事の数の合計）と、分母（人・仕事の総数）を計算する。
+ */
+void SimdKernels::scoreTerms(const float* life, const float* shop, const float* factory, const float* population, const float* commercialJobs, const float* industrialJobs, int n, double& score, double& total) {
+	current().scoreTerms(life, shop, factory, population, commercialJobs, industrialJobs, n, score, total);
+}
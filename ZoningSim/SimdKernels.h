@@ -0,0 +1,34 @@
+﻿#pragma once
+
+/**
+ * グリッド全体に対する単純なループを、SIMD命令で計算するカーネル群。
+ *
+ * 実行時にCPUの機能を調べて、使える中で最も速い実装（AVX-512 / AVX2 / SSE4.1）を選ぶ。
+ * スカラー版は、元のループと同じ計算順序の参照実装で、setLevel(LEVEL_SCALAR)で強制できるので、
+ * SIMD版との差分テストに使える。
+ *
+ * axpy、clamp、classifyZonesは、どの実装でも結果がビット単位で一致する。
+ * expShiftは多項式近似なので数ulpの誤差がある（結果が非正規化数になる範囲では、最小の非正規化数程度の誤差）。
+ * アンダーフロー・オーバーフローする範囲では、expfと同じく0と+infを返す。scoreTermsは加算の順序が異なる。
+ * ZoningSimBench --checkで、このCPUで使える全ての実装を、スカラー版と比較できる。
+ */
+class SimdKernels {
+public:
+	static enum { LEVEL_SCALAR = 0, LEVEL_SSE4, LEVEL_AVX2, LEVEL_AVX512, NUM_LEVELS };
+
+public:
+	static int detectLevel();
+	static int level();
+	static int setLevel(int level);
+	static const char* levelName(int level);
+	static int levelFromName(const char* name);
+
+	static void axpy(float* y, const float* x, float a, int n);
+	static void clamp(float* x, float lo, float hi, int n);
+	static void expShift(float* y, const float* x, float shift, int n);
+	static void classifyZones(unsigned char* zones, const float* population, const float* commercialJobs, const float* industrialJobs, int n, float max_population, float max_jobs, const unsigned char codes[5]);
+	static void scoreTerms(const float* life, const float* shop, const float* factory, const float* population, const float* commercialJobs, const float* industrialJobs, int n, double& score, double& total);
+
+private:
+	SimdKernels() {}
+};
@@ -0,0 +1,141 @@
+﻿#include "StepScheduler.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include <QStringList>
+
+const char* StepScheduler::fieldName(int f) {
+	static const char* names[NUM_FIELDS] = { "accessibility", "neighborPopulation", "neighborCommercial", "pollution", "slope", "landValue", "population", "commercialJobs", "industrialJobs", "life", "shop", "factory", "zones", "score", "rng" };
+
+	if (f < 0 || f >= NUM_FIELDS) return "unknown";
+	return names[f];
+}
+
+/**
+ * ステージを追加する。依存関係は、既に追加されたステージとの、フィールドの読み書きから決める。
+ *
+ * @param name		ステージの名前
+ * @param inputs	読み込むフィールド（field()のOR）
+ * @param outputs	書き込むフィールド（field()のOR）
+ * @param func		ステージの処理
+ * @return			ステージの番号
+ */
+int StepScheduler::addStage(const QString& name, unsigned int inputs, unsigned int outputs, std::function<void()> func) {
+	Stage stage;
+	stage.name = name;
+	stage.inputs = inputs;
+	stage.outputs = outputs;
+	stage.func = func;
+	stage.level = 0;
+	stage.duration = 0.0;
+
+	for (int i = 0; i < stages.size(); ++i) {
+		bool raw = (inputs & stages[i].outputs) != 0;
+		bool war = (outputs & (stages[i].inputs | stages[i].outputs)) != 0;
+		if (raw || war) {
+			stage.deps.push_back(i);
+			stage.level = std::max(stage.level, stages[i].level + 1);
+		}
+	}
+
+	if (stage.level >= levels.size()) levels.resize(stage.level + 1);
+	levels[stage.level].push_back(stages.size());
+	stages.push_back(stage);
+
+	return stages.size() - 1;
+}
+
+void StepScheduler::clear() {
+	stages.clear();
+	levels.clear();
+}
+
+/**
+ * 全てのステージを、依存関係を守って実行する。同じレベルのステージは並列に実行する。
+ * 他のスレッドで実行したステージのトレースも、呼び出したスレッドの記録として集計されるようにする。
+ */
+void StepScheduler::run() {
+	const TraceContext context = Trace::context();
+
+	for (int l = 0; l < levels.size(); ++l) {
+		const std::vector<int>& level = levels[l];
+		ThreadPool::parallelFor(level.size(), [&](int i) {
+			Stage& stage = stages[level[i]];
+
+			TraceContext saved = Trace::context();
+			Trace::setContext(context);
+
+			int64_t start = Trace::now();
+			stage.func();
+			stage.duration = (Trace::now() - start) * 1e-9;
+
+			Trace::setContext(saved);
+		});
+	}
+}
+
+/**
+ * 前回のrun()の処理時間で重み付けした、最長の依存パス（クリティカルパス）を返却する。
+ *
+ * @param length	パスの処理時間の合計 [sec] の格納先（NULLなら格納しない）
+ * @return			パス上のステージの番号（実行順）
+ */
+std::vector<int> StepScheduler::criticalPath(double* length) const {
+	std::vector<double> finish(stages.size(), 0.0);
+	std::vector<int> prev(stages.size(), -1);
+	int last = -1;
+
+	// ステージは依存先より後に追加されているので、追加順に処理すればよい
+	for (int i = 0; i < stages.size(); ++i) {
+		for (int k = 0; k < stages[i].deps.size(); ++k) {
+			int d = stages[i].deps[k];
+			if (prev[i] < 0 || finish[d] > finish[prev[i]]) prev[i] = d;
+		}
+		finish[i] = stages[i].duration + (prev[i] >= 0 ? finish[prev[i]] : 0.0);
+		if (last < 0 || finish[i] > finish[last]) last = i;
+	}
+
+	std::vector<int> path;
+	for (int i = last; i >= 0; i = prev[i]) {
+		path.insert(path.begin(), i);
+	}
+	if (length != NULL) *length = last >= 0 ? finish[last] : 0.0;
+
+	return path;
+}
+
+/**
+ * ステージの一覧（レベル、入出力、依存先、処理時間）と、クリティカルパスを文字列で返却する。
+ */
+QString StepScheduler::describe() const {
+	QString ret;
+
+	for (int l = 0; l < levels.size(); ++l) {
+		for (int i = 0; i < levels[l].size(); ++i) {
+			const Stage& stage = stages[levels[l][i]];
+
+			QStringList inputs, outputs, deps;
+			for (int f = 0; f < NUM_FIELDS; ++f) {
+				if (stage.inputs & field(f)) inputs << fieldName(f);
+				if (stage.outputs & field(f)) outputs << fieldName(f);
+			}
+			for (int k = 0; k < stage.deps.size(); ++k) {
+				deps << stages[stage.deps[k]].name;
+			}
+
+			ret += QString("[%1] %2 (%3 ms)\n").arg(l).arg(stage.name).arg(stage.duration * 1000.0, 0, 'f', 3);
+			ret += QString("    in: %1\n").arg(inputs.join(", "));
+			ret += QString("    out: %1\n").arg(outputs.join(", "));
+			if (deps.size() > 0) ret += QString("    after: %1\n").arg(deps.join(", "));
+		}
+	}
+
+	double length;
+	std::vector<int> path = criticalPath(&length);
+	QStringList names;
+	for (int i = 0; i < path.size(); ++i) {
+		names << stages[path[i]].name;
+	}
+	ret += QString("critical path (%1 ms): %2\n").arg(length * 1000.0, 0, 'f', 3).arg(names.join(" -> "));
+
+	return ret;
+}
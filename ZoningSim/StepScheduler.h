@@ -0,0 +1,53 @@
+﻿#pragma once
+
+#include <vector>
+#include <functional>
+#include <QString>
+
+/**
+ * 1ステップ内のステージを、読み書きするフィールドの依存関係（DAG）に従って実行するスケジューラ。
+ *
+ * 各ステージは、入力と出力のフィールドをビットマスクで宣言する。
+ * 後から追加したステージは、先に追加したステージの出力を読む場合（RAW）と、
+ * 先のステージが読み書きするフィールドに書き込む場合（WAR / WAW）に、そのステージに依存する。
+ * 依存関係のないステージは、ThreadPoolで並列に実行する。
+ *
+ * run()で計測した各ステージの処理時間から、クリティカルパスを求めることができる。
+ */
+class StepScheduler {
+public:
+	static enum {
+		FIELD_ACCESSIBILITY = 0, FIELD_NEIGHBOR_POPULATION, FIELD_NEIGHBOR_COMMERCIAL, FIELD_POLLUTION, FIELD_SLOPE, FIELD_LANDVALUE,
+		FIELD_POPULATION, FIELD_COMMERCIALJOBS, FIELD_INDUSTRIALJOBS, FIELD_LIFE, FIELD_SHOP, FIELD_FACTORY, FIELD_ZONES, FIELD_SCORE, FIELD_RNG,
+		NUM_FIELDS
+	};
+
+	struct Stage {
+		QString name;
+		unsigned int inputs;		// 読み込むフィールド（ビットマスク）
+		unsigned int outputs;		// 書き込むフィールド（ビットマスク）
+		std::function<void()> func;
+		std::vector<int> deps;		// 依存するステージ
+		int level;					// 依存の深さ（同じレベルのステージは並列に実行できる）
+		double duration;			// 前回のrun()での処理時間 [sec]
+	};
+
+private:
+	std::vector<Stage> stages;
+	std::vector<std::vector<int> > levels;
+
+public:
+	StepScheduler() {}
+
+	static unsigned int field(int f) { return 1u << f; }
+	static const char* fieldName(int f);
+
+	int addStage(const QString& name, unsigned int inputs, unsigned int outputs, std::function<void()> func);
+	void clear();
+	void run();
+
+	int numStages() const { return stages.size(); }
+	const Stage& stage(int i) const { return stages[i]; }
+	std::vector<int> criticalPath(double* length = NULL) const;
+	QString describe() const;
+};
@@ -0,0 +1,188 @@
+﻿#include "ThreadPool.h"
+
+const int ThreadPool::TILE_CELLS = 16384;
+
+namespace {
+
+// 現在のスレッドのキューの番号（ワーカー以外は0）
+thread_local int home_queue = 0;
+
+}
+
+ThreadPool::ThreadPool() : pending(0), next_queue(0), stopping(false) {
+	start(0);
+}
+
+/**
+ * プールを返却する。静的変数のデストラクタでワーカーをjoinしないよう、プールは解放しない。
+ */
+ThreadPool& ThreadPool::instance() {
+	static ThreadPool* pool = new ThreadPool();
+	return *pool;
+}
+
+/**
+ * スレッド数を設定する。呼び出したスレッドも1つと数える。
+ * 計算中には呼び出さないこと。
+ *
+ * @param num_threads	スレッド数（0なら、全てのコアを使う）
+ */
+void ThreadPool::setNumThreads(int num_threads) {
+	ThreadPool& pool = instance();
+	pool.stop();
+	pool.start(num_threads);
+}
+
+int ThreadPool::numThreads() {
+	return (int)instance().workers.size() + 1;
+}
+
+/**
+ * ワーカーを全て終了させる。main()から戻る前に呼び出すこと。
+ * これ以降の計算は、呼び出したスレッドだけで実行する。
+ */
+void ThreadPool::shutdown() {
+	instance().stop();
+}
+
+/**
+ * 1タイルの行数を返却する。
+ */
+int ThreadPool::tileRows(int rows, int cols) {
+	return std::max(1, TILE_CELLS / std::max(1, cols));
+}
+
+/**
+ * タイルの数を返却する。
+ */
+int ThreadPool::numTiles(int rows, int cols) {
+	int tile_rows = tileRows(rows, cols);
+	return (rows + tile_rows - 1) / tile_rows;
+}
+
+void ThreadPool::start(int num_threads) {
+	if (num_threads <= 0) num_threads = std::max(1, (int)std::thread::hardware_concurrency());
+
+	stopping = false;
+	for (int i = 0; i < num_threads; ++i) {
+		queues.push_back(new Queue());
+	}
+	for (int i = 1; i < num_threads; ++i) {
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+	}
+}
+
+void ThreadPool::stop() {
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		stopping = true;
+	}
+	wakeup.notify_all();
+
+	for (int i = 0; i < workers.size(); ++i) {
+		workers[i].join();
+	}
+	workers.clear();
+
+	for (int i = 0; i < queues.size(); ++i) {
+		delete queues[i];
+	}
+	queues.clear();
+}
+
+/**
+ * ジョブのタスクを各キューに分配し、全てのタスクが終わるまで、自分もタスクを実行する。
+ */
+void ThreadPool::run(Job& job, int num_tasks) {
+	// 1スレッドの場合や、タスクが1つの場合は、そのまま順に実行する
+	if (workers.size() == 0 || num_tasks == 1) {
+		for (int i = 0; i < num_tasks; ++i) {
+			job.invoke(job.func, i);
+		}
+		return;
+	}
+
+	job.remaining = num_tasks;
+
+	// 連続したタスクが同じキューに入るよう、ブロックごとに分配する
+	const int num_queues = queues.size();
+	const int first = next_queue++ % num_queues;
+	const int per_queue = (num_tasks + num_queues - 1) / num_queues;
+	for (int q = 0; q < num_queues; ++q) {
+		int begin = q * per_queue;
+		int end = std::min(num_tasks, begin + per_queue);
+		if (begin >= end) break;
+
+		Queue* queue = queues[(first + q) % num_queues];
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		for (int i = begin; i < end; ++i) {
+			Task task = { &job, i };
+			queue->tasks.push_back(task);
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		pending += num_tasks;
+	}
+	wakeup.notify_all();
+
+	// キューが空になったら、実行中のタスクが終わるまで眠る
+	while (job.remaining.load(std::memory_order_acquire) > 0) {
+		if (runOne(home_queue)) continue;
+
+		std::unique_lock<std::mutex> lock(done_mutex);
+		done.wait(lock, [&]() { return job.remaining.load(std::memory_order_acquire) == 0; });
+	}
+}
+
+/**
+ * 自分のキューの先頭か、他のキューの末尾からタスクを1つ取り出して実行する。
+ *
+ * @return		タスクを実行したらtrue
+ */
+bool ThreadPool::runOne(int home) {
+	const int num_queues = queues.size();
+
+	for (int i = 0; i < num_queues; ++i) {
+		Queue* queue = queues[(home + i) % num_queues];
+
+		Task task;
+		{
+			std::lock_guard<std::mutex> lock(queue->mutex);
+			if (queue->tasks.empty()) continue;
+			if (i == 0) {
+				task = queue->tasks.front();
+				queue->tasks.pop_front();
+			} else {
+				task = queue->tasks.back();
+				queue->tasks.pop_back();
+			}
+		}
+		pending--;
+
+		task.job->invoke(task.job->func, task.index);
+		if (task.job->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			// 待っているスレッドが条件を確認してから眠るまでの間に、通知しないようにする
+			{
+				std::lock_guard<std::mutex> lock(done_mutex);
+			}
+			done.notify_all();
+		}
+		return true;
+	}
+
+	return false;
+}
+
+void ThreadPool::workerLoop(int id) {
+	home_queue = id;
+
+	while (true) {
+		if (runOne(id)) continue;
+
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		wakeup.wait(lock, [&]() { return stopping || pending > 0; });
+		if (stopping) break;
+	}
+}
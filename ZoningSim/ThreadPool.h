@@ -0,0 +1,102 @@
+﻿#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+
+/**
+ * グリッドの各ステージを並列に実行する、ワークスティーリング方式のスレッドプール。
+ *
+ * 各ワーカーは自分のキューの先頭からタスクを取り出し、空になったら他のキューの末尾から盗む。
+ * parallelFor()を呼び出したスレッドも、完了を待つ間はタスクを実行するので、
+ * ZoningEnsembleの各スレッドから同時に呼び出してもよい。
+ *
+ * ワーカーは、静的変数のデストラクタでは止めないので、終了する前にshutdown()を呼び出すこと。
+ *
+ * forEachTile()は、グリッドを行の帯（タイル）に分割する。タイルの分け方はグリッドのサイズだけで決まるので、
+ * タイルごとの部分和をタイルの順に足し合わせれば、結果はスレッド数によらず一致する。
+ */
+class ThreadPool {
+public:
+	static const int TILE_CELLS;	// 1タイルのセル数の目安（1フィールドあたり64KB）
+
+private:
+	struct Job {
+		void* func;
+		void (*invoke)(void* func, int index);
+		std::atomic<int> remaining;
+	};
+
+	struct Task {
+		Job* job;
+		int index;
+	};
+
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	std::vector<Queue*> queues;		// [0]は外部のスレッド用、[i]はi番目のワーカー用
+	std::vector<std::thread> workers;
+	std::atomic<int> pending;		// キューに入っているタスクの数
+	std::atomic<unsigned int> next_queue;
+	std::mutex sleep_mutex;
+	std::condition_variable wakeup;
+	std::mutex done_mutex;
+	std::condition_variable done;	// ジョブの最後のタスクが終わったら通知する
+	bool stopping;
+
+public:
+	static void setNumThreads(int num_threads);
+	static int numThreads();
+	static void shutdown();
+
+	static int tileRows(int rows, int cols);
+	static int numTiles(int rows, int cols);
+
+	/**
+	 * func(i)を、i = 0, ..., num_tasks - 1について並列に実行し、全て終わるまで待つ。
+	 */
+	template<class F>
+	static void parallelFor(int num_tasks, F func) {
+		if (num_tasks <= 0) return;
+
+		Job job;
+		job.func = &func;
+		job.invoke = &invoke<F>;
+		instance().run(job, num_tasks);
+	}
+
+	/**
+	 * func(tile, r0, r1)を、各タイル（[r0, r1)の行）について並列に実行する。
+	 */
+	template<class F>
+	static void forEachTile(int rows, int cols, F func) {
+		const int tile_rows = tileRows(rows, cols);
+		parallelFor(numTiles(rows, cols), [&](int tile) {
+			int r0 = tile * tile_rows;
+			func(tile, r0, std::min(rows, r0 + tile_rows));
+		});
+	}
+
+private:
+	ThreadPool();
+
+	static ThreadPool& instance();
+
+	template<class F>
+	static void invoke(void* func, int index) {
+		(*(F*)func)(index);
+	}
+
+	void start(int num_threads);
+	void stop();
+	void run(Job& job, int num_tasks);
+	bool runOne(int home);
+	void workerLoop(int id);
+};
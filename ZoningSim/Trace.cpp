@@ -0,0 +1,204 @@
+﻿#include "Trace.h"
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+
+const int Trace::CAPACITY = 1 << 16;
+
+namespace {
+	/**
+	 * リングバッファの1要素。seqは、書き込みが完了した時に (書き込み位置 + 1) にセットする。
+	 * 読み込み時にseqを確認することで、書き込み途中や上書き済みの要素を読み飛ばす。
+	 * 読み込みと上書きが重なってもデータ競合にならないよう、各フィールドはrelaxedのatomicで読み書きする。
+	 */
+	struct Slot {
+		std::atomic<uint64_t> seq;
+		std::atomic<const char*> name;
+		std::atomic<uint32_t> tid;
+		std::atomic<uint32_t> owner;
+		std::atomic<int> step;
+		std::atomic<int64_t> start;
+		std::atomic<int64_t> duration;
+
+		/**
+		 * posの位置の記録を読み込む。書き込み途中か、上書きされていたら、falseを返却する。
+		 */
+		bool read(uint64_t pos, TraceEvent& event) const {
+			if (seq.load(std::memory_order_acquire) != pos + 1) return false;
+			event.name = name.load(std::memory_order_relaxed);
+			event.tid = tid.load(std::memory_order_relaxed);
+			event.owner = owner.load(std::memory_order_relaxed);
+			event.step = step.load(std::memory_order_relaxed);
+			event.start = start.load(std::memory_order_relaxed);
+			event.duration = duration.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			return seq.load(std::memory_order_relaxed) == pos + 1;
+		}
+	};
+
+	struct Buffer {
+		Slot* slots;
+		std::atomic<uint64_t> head;
+		std::atomic<uint32_t> num_threads;
+		std::chrono::steady_clock::time_point epoch;
+
+		Buffer() : head(0), num_threads(0), epoch(std::chrono::steady_clock::now()) {
+			slots = new Slot[Trace::CAPACITY];
+			for (int i = 0; i < Trace::CAPACITY; ++i) {
+				slots[i].seq.store(0, std::memory_order_relaxed);
+			}
+		}
+	};
+
+	Buffer& buffer() {
+		static Buffer buf;
+		return buf;
+	}
+
+	struct ThreadState {
+		uint32_t tid;
+		uint32_t owner;
+		int step;
+
+		ThreadState() : tid(buffer().num_threads++), step(-1) { owner = tid; }
+	};
+
+	ThreadState& threadState() {
+		thread_local ThreadState state;
+		return state;
+	}
+
+	/**
+	 * JSONの文字列として出力するため、"と\をエスケープする。
+	 */
+	void writeEscaped(FILE* fp, const char* str) {
+		for (const char* p = str; *p; ++p) {
+			if (*p == '"' || *p == '\\') fputc('\\', fp);
+			fputc(*p, fp);
+		}
+	}
+}
+
+/**
+ * トレースの開始時刻からの経過時間 [ns] を返却する。
+ */
+int64_t Trace::now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - buffer().epoch).count();
+}
+
+/**
+ * 呼び出したスレッドの、現在のステップ番号をセットする。以降の記録には、このステップ番号が付く。
+ */
+void Trace::setStep(int step) {
+	threadState().step = step;
+}
+
+/**
+ * 呼び出したスレッドの、現在のコンテキストを返却する。
+ */
+TraceContext Trace::context() {
+	ThreadState& state = threadState();
+	TraceContext ret = { state.owner, state.step };
+	return ret;
+}
+
+/**
+ * 呼び出したスレッドのコンテキストをセットする。以降の記録は、contextのスレッドの記録として集計される。
+ * 自分のコンテキストに戻すには、元のcontext()の値をセットし直す。
+ */
+void Trace::setContext(const TraceContext& context) {
+	ThreadState& state = threadState();
+	state.owner = context.owner;
+	state.step = context.step;
+}
+
+/**
+ * 区間を1つ記録する。
+ */
+void Trace::record(const char* name, int64_t start, int64_t duration) {
+	Buffer& buf = buffer();
+	ThreadState& state = threadState();
+
+	uint64_t pos = buf.head.fetch_add(1, std::memory_order_relaxed);
+	Slot& slot = buf.slots[pos & (CAPACITY - 1)];
+	slot.seq.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.name.store(name, std::memory_order_relaxed);
+	slot.tid.store(state.tid, std::memory_order_relaxed);
+	slot.owner.store(state.owner, std::memory_order_relaxed);
+	slot.step.store(state.step, std::memory_order_relaxed);
+	slot.start.store(start, std::memory_order_relaxed);
+	slot.duration.store(duration, std::memory_order_relaxed);
+	slot.seq.store(pos + 1, std::memory_order_release);
+}
+
+/**
+ * 現在の書き込み位置を返却する。summarize()で、この位置以降の記録だけを集計するのに使う。
+ */
+uint64_t Trace::position() {
+	return buffer().head.load(std::memory_order_acquire);
+}
+
+/**
+ * since以降に、呼び出したスレッド（と、そのスレッドから処理を任されたスレッド）が記録した区間の処理時間を、
+ * 名前ごとに合計する [sec]。
+ */
+void Trace::summarize(uint64_t since, QMap<QString, float>& totals) {
+	Buffer& buf = buffer();
+	uint32_t tid = threadState().tid;
+
+	uint64_t end = buf.head.load(std::memory_order_acquire);
+	if (end - since > (uint64_t)CAPACITY) since = end - CAPACITY;
+
+	for (uint64_t pos = since; pos < end; ++pos) {
+		TraceEvent event;
+		if (!buf.slots[pos & (CAPACITY - 1)].read(pos, event)) continue;
+		if (event.owner != tid) continue;
+
+		totals[event.name] += event.duration * 1e-9f;
+	}
+}
+
+/**
+ * バッファに残っている記録を、Chromeのtrace event形式のJSONで保存する。
+ *
+ * @return		保存できたらtrue
+ */
+bool Trace::dump(const QString& filename) {
+	FILE* fp = fopen(filename.toUtf8().constData(), "w");
+	if (fp == NULL) return false;
+
+	Buffer& buf = buffer();
+	uint64_t end = buf.head.load(std::memory_order_acquire);
+	uint64_t begin = end > (uint64_t)CAPACITY ? end - CAPACITY : 0;
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool first = true;
+	for (uint64_t pos = begin; pos < end; ++pos) {
+		TraceEvent event;
+		if (!buf.slots[pos & (CAPACITY - 1)].read(pos, event)) continue;
+
+		if (!first) fprintf(fp, ",\n");
+		first = false;
+
+		fprintf(fp, "{\"name\":\"");
+		writeEscaped(fp, event.name);
+		fprintf(fp, "\",\"cat\":\"zoning\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3lf,\"dur\":%.3lf,\"args\":{\"step\":%d}}",
+			event.tid, event.start * 1e-3, event.duration * 1e-3, event.step);
+	}
+	fprintf(fp, "\n]}\n");
+
+	fclose(fp);
+	return true;
+}
+
+/**
+ * 全ての記録を破棄する。記録中のスレッドがない時に呼び出すこと。
+ */
+void Trace::clear() {
+	Buffer& buf = buffer();
+	for (int i = 0; i < CAPACITY; ++i) {
+		buf.slots[i].seq.store(0, std::memory_order_relaxed);
+	}
+	buf.head.store(0, std::memory_order_release);
+}
@@ -0,0 +1,81 @@
+﻿#pragma once
+
+#include <stdint.h>
+#include <QMap>
+#include <QString>
+
+/**
+ * トレースを有効にするか。0を定義してビルドすると、ZONING_TRACE_SCOPEは何も生成しない。
+ */
+#ifndef ZONING_TRACE
+#define ZONING_TRACE 1
+#endif
+
+/**
+ * 1つの区間の記録。
+ */
+struct TraceEvent {
+	const char* name;	// 区間の名前（文字列リテラル）
+	uint32_t tid;		// スレッド番号
+	uint32_t owner;		// 集計先のスレッド番号（他のスレッドに任された処理では、任せた側のスレッド）
+	int step;			// シミュレーションのステップ番号
+	int64_t start;		// 開始時刻 [ns]
+	int64_t duration;	// 処理時間 [ns]
+};
+
+/**
+ * 記録に付ける、集計先のスレッドとステップ番号。
+ * 処理を他のスレッドに任せる時に、任せた側のコンテキストを引き継ぐのに使う。
+ */
+struct TraceContext {
+	uint32_t owner;
+	int step;
+};
+
+/**
+ * 処理時間の区間を記録する、ロックフリーのリングバッファ。
+ *
+ * 各スレッドは、書き込み位置をatomicに1つ進めて、その位置に記録するだけなので、ロックは不要。
+ * バッファが一杯になると、古い記録から上書きする。
+ * 記録はChromeのtrace event形式のJSONで出力でき、chrome://tracingなどで表示できる。
+ * GUIでは、環境変数ZONING_TRACE_FILEにファイル名を指定すると、終了時にそのファイルへ出力する。
+ */
+class Trace {
+public:
+	static const int CAPACITY;
+
+	static int64_t now();
+	static void setStep(int step);
+	static TraceContext context();
+	static void setContext(const TraceContext& context);
+	static void record(const char* name, int64_t start, int64_t duration);
+	static uint64_t position();
+	static void summarize(uint64_t since, QMap<QString, float>& totals);
+	static bool dump(const QString& filename);
+	static void clear();
+
+private:
+	Trace() {}
+};
+
+/**
+ * コンストラクタからデストラクタまでの区間を記録する。
+ */
+class TraceScope {
+private:
+	const char* name;
+	int64_t start;
+
+public:
+	TraceScope(const char* name) : name(name), start(Trace::now()) {}
+	~TraceScope() { Trace::record(name, start, Trace::now() - start); }
+};
+
+#define ZONING_TRACE_CONCAT_(a, b) a##b
+#define ZONING_TRACE_CONCAT(a, b) ZONING_TRACE_CONCAT_(a, b)
+
+#if ZONING_TRACE
+#define ZONING_TRACE_SCOPE(name) TraceScope ZONING_TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#else
+#define ZONING_TRACE_SCOPE(name)
+#endif
@@ -1,5 +1,5 @@
 ﻿#include "Util.h"
-#include <random>
+#include "Random.h"
 
 
 const float Util::MTC_FLOAT_TOL = 1e-6f;
@@ -363,83 +363,55 @@ float Util::curvature(const Polyline2D &polyline) {
 }
 
 /**
- * Uniform乱数[0, 1)を生成する
+ * Uniform乱数[0, 1)を生成する。
+ * 乱数は、呼び出したスレッド専用の乱数列（Random::threadDefault()）から生成する。
+ * 再現性が必要な場合は、Randomを直接使うこと。
  */
 float Util::genRand() {
-	return rand() / (float(RAND_MAX) + 1);
+	return Random::threadDefault().uniform();
 }
 
 /**
  * 指定された範囲[a, b)のUniform乱数を生成する
  */
 float Util::genRand(float a, float b) {
-	return genRand() * (b - a) + a;
+	return Random::threadDefault().uniform(a, b);
+}
+
+/**
+ * 53bitの精度を持つ、[0, 1)のUniform乱数を生成する。
+ */
+double Util::genRandDouble() {
+	return Random::threadDefault().uniformDouble();
 }
 
 /**
  * Normal distributionを使用して乱数を生成する。
  */
 float Util::genRandNormal(float mean, float variance) {
-	/*
-	static std::default_random_engine generator;
-
-	std::normal_distribution<float> distribution(mean, sqrtf(variance));
-	return distribution(generator);
-	*/
-
-#if 1
-	float m = mean;
-	float s = sqrt(variance);
-
-	/* mean m, standard deviation s */
-	float x1, x2, w, y1;
-	static float y2;
-	static int use_last = 0;
+	return Random::threadDefault().normal(mean, variance);
+}
 
-	if (use_last) {	/* use value from previous call */
-		y1 = y2;
-		use_last = 0;
-	} else {
-		do {
-			x1 = 2.0 * genRand(0.0f, 1.0f) - 1.0;
-			x2 = 2.0 * genRand(0.0f, 1.0f) - 1.0;
-			w = x1 * x1 + x2 * x2;
-		} while ( w >= 1.0 );
-
-		w = sqrt( (-2.0 * log( w ) ) / w );
-		y1 = x1 * w;
-		y2 = x2 * w;
-		use_last = 1;
-	}
+/**
+ * 二項分布B(n, p)に従う乱数を生成する。
+ */
+int Util::genRandBinomial(int n, float p) {
+	return Random::threadDefault().binomial(n, p);
+}
 
-	return m + y1 * s;
-#endif
+/**
+ * n個を、pdfの比率に従って多項分布でサンプリングし、各要素の個数をcountsに格納する。
+ */
+void Util::sampleMultinomial(int n, const std::vector<float> &pdf, std::vector<int> &counts) {
+	Random::threadDefault().sampleMultinomial(n, pdf, counts);
 }
 
 int Util::sampleFromCdf(std::vector<float> &cdf) {
-	float rnd = genRand(0, cdf.back());
-
-	for (int i = 0; i < cdf.size(); ++i) {
-		if (rnd <= cdf[i]) return i;
-	}
-
-	return cdf.size() - 1;
+	return Random::threadDefault().sampleFromCdf(cdf);
 }
 
 int Util::sampleFromPdf(std::vector<float> &pdf) {
-	if (pdf.size() == 0) return 0;
-
-	std::vector<float> cdf(pdf.size(), 0.0f);
-	cdf[0] = pdf[0];
-	for (int i = 1; i < pdf.size(); ++i) {
-		if (pdf[i] >= 0) {
-			cdf[i] = cdf[i - 1] + pdf[i];
-		} else {
-			cdf[i] = cdf[i - 1];
-		}
-	}
-
-	return sampleFromCdf(cdf);
+	return Random::threadDefault().sampleFromPdf(pdf);
 }
 
 /**
@@ -48,7 +48,10 @@ public:
 	// random
 	static float genRand();
 	static float genRand(float a, float b);
+	static double genRandDouble();
 	static float genRandNormal(float mean, float variance);
+	static int genRandBinomial(int n, float p);
+	static void sampleMultinomial(int n, const std::vector<float> &pdf, std::vector<int> &counts);
 	static int sampleFromCdf(std::vector<float> &cdf);
 	static int sampleFromPdf(std::vector<float> &pdf);
 
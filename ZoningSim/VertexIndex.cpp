@@ -0,0 +1,76 @@
+﻿#include "VertexIndex.h"
+
+VertexIndex::VertexIndex(float cell_size) {
+	this->cell_size = cell_size;
+	min_x = min_y = std::numeric_limits<int>::max();
+	max_x = max_y = std::numeric_limits<int>::min();
+	stale = false;
+}
+
+/**
+ * インデックスを、道路グラフに合わせる。後から追加された頂点だけを登録する。
+ * invalidate()された場合や、頂点が減った場合は、作り直す。
+ */
+void VertexIndex::sync(const RoadGraph& roads) {
+	const int num_vertices = boost::num_vertices(roads.graph);
+	if (stale || num_vertices < pts.size()) {
+		rebuild(roads);
+		return;
+	}
+
+	for (int v = pts.size(); v < num_vertices; ++v) {
+		insert(v, roads.graph[v]->pt);
+	}
+}
+
+/**
+ * 全ての頂点を登録し直す。
+ */
+void VertexIndex::rebuild(const RoadGraph& roads) {
+	buckets.clear();
+	pts.clear();
+	min_x = min_y = std::numeric_limits<int>::max();
+	max_x = max_y = std::numeric_limits<int>::min();
+	stale = false;
+
+	const int num_vertices = boost::num_vertices(roads.graph);
+	pts.reserve(num_vertices);
+	for (int v = 0; v < num_vertices; ++v) {
+		insert(v, roads.graph[v]->pt);
+	}
+}
+
+/**
+ * 頂点を登録する。頂点は、番号順に登録すること。
+ */
+void VertexIndex::insert(RoadVertexDesc v, const QVector2D& pt) {
+	if (v >= pts.size()) pts.resize(v + 1);
+	pts[v] = pt;
+
+	int x = cell(pt.x());
+	int y = cell(pt.y());
+	buckets[key(x, y)].push_back(v);
+	min_x = std::min(min_x, x);
+	min_y = std::min(min_y, y);
+	max_x = std::max(max_x, x);
+	max_y = std::max(max_y, y);
+}
+
+/**
+ * 頂点の座標を更新する。
+ */
+void VertexIndex::move(RoadVertexDesc v, const QVector2D& pt) {
+	if (v >= pts.size()) return;
+
+	std::vector<RoadVertexDesc>& bucket = buckets[key(cell(pts[v].x()), cell(pts[v].y()))];
+	bucket.erase(std::remove(bucket.begin(), bucket.end(), v), bucket.end());
+
+	pts[v] = pt;
+	int x = cell(pt.x());
+	int y = cell(pt.y());
+	buckets[key(x, y)].push_back(v);
+	min_x = std::min(min_x, x);
+	min_y = std::min(min_y, y);
+	max_x = std::max(max_x, x);
+	max_y = std::max(max_y, y);
+}
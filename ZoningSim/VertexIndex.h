@@ -0,0 +1,151 @@
+﻿#pragma once
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <QHash>
+#include <QVector2D>
+#include "RoadGraph.h"
+
+/**
+ * 頂点の座標の空間インデックス（一様なハッシュグリッド）。
+ * 最近傍、k近傍、半径内の頂点を、全頂点を走査せずに求める。
+ *
+ * 頂点は、無効になってもインデックスから削除しない。各クエリのfilterで、valid等をチェックすること。
+ * 距離が等しい頂点は、番号が小さい方を優先するので、全頂点を順に走査した場合と同じ結果になる。
+ *
+ * GraphUtil::addVertex()とmoveVertex()は、インデックスを更新する。それ以外の方法で追加された頂点は、
+ * sync()で追加される。頂点の座標を直接書き換えた場合は、invalidate()を呼ぶと、次のsync()で作り直す。
+ */
+class VertexIndex {
+private:
+	float cell_size;
+	QHash<qint64, std::vector<RoadVertexDesc> > buckets;
+	std::vector<QVector2D> pts;		// 各頂点の、インデックスに登録した座標
+	int min_x, min_y, max_x, max_y;	// 頂点が存在するセルの範囲
+	bool stale;
+
+public:
+	VertexIndex(float cell_size = 100.0f);
+
+	void sync(const RoadGraph& roads);
+	void rebuild(const RoadGraph& roads);
+	void invalidate() { stale = true; }
+	void insert(RoadVertexDesc v, const QVector2D& pt);
+	void move(RoadVertexDesc v, const QVector2D& pt);
+	int size() const { return pts.size(); }
+
+	/**
+	 * filter(v)がtrueの頂点のうち、ptに最も近い頂点を探す。
+	 *
+	 * @param max_dist	探索する最大距離（この距離ちょうどの頂点も含む）
+	 * @return			見つかったらtrue
+	 */
+	template<class Filter>
+	bool nearest(const QVector2D& pt, float max_dist, Filter filter, RoadVertexDesc& desc) const {
+		float best = max_dist * max_dist;	// FLT_MAXを指定すると無限大になり、距離の制限がなくなる
+		bool found = false;
+
+		const int cx = cell(pt.x());
+		const int cy = cell(pt.y());
+		for (int r = 0; !outside(cx, cy, r); ++r) {
+			// リングrの頂点は、少なくとも (r - 1) * cell_size 離れている
+			float bound = std::max(0, r - 1) * cell_size;
+			if (bound * bound > best) break;
+
+			visitRing(cx, cy, r, [&](RoadVertexDesc v) {
+				float dist = (pts[v] - pt).lengthSquared();
+				if (dist > best || (dist == best && found && v > desc)) return;
+				if (!filter(v)) return;
+				best = dist;
+				desc = v;
+				found = true;
+			});
+		}
+
+		return found;
+	}
+
+	/**
+	 * filter(v)がtrueの頂点のうち、ptに近い順にk個の頂点を返却する。
+	 */
+	template<class Filter>
+	std::vector<RoadVertexDesc> kNearest(const QVector2D& pt, int k, Filter filter) const {
+		std::vector<std::pair<float, RoadVertexDesc> > candidates;
+
+		const int cx = cell(pt.x());
+		const int cy = cell(pt.y());
+		for (int r = 0; k > 0 && !outside(cx, cy, r); ++r) {
+			float bound = std::max(0, r - 1) * cell_size;
+			if (candidates.size() >= k && bound * bound > candidates[k - 1].first) break;
+
+			visitRing(cx, cy, r, [&](RoadVertexDesc v) {
+				if (!filter(v)) return;
+				candidates.push_back(std::make_pair((pts[v] - pt).lengthSquared(), v));
+			});
+			std::sort(candidates.begin(), candidates.end());
+		}
+
+		std::vector<RoadVertexDesc> ret;
+		for (int i = 0; i < candidates.size() && i < k; ++i) {
+			ret.push_back(candidates[i].second);
+		}
+		return ret;
+	}
+
+	/**
+	 * filter(v)がtrueの頂点のうち、ptから半径radius以内（境界を含む）の頂点を、番号順に返却する。
+	 */
+	template<class Filter>
+	std::vector<RoadVertexDesc> withinRadius(const QVector2D& pt, float radius, Filter filter) const {
+		std::vector<RoadVertexDesc> ret;
+		const float radius2 = radius * radius;
+
+		for (int y = std::max(min_y, cell(pt.y() - radius)); y <= std::min(max_y, cell(pt.y() + radius)); ++y) {
+			for (int x = std::max(min_x, cell(pt.x() - radius)); x <= std::min(max_x, cell(pt.x() + radius)); ++x) {
+				QHash<qint64, std::vector<RoadVertexDesc> >::const_iterator it = buckets.constFind(key(x, y));
+				if (it == buckets.constEnd()) continue;
+				const std::vector<RoadVertexDesc>& bucket = it.value();
+				for (int i = 0; i < bucket.size(); ++i) {
+					RoadVertexDesc v = bucket[i];
+					if ((pts[v] - pt).lengthSquared() <= radius2 && filter(v)) ret.push_back(v);
+				}
+			}
+		}
+
+		std::sort(ret.begin(), ret.end());
+		return ret;
+	}
+
+private:
+	int cell(float x) const { return (int)floor(x / cell_size); }
+	static qint64 key(int x, int y) { return ((qint64)x << 32) | (unsigned int)y; }
+
+	/**
+	 * リングrが、頂点が存在するセルの範囲を全て超えたか。
+	 */
+	bool outside(int cx, int cy, int r) const {
+		return pts.empty() || (cx - r < min_x && cx + r > max_x && cy - r < min_y && cy + r > max_y);
+	}
+
+	/**
+	 * (cx, cy)からチェビシェフ距離rのセルにある、全ての頂点についてfunc(v)を呼ぶ。
+	 */
+	template<class F>
+	void visitRing(int cx, int cy, int r, F func) const {
+		for (int y = cy - r; y <= cy + r; ++y) {
+			if (y < min_y || y > max_y) continue;
+			int step = (y == cy - r || y == cy + r) ? 1 : 2 * r;
+			for (int x = cx - r; x <= cx + r; x += std::max(step, 1)) {
+				if (x < min_x || x > max_x) continue;
+				QHash<qint64, std::vector<RoadVertexDesc> >::const_iterator it = buckets.constFind(key(x, y));
+				if (it == buckets.constEnd()) continue;
+				const std::vector<RoadVertexDesc>& bucket = it.value();
+				for (int i = 0; i < bucket.size(); ++i) {
+					func(bucket[i]);
+				}
+			}
+		}
+	}
+};
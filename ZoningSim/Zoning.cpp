@@ -1,19 +1,29 @@
 ﻿#include "Zoning.h"
 #include "Util.h"
+#include "FenwickTree.h"
+#include "Random.h"
+#include "ZoningEnsemble.h"
+#include "Trace.h"
+#include "FieldEvaluator.h"
+#include "SimdKernels.h"
+#include "ThreadPool.h"
+#include "RoadRasterizer.h"
 #include "GraphUtil.h"
-#include <QElapsedTimer>
+#include <future>
 
 //#define DEBUG	0
 
 const float Zoning::MAX_LANDVALUE = 1000.0f;
 const int Zoning::MAX_POPULATION = 500;
 const int Zoning::MAX_JOBS = 500;
+const int Zoning::TOURNAMENT_SIZE = 10;
 
-Zoning::Zoning(float city_length, int grid_size, const QMap<QString, float>& weights) {
+Zoning::Zoning(float city_length, int grid_size, const QMap<QString, float>& weights, bool verbose) {
 	this->city_length = city_length;
 	this->grid_size = grid_size;
 	this->cell_length = city_length / grid_size;
-	this->weights = weights;
+	accessibilityMode = ACCESSIBILITY_DENSITY;
+	setWeights(weights);
 
 	zones = Mat_<uchar>(grid_size, grid_size);
 	accessibility = Mat_<float>::zeros(grid_size, grid_size);
@@ -25,15 +35,177 @@ Zoning::Zoning(float city_length, int grid_size, const QMap<QString, float>& wei
 	population = Mat_<float>::zeros(grid_size, grid_size);
 	commercialJobs = Mat_<float>::zeros(grid_size, grid_size);
 	industrialJobs = Mat_<float>::zeros(grid_size, grid_size);
+	populationDelta = Mat_<float>::zeros(grid_size, grid_size);
+	commercialJobsDelta = Mat_<float>::zeros(grid_size, grid_size);
+	industrialJobsDelta = Mat_<float>::zeros(grid_size, grid_size);
+
+	incrementalFields = true;
+	fullRebuildInterval = 10;
+	batchMoves = false;
+	fusedEvaluation = false;
+	this->verbose = verbose;
+	lastScore = 0.0f;
 	
 	init();
 }
 
+/**
+ * アンサンブル実行用に、このオブジェクトの複製を作成する。
+ * 道路データは複製しない。読み込み専用のaccessibilityとslopeは、コピーせずにデータを共有する。
+ * それ以外のフィールドは、複製ごとに新しく確保するので、init()を呼んでから使うこと。
+ */
+Zoning* Zoning::fork() const {
+	Zoning* zoning = new Zoning();
+	zoning->city_length = city_length;
+	zoning->grid_size = grid_size;
+	zoning->cell_length = cell_length;
+	zoning->weights = weights;
+	zoning->params = params;
+	zoning->tracker = tracker;
+	zoning->tracker.invalidateAll();
+
+	zoning->zones = Mat_<uchar>(grid_size, grid_size);
+	zoning->accessibility = accessibility;
+	for (int i = 0; i < 3; ++i) {
+		zoning->roadLength[i] = roadLength[i];
+	}
+	zoning->slope = slope;
+	zoning->neighborPopulation = Mat_<float>::zeros(grid_size, grid_size);
+	zoning->neighborCommercial = Mat_<float>::zeros(grid_size, grid_size);
+	zoning->pollution = Mat_<float>::zeros(grid_size, grid_size);
+	zoning->populationDelta = Mat_<float>::zeros(grid_size, grid_size);
+	zoning->commercialJobsDelta = Mat_<float>::zeros(grid_size, grid_size);
+	zoning->industrialJobsDelta = Mat_<float>::zeros(grid_size, grid_size);
+
+	zoning->incrementalFields = incrementalFields;
+	zoning->fullRebuildInterval = fullRebuildInterval;
+	zoning->batchMoves = batchMoves;
+	zoning->fusedEvaluation = fusedEvaluation;
+	zoning->accessibilityMode = accessibilityMode;
+	zoning->outputDir = outputDir;
+	zoning->verbose = false;
+	zoning->seed = 0;
+	zoning->step = 0;
+	zoning->lastScore = 0.0f;
+
+	return zoning;
+}
+
+/**
+ * デフォルトの重みを返却する。
+ * GUIとコマンドラインの両方から使用する。
+ */
+QMap<QString, float> Zoning::defaultWeights() {
+	QMap<QString, float> weights;
+	weights["highway_accessibility"] = 30.0f;			// セル内のhighway長が、アクセシビリティに与える影響度
+	weights["avenue_accessibility"] = 30.0f;			// セル内のavenue長が、アクセシビリティに与える影響度
+	weights["street_accessibility"] = 3.0f;			// セル内のlocal street長が、アクセシビリティに与える影響度
+
+	weights["population_neighbor"] = 0.15f;				// 人口が、周辺人口に与える影響
+	weights["distance_neighbor_population"] = 0.005f;	// 周辺人口を計算する際の、距離に対する係数
+	weights["commercial_neighbor"] = 0.15f;				// 店が、周辺商業に与える影響
+	weights["distance_neighbor_commercial"] = 0.004f;	// 周辺商業を計算する際の、距離に対する係数
+	weights["industrial_pollution"] = 0.2f;				// 工場が、汚染度に与える影響
+	weights["distance_pollution"] = 0.003f;				// 工場からの距離が、汚染度に与える影響
+
+	weights["accessibility_landvalue"] = 450.0f;		// アクセシビリティが、地価に与える影響度
+	weights["neighbor_population_landvalue"] = 100.0f;	// 周辺人口が、地価に与える影響度
+	weights["neighbor_commercial_landvalue"] = 300.0f;	// 周辺商業が、地価に与える影響度
+	weights["pollution_landvalue"] = -350.0f;			// 汚染度が、地価に与える影響度
+	weights["slope_landvalue"] = -100.0f;				// 地面傾斜が、地価に与える影響度
+	weights["population_landvalue"] = 200.0f;			// 人口が、地価に与える影響度
+	weights["commercialjobs_landvalue"] = 200.0f;		// 商業の仕事量が、地価に与える影響度
+	weights["industrialjobs_landvalue"] = 200.0f;		// 工業の仕事量が、地価に与える影響度
+
+	weights["accessibility_life"] = 0.6f;				// アクセシビリティが、良い生活に与える影響度
+	weights["neighbor_population_life"] = 0.0f;			// 周辺人口が、良い生活に与える影響度
+	weights["neighbor_commercial_life"] = 0.6f;			// 周辺商業が、良い生活に与える影響度
+	weights["pollution_life"] = -1.0f;					// 汚染度が、良い生活に与える影響度
+	weights["slope_life"] = -0.1f;						// 地面傾斜が、良い生活に与える影響度
+	weights["landvalue_life"] = -0.1f;					// 地価が、良い生活に与える影響度
+	weights["population_life"] = 0.0f;					// 人口が、良い生活に与える影響度
+	weights["commercialjobs_life"] = 0.05f;				// 商業の仕事量が、良い生活に与える影響度
+	weights["industrialjobs_life"] = -1.0f;				// 工業の仕事量が、良い生活に与える影響度
+
+	weights["accessibility_shop"] = 0.5f;				// アクセシビリティが、店に与える影響度
+	weights["neighbor_population_shop"] = 0.8f;			// 周辺人口が、店に与える影響度
+	weights["neighbor_commercial_shop"] = 0.0f;			// 周辺商業が、店に与える影響度
+	weights["pollution_shop"] = -0.1f;					// 汚染度が、店に与える影響度
+	weights["slope_shop"] = 0.0f;						// 地面傾斜が、店に与える影響度
+	weights["landvalue_shop"] = 0.2f;					// 地価が、店に与える影響度
+	weights["population_shop"] = 0.0f;					// 人口が、店に与える影響度
+	weights["commercialjobs_shop"] = 0.0f;				// 商業の仕事量が、店に与える影響度
+	weights["industrialjobs_shop"] = 0.0f;				// 工業の仕事量が、店に与える影響度
+
+	weights["accessibility_factory"] = 0.1f;			// アクセシビリティが、工場に与える影響度
+	weights["neighbor_population_factory"] = -0.2f;		// 周辺人口が、工場に与える影響度
+	weights["neighbor_commercial_factory"] = 0.0f;		// 周辺商業が、工場に与える影響度
+	weights["pollution_factory"] = 0.7f;				// 汚染度が、工場に与える影響度
+	weights["slope_factory"] = 0.0f;					// 地面傾斜が、工場に与える影響度
+	weights["landvalue_factory"] = -0.1f;				// 地価が、工場に与える影響度
+	weights["population_factory"] = -1.0f;				// 人口が、工場に与える影響度
+	weights["commercialjobs_factory"] = 0.0f;			// 商業の仕事量が、工場に与える影響度
+	weights["industrialjobs_factory"] = 0.0f;			// 工業の仕事量が、工場に与える影響度
+
+	return weights;
+}
+
+/**
+ * 重みをセットし、シミュレーションで使う係数にコンパイルする。
+ * 重みを変更した場合は、必ずこの関数を呼び出すこと。
+ */
+void Zoning::setWeights(const QMap<QString, float>& weights) {
+	this->weights = weights;
+	ZoningParams old_params = params;
+
+	float normalization[ZoningParams::NUM_INPUTS];
+	for (int i = 0; i < ZoningParams::NUM_INPUTS; ++i) {
+		normalization[i] = 1.0f;
+	}
+	normalization[ZoningParams::INPUT_LANDVALUE] = 1.0f / MAX_LANDVALUE;
+	normalization[ZoningParams::INPUT_POPULATION] = 1.0f / MAX_POPULATION;
+	normalization[ZoningParams::INPUT_COMMERCIALJOBS] = 1.0f / MAX_JOBS;
+	normalization[ZoningParams::INPUT_INDUSTRIALJOBS] = 1.0f / MAX_JOBS;
+
+	params.compile(weights, normalization);
+
+	// 係数が変わったフィールドだけを、計算し直すようにする
+	unsigned int changed = params.changedGroups(old_params);
+	if ((changed & ZoningParams::group(ZoningParams::GROUP_ACCESSIBILITY)) && accessibilityMode == ACCESSIBILITY_DENSITY) {
+		combineAccessibility();
+	}
+	static const int fields[ZoningParams::NUM_GROUPS] = {
+		StepScheduler::FIELD_ACCESSIBILITY, StepScheduler::FIELD_NEIGHBOR_POPULATION, StepScheduler::FIELD_NEIGHBOR_COMMERCIAL, StepScheduler::FIELD_POLLUTION,
+		StepScheduler::FIELD_LANDVALUE, StepScheduler::FIELD_LIFE, StepScheduler::FIELD_SHOP, StepScheduler::FIELD_FACTORY
+	};
+	for (int g = ZoningParams::GROUP_NEIGHBOR_POPULATION; g < ZoningParams::NUM_GROUPS; ++g) {
+		if (changed & ZoningParams::group(g)) tracker.invalidate(fields[g]);
+	}
+	updateDependencies();
+}
+
+/**
+ * 入力が変わった派生フィールドだけを計算し直し、全てのフィールドを最新の状態にする。
+ * 重みを変更した後に呼び出せば、init()からやり直さずに、変更の影響だけを反映できる。
+ */
+void Zoning::refresh() {
+	ZONING_TRACE_SCOPE("refresh");
+
+	refreshField(StepScheduler::FIELD_NEIGHBOR_POPULATION, &Zoning::computeNeighborPopulation);
+	refreshField(StepScheduler::FIELD_NEIGHBOR_COMMERCIAL, &Zoning::computeNeighborCommercial);
+	refreshField(StepScheduler::FIELD_POLLUTION, &Zoning::computePollution);
+	evaluateFields();
+}
+
 /**
  * 道路をセットする。
  */
 void Zoning::setRoads(RoadGraph& roads) {
 	this->roads = roads;
+	this->roads.setModified();
+
+	// 無効な頂点とエッジが多ければ、取り除いておく（道路の走査や、CSRの構築が速くなる）
+	GraphUtil::compactIfNeeded(this->roads);
 
 	computeAccessibility();
 }
@@ -44,17 +216,25 @@ void Zoning::setRoads(RoadGraph& roads) {
  * @param rand_seed		乱数シード
  */
 void Zoning::init(int rand_seed) {
+	ZONING_TRACE_SCOPE("init");
+
 	landValue = Mat_<float>::zeros(grid_size, grid_size);
 	population = Mat_<float>::zeros(grid_size, grid_size);
 	commercialJobs = Mat_<float>::zeros(grid_size, grid_size);
 	industrialJobs = Mat_<float>::zeros(grid_size, grid_size);
+	resetNeighborFields();
 
-	srand(rand_seed);
+	// 乱数列は (seed, step, stream) で決まるので、同じシードなら常に同じ結果になる
+	seed = rand_seed;
+	step = 0;
+	Trace::setStep(step);
 
 	// ゾーンをランダムに初期化
+	vector<float> rnd(grid_size * grid_size);
+	Random(seed, step, STREAM_INIT_ZONES).fillUniform(rnd.data(), rnd.size(), 0, 10);
 	for (int r = 0; r < grid_size; ++r) {
 		for (int c = 0; c < grid_size; ++c) {
-			float n = Util::genRand(0, 10);
+			float n = rnd[r * grid_size + c];
 
 			if (n <= 6) {
 				zones(r, c) = TYPE_RESIDENTIAL;
@@ -70,35 +250,35 @@ void Zoning::init(int rand_seed) {
 
 
 	// 人、仕事を初期化
+	rng = Random(seed, step, STREAM_INIT_UNITS);
 	for (int r = 0; r < grid_size; ++r) {
 		for (int c = 0; c < grid_size; ++c) {
 			if (zones(r, c) == TYPE_RESIDENTIAL) {
-				population(r, c) = (int)Util::genRand(50, 350);
+				population(r, c) = (int)rng.uniform(50, 350);
 			} else if (zones(r, c) == TYPE_COMMERCIAL) {
-				commercialJobs(r, c) = (int)Util::genRand(50, 350);
+				commercialJobs(r, c) = (int)rng.uniform(50, 350);
 			} else if (zones(r, c) == TYPE_INDUSTRIAL) {
-				industrialJobs(r, c) = (int)Util::genRand(50, 350);
+				industrialJobs(r, c) = (int)rng.uniform(50, 350);
 			} else if (zones(r, c) == TYPE_MIXED) {
-				population(r, c) = (int)(Util::genRand(50, 350) * 0.5);
-				commercialJobs(r, c) = (int)(Util::genRand(50, 350) * 0.5);
+				population(r, c) = (int)(rng.uniform(50, 350) * 0.5);
+				commercialJobs(r, c) = (int)(rng.uniform(50, 350) * 0.5);
 			}
 		}
 	}
 
 
-	computeNeighborPopulation();
-	computeNeighborCommercial();
-	computePollution();
+	tracker.invalidateAll();
+	tracker.touch(StepScheduler::FIELD_POPULATION);
+	tracker.touch(StepScheduler::FIELD_COMMERCIALJOBS);
+	tracker.touch(StepScheduler::FIELD_INDUSTRIALJOBS);
 
-	updateLandValue();
+	refresh();
 
-	computeLife();
-	computeShop();
-	computeFactory();
-
-	cout << "Score: " << computeScore() << endl;
-	cout << "Initialized." << endl;
-	cout << endl;
+	if (verbose) {
+		cout << "Score: " << computeScore() << endl;
+		cout << "Initialized." << endl;
+		cout << endl;
+	}
 }
 
 /**
@@ -112,89 +292,165 @@ void Zoning::init(int rand_seed) {
  */
 void Zoning::nextSteps(int numSteps, float move_rate, bool saveScores, bool saveBestZoning, bool saveZonings) {
 	elapsedTimes.clear();
+	uint64_t trace_mark = Trace::position();
 
 	FILE* fp;
 	if (saveScores) {
-		fp = fopen("scores.txt", "w");
+		fp = fopen(outputPath("scores.txt").toUtf8().constData(), "w");
 	}
 
 	Mat_<uchar> best_zones;
 	float best_score = -numeric_limits<float>::max();
 
-	for (int iter = 0; iter < numSteps; ++iter) {
-		updateLandValue();
-
-		computeLife();
-		computeShop();
-		computeFactory();
+	buildStepGraph(move_rate);
 
-		updatePeopleAndJobs(move_rate);
+	// 前のステップの出力（スコアの書き込み、ゾーンの画像の保存）は、次のステップの計算と並行して行う
+	std::future<void> output;
+	const TraceContext context = Trace::context();
+	bool keepZones = saveBestZoning || saveZonings;
 
-		updateZones();
+	for (int iter = 0; iter < numSteps; ++iter) {
+		// 各ステップの移動には、そのステップ専用の乱数列を使う
+		step++;
+		rng = Random(seed, step, STREAM_MOVES);
 
-		computeNeighborPopulation();
-		computeNeighborCommercial();
-		computePollution();
+		Trace::setStep(step);
+		ZONING_TRACE_SCOPE("step");
 
-		float score = computeScore();
+		if (fullRebuildInterval > 0 && (iter + 1) % fullRebuildInterval == 0) {
+			resetNeighborFields();
+		}
 
-		if (saveScores) {
-			fprintf(fp, "%lf\n", score);
+		// 前のステップのゾーンは出力中かもしれないので、新しいバッファに書き込む
+		if (keepZones) {
+			zones = Mat_<uchar>(grid_size, grid_size);
+			tracker.invalidate(StepScheduler::FIELD_ZONES);
 		}
 
+		scheduler.run();
+		float score = lastScore;
+
+		// このステップのゾーンのバッファは、以降書き換えないので、コピーせずに共有する
+		Mat_<uchar> step_zones = zones;
 		if (score > best_score) {
 			best_score = score;
-			zones.copyTo(best_zones);
+			best_zones = step_zones;
 		}
 
-		if (saveZonings) {
-			char filename[256];
-			sprintf(filename, "zone_%d.png", iter);
-			saveZoneImage(zones, filename);
+		if (output.valid()) output.wait();
+		if (saveScores || saveZonings) {
+			TraceContext step_context = Trace::context();
+			output = std::async(std::launch::async, [=]() {
+				Trace::setContext(step_context);
+				if (saveScores) {
+					fprintf(fp, "%lf\n", score);
+				}
+				if (saveZonings) {
+					saveZoneImage(step_zones, outputPath(QString("zone_%1.png").arg(iter)));
+				}
+			});
 		}
 	}
 
+	if (output.valid()) output.wait();
+
 	if (saveScores) {
 		fclose(fp);
 	}
 
-	if (saveBestZoning) {
-		cout << "Best score: " << best_score << endl;
-		cout << endl;
-		saveZoneImage(best_zones, "best_zone.png");
+	// ステップを実行していなければ、ベストのゾーニングはない
+	if (saveBestZoning && !best_zones.empty()) {
+		if (verbose) {
+			cout << "Best score: " << best_score << endl;
+			cout << endl;
+		}
+		saveZoneImage(best_zones, outputPath("best_zone.png"));
 	}
 
+	if (!verbose) return;
+
+#if ZONING_TRACE
+	// 各ステージの処理時間は、このスレッドのトレースの記録から集計する
+	Trace::summarize(trace_mark, elapsedTimes);
 
 	cout << "computeNeighborPopulation(): " << elapsedTimes["computeNeighborPopulation"] << " [sec]" << endl;
-	cout << "computeNeighborComercial(): " << elapsedTimes["computeNeighborComercial"] << " [sec]" << endl;
+	cout << "computeNeighborCommercial(): " << elapsedTimes["computeNeighborCommercial"] << " [sec]" << endl;
 	cout << "computePollution(): " << elapsedTimes["computePollution"] << " [sec]" << endl;
+	cout << "evaluateFields(): " << elapsedTimes["evaluateFields"] << " [sec]" << endl;
 	cout << "updateLandValue(): " << elapsedTimes["updateLandValue"] << " [sec]" << endl;
 	cout << "updatePeopleAndJobs(): " << elapsedTimes["updatePeopleAndJobs"] << " [sec]" << endl;
 	cout << "computeLife(): " << elapsedTimes["computeLife"] << " [sec]" << endl;
 	cout << "computeShop(): " << elapsedTimes["computeShop"] << " [sec]" << endl;
-	cout << "computeFactory()(): " << elapsedTimes["computeFactory"] << " [sec]" << endl;
+	cout << "computeFactory(): " << elapsedTimes["computeFactory"] << " [sec]" << endl;
 	cout << "updateZones(): " << elapsedTimes["updateZones"] << " [sec]" << endl;
+#else
+	// トレースを無効にしてビルドした場合は、各ステージの処理時間は記録されない
+	cout << "Per-stage times are not available (built with ZONING_TRACE=0)." << endl;
+#endif
 	cout << endl;
+
+	// 最後のステップの、ステージの依存グラフとクリティカルパス
+	cout << scheduler.describe().toUtf8().constData() << endl;
 	cout << "Score: " << computeScore() << endl;
 	cout << "... next steps done.\n" << endl;
 	cout << endl;
 }
 
-void Zoning::testRandomGeneration(int num) {
-	FILE* fp = fopen("features.txt", "w");
+/**
+ * 1ステップの各ステージと、それぞれが読み書きするフィールドを、スケジューラに登録する。
+ * 周辺人口・周辺商業・汚染度の計算、ゾーンの更新、スコアの計算は互いに独立なので、並列に実行される。
+ * fusedEvaluationがfalseの場合は、生活・店・工場の指標の計算も並列に実行される。
+ *
+ * スコアは、ステージの関数が呼び出し元より長く残っても安全なように、メンバのlastScoreに格納する。
+ *
+ * @param move_rate		各ステップで動かす人・仕事の割合
+ */
+void Zoning::buildStepGraph(float move_rate) {
+	typedef StepScheduler S;
+	const unsigned int people = S::field(S::FIELD_POPULATION) | S::field(S::FIELD_COMMERCIALJOBS) | S::field(S::FIELD_INDUSTRIALJOBS);
+	const unsigned int utilities = S::field(S::FIELD_LIFE) | S::field(S::FIELD_SHOP) | S::field(S::FIELD_FACTORY);
+	const unsigned int inputs = S::field(S::FIELD_ACCESSIBILITY) | S::field(S::FIELD_NEIGHBOR_POPULATION) | S::field(S::FIELD_NEIGHBOR_COMMERCIAL) | S::field(S::FIELD_POLLUTION) | S::field(S::FIELD_SLOPE) | people;
+
+	scheduler.clear();
+
+	if (fusedEvaluation) {
+		scheduler.addStage("evaluateFields", inputs, S::field(S::FIELD_LANDVALUE) | utilities, [this]() { evaluateFields(); });
+	} else {
+		scheduler.addStage("updateLandValue", inputs, S::field(S::FIELD_LANDVALUE), [this]() { refreshField(S::FIELD_LANDVALUE, &Zoning::updateLandValue); });
+		scheduler.addStage("computeLife", inputs | S::field(S::FIELD_LANDVALUE), S::field(S::FIELD_LIFE), [this]() { refreshField(S::FIELD_LIFE, &Zoning::computeLife); });
+		scheduler.addStage("computeShop", inputs | S::field(S::FIELD_LANDVALUE), S::field(S::FIELD_SHOP), [this]() { refreshField(S::FIELD_SHOP, &Zoning::computeShop); });
+		scheduler.addStage("computeFactory", inputs | S::field(S::FIELD_LANDVALUE), S::field(S::FIELD_FACTORY), [this]() { refreshField(S::FIELD_FACTORY, &Zoning::computeFactory); });
+	}
 
+	scheduler.addStage("updatePeopleAndJobs", people | utilities | S::field(S::FIELD_RNG), people | S::field(S::FIELD_RNG), [this, move_rate]() { updatePeopleAndJobs(move_rate); });
+	scheduler.addStage("updateZones", people, S::field(S::FIELD_ZONES), [this]() { refreshField(S::FIELD_ZONES, &Zoning::updateZones); });
+	scheduler.addStage("computeNeighborPopulation", S::field(S::FIELD_POPULATION), S::field(S::FIELD_NEIGHBOR_POPULATION), [this]() { refreshField(S::FIELD_NEIGHBOR_POPULATION, &Zoning::computeNeighborPopulation); });
+	scheduler.addStage("computeNeighborCommercial", S::field(S::FIELD_COMMERCIALJOBS), S::field(S::FIELD_NEIGHBOR_COMMERCIAL), [this]() { refreshField(S::FIELD_NEIGHBOR_COMMERCIAL, &Zoning::computeNeighborCommercial); });
+	scheduler.addStage("computePollution", S::field(S::FIELD_INDUSTRIALJOBS), S::field(S::FIELD_POLLUTION), [this]() { refreshField(S::FIELD_POLLUTION, &Zoning::computePollution); });
+	scheduler.addStage("computeScore", people | utilities, S::field(S::FIELD_SCORE), [this]() { lastScore = computeScore(); });
+}
+
+/**
+ * ランダムに初期化したゾーニングをnum個シミュレーションし、特徴量とスコアをfeatures.txtに保存する。
+ * 各サンプルは独立なので、全てのコアを使って並列に実行する。結果はシードの順に出力する。
+ */
+void Zoning::testRandomGeneration(int num) {
 	time_t timer;
 	time(&timer);
+
+	vector<int> seeds(num);
 	for (int iter = 0; iter < num; ++iter) {
-		init(timer + iter);
+		seeds[iter] = timer + iter;
+	}
 
-		nextSteps(10, 0.5, false, false, false);
+	vector<ZoningSample> samples = ZoningEnsemble::run(*this, seeds, 10, 0.5);
 
-		vector<float> feature = computeFeature(zones);
-		for (int k = 0; k < feature.size(); ++k) {
-			fprintf(fp, "%lf,", feature[k]);
+	FILE* fp = fopen(outputPath("features.txt").toUtf8().constData(), "w");
+	for (int iter = 0; iter < samples.size(); ++iter) {
+		for (int k = 0; k < samples[iter].feature.size(); ++k) {
+			fprintf(fp, "%lf,", samples[iter].feature[k]);
 		}
-		fprintf(fp, "%lf\n", computeScore());
+		fprintf(fp, "%lf\n", samples[iter].score);
 	}
 
 	fclose(fp);
@@ -205,90 +461,62 @@ void Zoning::testRandomGeneration(int num) {
  * 道路データが変更された時のみ、この関数を呼び出してアクセシビリティを更新すれば良い。
  */
 void Zoning::computeAccessibility() {
-	// 各セルにおける道路長を計算する
-	Mat_<float> road_length[3];
-	for (int i = 0; i < 3; ++i) {
-		road_length[i] = Mat_<float>::zeros(grid_size, grid_size);
-	}
-	RoadEdgeIter ei, eend;
-	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ++ei) {
-		Polyline2D polyline = GraphUtil::finerEdge(roads, *ei, 10.0f);
-		float oneWay = roads.graph[*ei]->oneWay ? 0.5f : 1.0f;
-		for (int i = 0; i < polyline.size() - 1; ++i) {
-			QVector2D pt = cityToGrid(polyline[i]);
-			if (pt.x() < 0 || pt.x() >= grid_size) continue;
-			if (pt.y() < 0 || pt.y() >= grid_size) continue;
-
-			// 道路セグメントの長さ（一方通行の場合は、半分にする）
-			float len = (polyline[i + 1] - polyline[i]).length() * oneWay;
-
-			// このセルを中心に、3x3セルの範囲で、道路長を追加していく
-			for (int dx = -2; dx <= 2; ++dx) {
-				if (pt.x() + dx < 0 || pt.x() + dx >= grid_size) continue;
-				for (int dy = -2; dy <= 2; ++dy) {
-					if (pt.y() + dy < 0 || pt.y() + dy >= grid_size) continue;
-
-					float w = 1.0f / (1.0f + sqrtf(SQR(dx) + SQR(dy)));
-
-					if (roads.graph[*ei]->type == RoadEdge::TYPE_HIGHWAY) {
-						road_length[0](pt.y() + dy, pt.x() + dx) += len * w;
-					} else if (roads.graph[*ei]->type == RoadEdge::TYPE_AVENUE) {
-						road_length[1](pt.y() + dy, pt.x() + dx) += len * w;
-					} else if (roads.graph[*ei]->type == RoadEdge::TYPE_STREET) {
-						road_length[2](pt.y() + dy, pt.x() + dx) += len * w;
-					}
-				}
-			}
-		}
+	ZONING_TRACE_SCOPE("computeAccessibility");
+
+	roadsCSR.sync(roads);
+
+	if (accessibilityMode == ACCESSIBILITY_NETWORK) {
+		networkAccessibility.build(roadsCSR);
+		networkAccessibility.computeTravelTimes();
+		networkAccessibility.apply(city_length, grid_size, accessibility);
+		tracker.touch(StepScheduler::FIELD_ACCESSIBILITY);
+	} else {
+		rasterizeRoads();
+		combineAccessibility();
 	}
+}
+
+/**
+ * 道路の種類ごとに、各セルにおける道路長を計算し、roadLengthにキャッシュする。
+ */
+void Zoning::rasterizeRoads() {
+	ZONING_TRACE_SCOPE("rasterizeRoads");
+
+	RoadRasterizer::rasterize(roadsCSR, city_length, grid_size, roadLength);
+}
 
+/**
+ * キャッシュした道路長と、アクセシビリティの重みから、アクセシビリティを計算する。
+ * 重みだけが変わった場合は、道路をラスタライズし直さずに、この関数だけを呼べば良い。
+ */
+void Zoning::combineAccessibility() {
+	if (roadLength[0].rows != grid_size) return;
+
+	const Mat_<float>* road_length = roadLength;
 	float cell_length2 = cell_length * cell_length;
-	for (int r = 0; r < grid_size; ++r) {
-		for (int c = 0; c < grid_size; ++c) {
-			accessibility(r, c) = std::max(weights["highway_accessibility"] * road_length[0](r, c) / cell_length2, std::max(weights["avenue_accessibility"] * road_length[1](r, c) / cell_length2, weights["street_accessibility"] * road_length[2](r, c) / cell_length2));
-			accessibility(r, c) = min(accessibility(r, c), 1.0f);
-			//accessibility(r, c) = min(weights["highway_accessibility"] * road_length[0](r, c) / cell_length2  + weights["avenue_accessibility"] * road_length[1](r, c) / cell_length2 + weights["streeet_accessibility"] * road_length[2](r, c) / cell_length2, 1.0f);
+	ThreadPool::forEachTile(grid_size, grid_size, [&](int tile, int r0, int r1) {
+		for (int r = r0; r < r1; ++r) {
+			for (int c = 0; c < grid_size; ++c) {
+				accessibility(r, c) = std::max(params.highway_accessibility * road_length[0](r, c) / cell_length2, std::max(params.avenue_accessibility * road_length[1](r, c) / cell_length2, params.street_accessibility * road_length[2](r, c) / cell_length2));
+				accessibility(r, c) = min(accessibility(r, c), 1.0f);
+				//accessibility(r, c) = min(weights["highway_accessibility"] * road_length[0](r, c) / cell_length2  + weights["avenue_accessibility"] * road_length[1](r, c) / cell_length2 + weights["streeet_accessibility"] * road_length[2](r, c) / cell_length2, 1.0f);
+			}
 		}
-	}
+	});
+	tracker.touch(StepScheduler::FIELD_ACCESSIBILITY);
 }
 
 /**
  * 周辺の人口を計算する。
  */
 void Zoning::computeNeighborPopulation() {
-	QElapsedTimer timer;
-	timer.start();
-
-	neighborPopulation = Mat_<float>::zeros(grid_size, grid_size);
+	ZONING_TRACE_SCOPE("computeNeighborPopulation");
 
 	// アクティビティが広がる最大距離
 	const float dist_max = 1000.0f;
 
-	int window_size = dist_max / cell_length + 0.5f;
-
-	for (int r = 0; r < grid_size; ++r) {
-		for (int c = 0; c < grid_size; ++c) {
-			// 当該セルの周辺セルに、人口を追加する
-			for (int dr = -window_size; dr <= window_size; ++dr) {
-				if (r + dr < 0 || r + dr >= grid_size) continue;
-				for (int dc = -window_size; dc <= window_size; ++dc) {
-					if (c + dc < 0 || c + dc >= grid_size) continue;
-
-					float dist = sqrt(SQR(dc * cell_length) + SQR(dr * cell_length));
-					neighborPopulation(r + dr, c + dc) += weights["population_neighbor"] * population(r, c) / MAX_JOBS / expf(weights["distance_neighbor_population"] * dist);
-				}
-			}
-		}
-	}
-
-	// 最大値を1にする
-	for (int r = 0; r < grid_size; ++r) {
-		for (int c = 0; c < grid_size; ++c) {
-			neighborPopulation(r, c) = min(neighborPopulation(r, c), 1.0f);
-		}
-	}
-
-	elapsedTimes["computeNeighborPopulation"] += timer.elapsed() * 0.001;
+	bool kernelChanged = neighborPopulationConv.setKernel(grid_size, cell_length, dist_max, params.distance_neighbor_population, params.population_neighbor / MAX_JOBS);
+	updateNeighborField(neighborPopulationConv, kernelChanged, population, populationDelta, neighborPopulationRaw, neighborPopulation);
 
 #ifdef DEBUG
 	cout << "Neighbor population: " << endl;
@@ -300,39 +528,13 @@ void Zoning::computeNeighborPopulation() {
  * 周辺の商業を計算する。
  */
 void Zoning::computeNeighborCommercial() {
-	QElapsedTimer timer;
-	timer.start();
-
-	neighborCommercial = Mat_<float>::zeros(grid_size, grid_size);
+	ZONING_TRACE_SCOPE("computeNeighborCommercial");
 
 	// アクティビティが広がる最大距離
 	const float dist_max = 1000.0f;
 
-	int window_size = dist_max / cell_length + 0.5f;
-
-	for (int r = 0; r < grid_size; ++r) {
-		for (int c = 0; c < grid_size; ++c) {
-			// 当該セルの周辺セルに、商業を追加する
-			for (int dr = -window_size; dr <= window_size; ++dr) {
-				if (r + dr < 0 || r + dr >= grid_size) continue;
-				for (int dc = -window_size; dc <= window_size; ++dc) {
-					if (c + dc < 0 || c + dc >= grid_size) continue;
-
-					float dist = sqrt(SQR(dc * cell_length) + SQR(dr * cell_length));
-					neighborCommercial(r + dr, c + dc) += weights["commercial_neighbor"] * commercialJobs(r, c) / MAX_JOBS / expf(weights["distance_neighbor_commercial"] * dist);
-				}
-			}
-		}
-	}
-
-	// 最大値を1にする
-	for (int r = 0; r < grid_size; ++r) {
-		for (int c = 0; c < grid_size; ++c) {
-			neighborCommercial(r, c) = min(neighborCommercial(r, c), 1.0f);
-		}
-	}
-
-	elapsedTimes["computeNeighborComercial"] += timer.elapsed() * 0.001;
+	bool kernelChanged = neighborCommercialConv.setKernel(grid_size, cell_length, dist_max, params.distance_neighbor_commercial, params.commercial_neighbor / MAX_JOBS);
+	updateNeighborField(neighborCommercialConv, kernelChanged, commercialJobs, commercialJobsDelta, neighborCommercialRaw, neighborCommercial);
 
 #ifdef DEBUG
 	cout << "Neighbor population: " << endl;
@@ -344,39 +546,13 @@ void Zoning::computeNeighborCommercial() {
  * 汚染度を計算する
  */
 void Zoning::computePollution() {
-	QElapsedTimer timer;
-	timer.start();
-
-	pollution = Mat_<float>::zeros(grid_size, grid_size);
+	ZONING_TRACE_SCOPE("computePollution");
 
 	// 汚染が広がる最大距離
 	const float dist_max = 1000.0f;
 
-	int window_size = dist_max / cell_length + 0.5f;
-
-	for (int r = 0; r < grid_size; ++r) {
-		for (int c = 0; c < grid_size; ++c) {
-			// 当該工業ゾーンの周辺セルに、汚染度を追加する
-			for (int dr = -window_size; dr <= window_size; ++dr) {
-				if (r + dr < 0 || r + dr >= grid_size) continue;
-				for (int dc = -window_size; dc <= window_size; ++dc) {
-					if (c + dc < 0 || c + dc >= grid_size) continue;
-
-					float dist = sqrt(SQR(dc * cell_length) + SQR(dr * cell_length));
-					pollution(r + dr, c + dc) += weights["industrial_pollution"] * industrialJobs(r, c) / MAX_JOBS / exp(weights["distance_pollution"] * dist);
-				}
-			}
-		}
-	}
-
-	// 最大値を1にする
-	for (int r = 0; r < grid_size; ++r) {
-		for (int c = 0; c < grid_size; ++c) {
-			pollution(r, c) = min(pollution(r, c), 1.0f);
-		}
-	}
-
-	elapsedTimes["computePollution"] += timer.elapsed() * 0.001;
+	bool kernelChanged = pollutionConv.setKernel(grid_size, cell_length, dist_max, params.distance_pollution, params.industrial_pollution / MAX_JOBS);
+	updateNeighborField(pollutionConv, kernelChanged, industrialJobs, industrialJobsDelta, pollutionRaw, pollution);
 
 #ifdef DEBUG
 	cout << "Pollution: " << endl;
@@ -384,33 +560,76 @@ void Zoning::computePollution() {
 #endif
 }
 
+/**
+ * 周辺の人口・商業、汚染度のフィールドを更新する。
+ * インクリメンタルモードでは、前回の更新以降に変化したセル（delta）だけを
+ * クリップ前の累積値（raw）に足し込む。カーネルが変わった場合や、rawが無効化されている場合は、
+ * ソース全体から作り直す。最後に、rawの上限を1にクリップした値をfieldに格納する。
+ *
+ * @param conv				畳み込みエンジン
+ * @param kernelChanged		カーネルが変更されたか
+ * @param source			ソース（人口、商業の仕事量、工業の仕事量）
+ * @param delta				前回の更新以降のソースの変化量（この関数で0にリセットされる）
+ * @param raw				クリップ前の累積値
+ * @param field				クリップ後の値
+ */
+void Zoning::updateNeighborField(ConvolutionEngine& conv, bool kernelChanged, const Mat_<float>& source, Mat_<float>& delta, Mat_<float>& raw, Mat_<float>& field) {
+	if (!incrementalFields || kernelChanged || raw.rows != grid_size || raw.cols != grid_size) {
+		conv.apply(source, raw);
+	} else {
+		conv.accumulate(delta, raw);
+	}
+	delta.setTo(0.0f);
+
+	// 1を超えないようにクリップする
+	field.create(grid_size, grid_size);
+	ThreadPool::forEachTile(grid_size, grid_size, [&](int tile, int r0, int r1) {
+		for (int r = r0; r < r1; ++r) {
+			for (int c = 0; c < grid_size; ++c) {
+				field(r, c) = std::min(raw(r, c), 1.0f);
+			}
+		}
+	});
+}
+
+/**
+ * クリップ前の累積値を無効化し、次回の更新でソース全体から作り直すようにする。
+ * インクリメンタル更新による浮動小数点誤差の蓄積を防ぐため、定期的に呼び出す。
+ */
+void Zoning::resetNeighborFields() {
+	neighborPopulationRaw.release();
+	neighborCommercialRaw.release();
+	pollutionRaw.release();
+}
+
 /**
  * 地価を更新する。
  * 地価は、0からMAX_LANDVALUEの範囲の値をとる。
  */
 void Zoning::updateLandValue() {
-	QElapsedTimer timer;
-	timer.start();
-
-	for (int r = 0; r < grid_size; ++r) {
-		for (int c = 0; c < grid_size; ++c) {
-			float expected_landValue = weights["accessibility_landvalue"] * accessibility(r, c)
-				+ weights["neighbor_population_landvalue"] * neighborPopulation(r, c)
-				+ weights["neighbor_commercial_landvalue"] * neighborCommercial(r, c)
-				+ weights["pollution_landvalue"] * pollution(r, c)
-				+ weights["slope_landvalue"] * slope(r, c)
-				+ weights["population_landvalue"] * population(r, c) / MAX_POPULATION
-				+ weights["commercialjobs_landvalue"] * commercialJobs(r, c) / MAX_JOBS
-				+ weights["industrialjobs_landvalue"] * industrialJobs(r, c) / MAX_JOBS;
-			if (expected_landValue < 0) expected_landValue = 0.0f;
-			if (expected_landValue > MAX_LANDVALUE) expected_landValue = MAX_LANDVALUE;
-
-			//landValue(r, c) += (expected_landValue - landValue(r, c)) * 0.1f;
-			landValue(r, c) = expected_landValue;
+	ZONING_TRACE_SCOPE("updateLandValue");
+
+	const float* lv = params.landvalue;
+
+	ThreadPool::forEachTile(grid_size, grid_size, [&](int tile, int r0, int r1) {
+		for (int r = r0; r < r1; ++r) {
+			for (int c = 0; c < grid_size; ++c) {
+				float expected_landValue = lv[ZoningParams::INPUT_ACCESSIBILITY] * accessibility(r, c)
+					+ lv[ZoningParams::INPUT_NEIGHBOR_POPULATION] * neighborPopulation(r, c)
+					+ lv[ZoningParams::INPUT_NEIGHBOR_COMMERCIAL] * neighborCommercial(r, c)
+					+ lv[ZoningParams::INPUT_POLLUTION] * pollution(r, c)
+					+ lv[ZoningParams::INPUT_SLOPE] * slope(r, c)
+					+ lv[ZoningParams::INPUT_POPULATION] * population(r, c)
+					+ lv[ZoningParams::INPUT_COMMERCIALJOBS] * commercialJobs(r, c)
+					+ lv[ZoningParams::INPUT_INDUSTRIALJOBS] * industrialJobs(r, c);
+				if (expected_landValue < 0) expected_landValue = 0.0f;
+				if (expected_landValue > MAX_LANDVALUE) expected_landValue = MAX_LANDVALUE;
+
+				//landValue(r, c) += (expected_landValue - landValue(r, c)) * 0.1f;
+				landValue(r, c) = expected_landValue;
+			}
 		}
-	}
-
-	elapsedTimes["updateLandValue"] += timer.elapsed() * 0.001;
+	});
 
 #ifdef DEBUG
 	cout << "Land value:" << endl;
@@ -424,8 +643,7 @@ void Zoning::updateLandValue() {
  * @param ratio		移動する比率
  */
 void Zoning::updatePeopleAndJobs(float ratio) {
-	QElapsedTimer timer;
-	timer.start();
+	ZONING_TRACE_SCOPE("updatePeopleAndJobs");
 
 	// 全人口を計算する
 	float total_population = matsum(population);
@@ -434,19 +652,36 @@ void Zoning::updatePeopleAndJobs(float ratio) {
 	float total_commercialJobs = matsum(commercialJobs);
 	float total_industrialJobs = matsum(industrialJobs);
 
-	// 人口を移動する
-	removePeople(total_population * ratio);
-	addPeople(total_population * ratio);
-
-	// 仕事を移動する
-	removeCommercialJobs(total_commercialJobs * ratio);
-	addCommercialJobs(total_commercialJobs * ratio);
-
-	// 仕事を移動する
-	removeIndustrialJobs(total_industrialJobs * ratio);
-	addIndustrialJobs(total_industrialJobs * ratio);
-
-	elapsedTimes["updatePeopleAndJobs"] += timer.elapsed() * 0.001;
+	// 移動した人・仕事があれば、依存する派生フィールドを計算し直すよう記録する
+	if ((int)(total_population * ratio) > 0) tracker.touch(StepScheduler::FIELD_POPULATION);
+	if ((int)(total_commercialJobs * ratio) > 0) tracker.touch(StepScheduler::FIELD_COMMERCIALJOBS);
+	if ((int)(total_industrialJobs * ratio) > 0) tracker.touch(StepScheduler::FIELD_INDUSTRIALJOBS);
+
+	if (batchMoves) {
+		// 人口を移動する
+		removeUnitsBatch(population, populationDelta, total_population * ratio);
+		addUnitsBatch(population, populationDelta, life, MAX_POPULATION, total_population * ratio);
+
+		// 仕事を移動する
+		removeUnitsBatch(commercialJobs, commercialJobsDelta, total_commercialJobs * ratio);
+		addUnitsBatch(commercialJobs, commercialJobsDelta, shop, MAX_JOBS, total_commercialJobs * ratio);
+
+		// 仕事を移動する
+		removeUnitsBatch(industrialJobs, industrialJobsDelta, total_industrialJobs * ratio);
+		addUnitsBatch(industrialJobs, industrialJobsDelta, factory, MAX_JOBS, total_industrialJobs * ratio);
+	} else {
+		// 人口を移動する
+		removePeople(total_population * ratio);
+		addPeople(total_population * ratio);
+
+		// 仕事を移動する
+		removeCommercialJobs(total_commercialJobs * ratio);
+		addCommercialJobs(total_commercialJobs * ratio);
+
+		// 仕事を移動する
+		removeIndustrialJobs(total_industrialJobs * ratio);
+		addIndustrialJobs(total_industrialJobs * ratio);
+	}
 
 #ifdef DEBUG
 	cout << "People: " << matsum(population) << endl;
@@ -459,42 +694,14 @@ void Zoning::updatePeopleAndJobs(float ratio) {
  * 指定された人数を減らす。ランダムにセルを選択し、一人減らす。これを人数分繰り返す。
  */
 void Zoning::removePeople(int num) {
-	while (num > 0) {
-		int r = Util::genRand(0, grid_size);
-		int c = Util::genRand(0, grid_size);
-
-		if (population(r, c) > 0) {
-			population(r, c)--;
-			num--;
-		}
-	}
+	removeUnits(population, populationDelta, num);
 }
 
 /** 
  * 指定された人数を増やす。ランダムにセルを選択し、一人増やす。これを人数分繰り返す。
  */
 void Zoning::addPeople(int num) {
-	const int T = 10;
-
-	while (num > 0) {
-		vector<QVector2D> cells(T);
-		vector<float> pdf(T);
-
-		for (int i = 0; i < T; ++i) {
-			int r, c;
-			while (true) {
-				r = Util::genRand(0, grid_size);
-				c = Util::genRand(0, grid_size);
-				if (population(r, c) / MAX_POPULATION + commercialJobs(r, c) / MAX_JOBS + industrialJobs(r, c) / MAX_JOBS < 1.0f) break;
-			}
-			cells[i] = QVector2D(c, r);
-			pdf[i] = life(c, r);
-		}
-
-		int id = Util::sampleFromPdf(pdf);
-		population(cells[id].y(), cells[id].x())++;
-		num--;
-	}
+	addUnits(population, populationDelta, life, num);
 }
 
 /** 
@@ -505,102 +712,355 @@ void Zoning::removeCommercialJobs(int num) {
 	cout << commercialJobs << endl;
 #endif
 
-	while (num > 0) {
-		int r = Util::genRand(0, grid_size);
-		int c = Util::genRand(0, grid_size);
-
-		if (commercialJobs(r, c) > 0) {
-			commercialJobs(r, c)--;
-			num--;
-		}
-	}
+	removeUnits(commercialJobs, commercialJobsDelta, num);
 }
 
 /** 
  * 指定された商業仕事を増やす。ランダムにセルを選択し、一人増やす。これを指定された数だけ繰り返す。
  */
 void Zoning::addCommercialJobs(int num) {
-	const int T = 10;
+	addUnits(commercialJobs, commercialJobsDelta, shop, num);
+}
 
+/** 
+ * 指定された工業仕事を減らす。ランダムにセルを選択し、一人減らす。これを指定された数だけ繰り返す。
+ */
+void Zoning::removeIndustrialJobs(int num) {
+	removeUnits(industrialJobs, industrialJobsDelta, num);
+}
+
+/** 
+ * 指定された工業仕事を増やす。ランダムにセルを選択し、一人増やす。これを指定された数だけ繰り返す。
+ */
+void Zoning::addIndustrialJobs(int num) {
+	addUnits(industrialJobs, industrialJobsDelta, factory, num);
+}
+
+/**
+ * 指定された数の人・仕事を減らす。空でないセルを一様に選び、1つ減らす。これを指定された数だけ繰り返す。
+ * 空でないセルをFenwick木で管理するので、空のセルを引き直す必要はなく、1つあたりO(log n)で済む。
+ *
+ * @param units		人口、または仕事量
+ * @param delta		変化量を記録するバッファ
+ * @param num		減らす数
+ * @return			実際に減らした数
+ */
+int Zoning::removeUnits(Mat_<float>& units, Mat_<float>& delta, int num) {
+	vector<double> weights(grid_size * grid_size);
+	for (int r = 0; r < grid_size; ++r) {
+		for (int c = 0; c < grid_size; ++c) {
+			weights[r * grid_size + c] = units(r, c) > 0 ? 1.0 : 0.0;
+		}
+	}
+	FenwickTree index;
+	index.build(weights);
+
+	int removed = 0;
+	while (num > 0) {
+		int id = index.sample(rng.uniformDouble() * index.total());
+		if (id < 0) break;
+
+		int r = id / grid_size;
+		int c = id % grid_size;
+		units(r, c)--;
+		delta(r, c)--;
+		num--;
+		removed++;
+
+		if (units(r, c) <= 0) index.set(id, 0.0);
+	}
+
+	return removed;
+}
+
+/**
+ * 指定された数の人・仕事を増やす。空きのあるセルからT個の候補を一様に選び、
+ * 魅力度に比例した確率でその中の1つを選んで、1つ増やす。これを指定された数だけ繰り返す。
+ * 空きのあるセルをFenwick木で管理するので、満杯のセルを引き直す必要はなく、1つあたりO(T log n)で済む。
+ * 全てのセルが満杯になった場合は、警告を出して終了する。
+ * 魅力度は、元の実装と同じく、候補のセル(r, c)について(c, r)の値を読む。
+ *
+ * @param units				人口、または仕事量
+ * @param delta				変化量を記録するバッファ
+ * @param attractiveness	各セルの魅力度（life / shop / factory）
+ * @param num				増やす数
+ * @return					実際に増やした数
+ */
+int Zoning::addUnits(Mat_<float>& units, Mat_<float>& delta, const Mat_<float>& attractiveness, int num) {
+	const int T = TOURNAMENT_SIZE;
+
+	vector<double> weights(grid_size * grid_size);
+	for (int r = 0; r < grid_size; ++r) {
+		for (int c = 0; c < grid_size; ++c) {
+			weights[r * grid_size + c] = occupancy(r, c) < 1.0f ? 1.0 : 0.0;
+		}
+	}
+	FenwickTree index;
+	index.build(weights);
+
+	vector<int> cells(T);
+	vector<float> pdf(T);
+
+	int added = 0;
 	while (num > 0) {
-		vector<QVector2D> cells(T);
-		vector<float> pdf(T);
+		if (index.total() <= 0.0) {
+			cerr << "Warning: the grid is full. " << num << " units could not be placed." << endl;
+			break;
+		}
 
 		for (int i = 0; i < T; ++i) {
-			int r, c;
-			while (true) {
-				r = Util::genRand(0, grid_size);
-				c = Util::genRand(0, grid_size);
-				if (population(r, c) / MAX_POPULATION + commercialJobs(r, c) / MAX_JOBS + industrialJobs(r, c) / MAX_JOBS < 1.0f) break;
-			}
-			cells[i] = QVector2D(c, r);
-			pdf[i] = shop(c, r);
+			cells[i] = index.sample(rng.uniformDouble() * index.total());
+			pdf[i] = attractiveness(cells[i] % grid_size, cells[i] / grid_size);
 		}
 
-		int id = Util::sampleFromPdf(pdf);
-		commercialJobs(cells[id].y(), cells[id].x())++;
+		int id = cells[rng.sampleFromPdf(pdf)];
+		int r = id / grid_size;
+		int c = id % grid_size;
+		units(r, c)++;
+		delta(r, c)++;
 		num--;
+		added++;
+
+		if (occupancy(r, c) >= 1.0f) index.set(id, 0.0);
 	}
+
+	return added;
 }
 
-/** 
- * 指定された工業仕事を減らす。ランダムにセルを選択し、一人減らす。これを指定された数だけ繰り返す。
+/**
+ * 指定されたセルの占有率（人口と仕事量の、最大値に対する比率の和）を返却する。
+ * 1以上なら、そのセルは満杯である。
  */
-void Zoning::removeIndustrialJobs(int num) {
+float Zoning::occupancy(int r, int c) {
+	return population(r, c) / MAX_POPULATION + commercialJobs(r, c) / MAX_JOBS + industrialJobs(r, c) / MAX_JOBS;
+}
+
+/**
+ * 指定された数の人・仕事を、一括で減らす。
+ * 空でないセルを一様に選んで1つ減らす処理を繰り返すのと同じ分布になるよう、
+ * 空でないセルに等確率の多項分布で割り当てる。セルに残っている数を超えた分は、次のラウンドで再配分する。
+ * 計算量は、人数ではなくセルの数に比例する。
+ *
+ * @param units		人口、または仕事量
+ * @param delta		変化量を記録するバッファ
+ * @param num		減らす数
+ * @return			実際に減らした数
+ */
+int Zoning::removeUnitsBatch(Mat_<float>& units, Mat_<float>& delta, int num) {
+	vector<int> cells;
+	vector<float> pdf;
+	vector<int> counts;
+	int removed = 0;
+
 	while (num > 0) {
-		int r = Util::genRand(0, grid_size);
-		int c = Util::genRand(0, grid_size);
+		cells.clear();
+		for (int r = 0; r < grid_size; ++r) {
+			for (int c = 0; c < grid_size; ++c) {
+				if (units(r, c) >= 1.0f) cells.push_back(r * grid_size + c);
+			}
+		}
+		if (cells.size() == 0) break;
 
-		if (industrialJobs(r, c) > 0) {
-			industrialJobs(r, c)--;
-			num--;
+		pdf.assign(cells.size(), 1.0f);
+		rng.sampleMultinomial(num, pdf, counts);
+
+		for (int i = 0; i < cells.size(); ++i) {
+			if (counts[i] == 0) continue;
+
+			int r = cells[i] / grid_size;
+			int c = cells[i] % grid_size;
+			int n = std::min(counts[i], (int)units(r, c));
+			units(r, c) -= n;
+			delta(r, c) -= n;
+			num -= n;
+			removed += n;
 		}
 	}
+
+	return removed;
 }
 
-/** 
- * 指定された工業仕事を増やす。ランダムにセルを選択し、一人増やす。これを指定された数だけ繰り返す。
+/**
+ * 指定された数の人・仕事を、一括で増やす。
+ * 空きのあるセルからT個の候補を一様に選び、魅力度に比例した確率で1つを選ぶトーナメント方式と、
+ * ほぼ同じ分布になるよう、各セルが選ばれる確率を解析的に近似して、多項分布で割り当てる。
+ * セルの空き容量を超えた分は、次のラウンドで再配分する。
+ *
+ * トーナメントでセルiが選ばれる確率は、a_iを魅力度、Sを他のT-1個の候補の魅力度の和とすると、
+ * T / n * a_i * E[1 / (a_i + S)] であり、E[1 / (a_i + S)]を2次のテイラー展開で近似する。
+ * 魅力度は、addUnits()と同じく、セル(r, c)について(c, r)の値を読む。
+ *
+ * @param units				人口、または仕事量
+ * @param delta				変化量を記録するバッファ
+ * @param attractiveness	各セルの魅力度（life / shop / factory）
+ * @param max_units			1セルあたりの最大数（MAX_POPULATION / MAX_JOBS）
+ * @param num				増やす数
+ * @return					実際に増やした数
  */
-void Zoning::addIndustrialJobs(int num) {
-	const int T = 10;
+int Zoning::addUnitsBatch(Mat_<float>& units, Mat_<float>& delta, const Mat_<float>& attractiveness, int max_units, int num) {
+	const int T = TOURNAMENT_SIZE;
+
+	vector<int> cells;
+	vector<int> capacity;
+	vector<float> pdf;
+	vector<int> counts;
+	int added = 0;
 
 	while (num > 0) {
-		vector<QVector2D> cells(T);
-		vector<float> pdf(T);
+		// 空きのあるセルと、その空き容量を求める
+		cells.clear();
+		capacity.clear();
+		pdf.clear();
+		double sum = 0.0;
+		double sum2 = 0.0;
+		for (int r = 0; r < grid_size; ++r) {
+			for (int c = 0; c < grid_size; ++c) {
+				float occ = occupancy(r, c);
+				if (occ >= 1.0f) continue;
+
+				cells.push_back(r * grid_size + c);
+				capacity.push_back(std::max(1, (int)ceil((1.0f - occ) * max_units)));
+				pdf.push_back(attractiveness(c, r));
+				sum += attractiveness(c, r);
+				sum2 += SQR(attractiveness(c, r));
+			}
+		}
+		if (cells.size() == 0) {
+			cerr << "Warning: the grid is full. " << num << " units could not be placed." << endl;
+			break;
+		}
 
-		for (int i = 0; i < T; ++i) {
-			int r, c;
-			while (true) {
-				r = Util::genRand(0, grid_size);
-				c = Util::genRand(0, grid_size);
-				if (population(r, c) / MAX_POPULATION + commercialJobs(r, c) / MAX_JOBS + industrialJobs(r, c) / MAX_JOBS < 1.0f) break;
+		// 他のT-1個の候補の魅力度の和の平均と分散
+		double mean = sum / cells.size();
+		double m = (T - 1) * mean;
+		double v = (T - 1) * std::max(0.0, sum2 / cells.size() - mean * mean);
+		const int num_blocks = (pdf.size() + ThreadPool::TILE_CELLS - 1) / ThreadPool::TILE_CELLS;
+		ThreadPool::parallelFor(num_blocks, [&](int block) {
+			int end = std::min((int)pdf.size(), (block + 1) * ThreadPool::TILE_CELLS);
+			for (int i = block * ThreadPool::TILE_CELLS; i < end; ++i) {
+				double a = pdf[i];
+				if (a + m <= 0.0) {
+					pdf[i] = 0.0f;
+				} else {
+					pdf[i] = (float)(a / (a + m) + a * v / ((a + m) * (a + m) * (a + m)));
+				}
 			}
-			cells[i] = QVector2D(c, r);
-			pdf[i] = factory(c, r);
+		});
+
+		rng.sampleMultinomial(num, pdf, counts);
+
+		for (int i = 0; i < cells.size(); ++i) {
+			if (counts[i] == 0) continue;
+
+			int r = cells[i] / grid_size;
+			int c = cells[i] % grid_size;
+			int n = std::min(counts[i], capacity[i]);
+			units(r, c) += n;
+			delta(r, c) += n;
+			num -= n;
+			added += n;
 		}
+	}
 
-		int id = Util::sampleFromPdf(pdf);
-		industrialJobs(cells[id].y(), cells[id].x())++;
-		num--;
+	return added;
+}
+
+/**
+ * 地価と、生活・店・工場の指標を更新する。
+ * fusedEvaluationがtrueなら、FieldEvaluatorで1回の走査にまとめて計算する。
+ * falseなら、updateLandValue()、computeLife()、computeShop()、computeFactory()を順に呼び出す。
+ */
+void Zoning::evaluateFields() {
+	if (!fusedEvaluation) {
+		refreshField(StepScheduler::FIELD_LANDVALUE, &Zoning::updateLandValue);
+		refreshField(StepScheduler::FIELD_LIFE, &Zoning::computeLife);
+		refreshField(StepScheduler::FIELD_SHOP, &Zoning::computeShop);
+		refreshField(StepScheduler::FIELD_FACTORY, &Zoning::computeFactory);
+		return;
 	}
+
+	// 入力が変わっていない出力は計算しない。地価を計算し直す場合は、地価に依存する効用も計算し直す
+	int outputs = 0;
+	bool landValueDirty = tracker.isDirty(StepScheduler::FIELD_LANDVALUE);
+	if (landValueDirty) outputs |= FieldEvaluator::OUTPUT_LANDVALUE;
+	for (int k = 0; k < ZoningParams::NUM_UTILITIES; ++k) {
+		int field = StepScheduler::FIELD_LIFE + k;
+		bool dependsOnLandValue = (tracker.dependsOn(field) & StepScheduler::field(StepScheduler::FIELD_LANDVALUE)) != 0;
+		if (tracker.isDirty(field) || (landValueDirty && dependsOnLandValue)) outputs |= FieldEvaluator::utilityOutput(k);
+	}
+	if (outputs == 0) return;
+
+	ZONING_TRACE_SCOPE("evaluateFields");
+
+	const Mat_<float>* inputs[ZoningParams::NUM_INPUTS];
+	inputs[ZoningParams::INPUT_ACCESSIBILITY] = &accessibility;
+	inputs[ZoningParams::INPUT_NEIGHBOR_POPULATION] = &neighborPopulation;
+	inputs[ZoningParams::INPUT_NEIGHBOR_COMMERCIAL] = &neighborCommercial;
+	inputs[ZoningParams::INPUT_POLLUTION] = &pollution;
+	inputs[ZoningParams::INPUT_SLOPE] = &slope;
+	inputs[ZoningParams::INPUT_LANDVALUE] = &landValue;
+	inputs[ZoningParams::INPUT_POPULATION] = &population;
+	inputs[ZoningParams::INPUT_COMMERCIALJOBS] = &commercialJobs;
+	inputs[ZoningParams::INPUT_INDUSTRIALJOBS] = &industrialJobs;
+
+	Mat_<float>* utilities[ZoningParams::NUM_UTILITIES];
+	utilities[ZoningParams::UTILITY_LIFE] = &life;
+	utilities[ZoningParams::UTILITY_SHOP] = &shop;
+	utilities[ZoningParams::UTILITY_FACTORY] = &factory;
+
+	FieldEvaluator::evaluate(params, MAX_LANDVALUE, 1.0f, inputs, landValue, utilities, outputs);
+
+	if (landValueDirty) tracker.markComputed(StepScheduler::FIELD_LANDVALUE);
+	for (int k = 0; k < ZoningParams::NUM_UTILITIES; ++k) {
+		if (outputs & FieldEvaluator::utilityOutput(k)) tracker.markComputed(StepScheduler::FIELD_LIFE + k);
+	}
+}
+
+/**
+ * 派生フィールドの入力が、前回の計算から変わっている場合だけ、computeで計算し直す。
+ *
+ * @param field		派生フィールド（StepScheduler::FIELD_xxx）
+ * @param compute	計算する関数
+ */
+void Zoning::refreshField(int field, void (Zoning::*compute)()) {
+	if (!tracker.isDirty(field)) return;
+
+	(this->*compute)();
+	tracker.markComputed(field);
+}
+
+/**
+ * 係数が0でない入力だけを、各派生フィールドの依存先としてセットする。
+ * 地価・効用の入力の番号（ZoningParams::INPUT_xxx）は、StepScheduler::FIELD_xxxと同じ並び。
+ */
+void Zoning::updateDependencies() {
+	typedef StepScheduler S;
+
+	tracker.setDependencies(S::FIELD_LANDVALUE, params.landValueInputs());
+	for (int k = 0; k < ZoningParams::NUM_UTILITIES; ++k) {
+		tracker.setDependencies(S::FIELD_LIFE + k, params.utilityInputs(k));
+	}
+	tracker.setDependencies(S::FIELD_NEIGHBOR_POPULATION, params.population_neighbor != 0.0f ? S::field(S::FIELD_POPULATION) : 0);
+	tracker.setDependencies(S::FIELD_NEIGHBOR_COMMERCIAL, params.commercial_neighbor != 0.0f ? S::field(S::FIELD_COMMERCIALJOBS) : 0);
+	tracker.setDependencies(S::FIELD_POLLUTION, params.industrial_pollution != 0.0f ? S::field(S::FIELD_INDUSTRIALJOBS) : 0);
+	tracker.setDependencies(S::FIELD_ZONES, S::field(S::FIELD_POPULATION) | S::field(S::FIELD_COMMERCIALJOBS) | S::field(S::FIELD_INDUSTRIALJOBS));
 }
 
 /**
  * 生活の快適さの指標を計算する。
  */
 void Zoning::computeLife() {
-	QElapsedTimer timer;
-	timer.start();
+	ZONING_TRACE_SCOPE("computeLife");
 
-	life = Mat_<float>(grid_size, grid_size);
+	life.create(grid_size, grid_size);
 
-	for (int r = 0; r < grid_size; ++r) {
-		for (int c = 0; c < grid_size; ++c) {
-			life(r, c) = lifeValue(c, r);
+	ThreadPool::forEachTile(grid_size, grid_size, [&](int tile, int r0, int r1) {
+		for (int r = r0; r < r1; ++r) {
+			for (int c = 0; c < grid_size; ++c) {
+				life(r, c) = lifeValue(c, r);
+			}
 		}
-	}
-
-	elapsedTimes["computeLife"] += timer.elapsed() * 0.001;
+	});
 
 #ifdef DEBUG
 	cout << "Life:" << endl;
@@ -612,18 +1072,17 @@ void Zoning::computeLife() {
  * 店をオープンする指標を計算する。
  */
 void Zoning::computeShop() {
-	QElapsedTimer timer;
-	timer.start();
+	ZONING_TRACE_SCOPE("computeShop");
 
-	shop = Mat_<float>(grid_size, grid_size);
+	shop.create(grid_size, grid_size);
 
-	for (int r = 0; r < grid_size; ++r) {
-		for (int c = 0; c < grid_size; ++c) {
-			shop(r, c) = shopValue(c, r);
+	ThreadPool::forEachTile(grid_size, grid_size, [&](int tile, int r0, int r1) {
+		for (int r = r0; r < r1; ++r) {
+			for (int c = 0; c < grid_size; ++c) {
+				shop(r, c) = shopValue(c, r);
+			}
 		}
-	}
-
-	elapsedTimes["computeShop"] += timer.elapsed() * 0.001;
+	});
 
 #ifdef DEBUG
 	cout << endl << "Shop:" << endl;
@@ -635,18 +1094,17 @@ void Zoning::computeShop() {
  * 工場をオープンする指標を計算する。
  */
 void Zoning::computeFactory() {
-	QElapsedTimer timer;
-	timer.start();
+	ZONING_TRACE_SCOPE("computeFactory");
 
-	factory = Mat_<float>(grid_size, grid_size);
+	factory.create(grid_size, grid_size);
 
-	for (int r = 0; r < grid_size; ++r) {
-		for (int c = 0; c < grid_size; ++c) {
-			factory(r, c) = factoryValue(c, r);
+	ThreadPool::forEachTile(grid_size, grid_size, [&](int tile, int r0, int r1) {
+		for (int r = r0; r < r1; ++r) {
+			for (int c = 0; c < grid_size; ++c) {
+				factory(r, c) = factoryValue(c, r);
+			}
 		}
-	}
-
-	elapsedTimes["computeFactory"] += timer.elapsed() * 0.001;
+	});
 
 #ifdef DEBUG
 	cout << endl << "Factory:" << endl;
@@ -658,45 +1116,34 @@ void Zoning::computeFactory() {
  * 指定されたセルの生活価値を返却する。
  */
 float Zoning::lifeValue(int x, int y, float max_value) {
-	float v = weights["accessibility_life"] * accessibility(y, x)
-		+ weights["neighbor_population_life"] * neighborPopulation(y, x)
-		+ weights["neighbor_commercial_life"] * neighborCommercial(y, x)
-		+ weights["pollution_life"] * pollution(y, x)
-		+ weights["slope_life"] * slope(y, x)
-		+ weights["landvalue_life"] * landValue(y, x) / MAX_LANDVALUE
-		+ weights["population_life"] * population(y, x) / MAX_POPULATION
-		+ weights["commercialjobs_life"] * commercialJobs(y, x) / MAX_JOBS
-		+ weights["industrialjobs_life"] * industrialJobs(y, x) / MAX_JOBS;
-
-	// 桁あふれを防ぐため
-	return expf(v - max_value);
+	return utilityValue(ZoningParams::UTILITY_LIFE, y, x, max_value);
 }
 
 float Zoning::shopValue(int c, int r, float max_value) {
-	float v = weights["accessibility_shop"] * accessibility(r, c)
-		+ weights["neighbor_population_shop"] * neighborPopulation(r, c)
-		+ weights["neighbor_commercial_shop"] * neighborCommercial(r, c)
-		+ weights["pollution_shop"] * pollution(r, c)
-		+ weights["slope_shop"] * slope(r, c)
-		+ weights["landvalue_shop"] * landValue(r, c) / MAX_LANDVALUE
-		+ weights["population_shop"] * population(r, c) / MAX_POPULATION
-		+ weights["commercialjobs_shop"] * commercialJobs(r, c) / MAX_JOBS
-		+ weights["industrialjobs_shop"] * industrialJobs(r, c) / MAX_JOBS;
-
-	// 桁あふれを防ぐため
-	return expf(v - max_value);
+	return utilityValue(ZoningParams::UTILITY_SHOP, r, c, max_value);
 }
 
 float Zoning::factoryValue(int c, int r, float max_value) {
-	float v = weights["accessibility_factory"] * accessibility(r, c)
-		+ weights["neighbor_population_factory"] * neighborPopulation(r, c)
-		+ weights["neighbor_commercial_factory"] * neighborCommercial(r, c)
-		+ weights["pollution_factory"] * pollution(r, c)
-		+ weights["slope_factory"] * slope(r, c)
-		+ weights["landvalue_factory"] * landValue(r, c) / MAX_LANDVALUE
-		+ weights["population_factory"] * population(r, c) / MAX_POPULATION
-		+ weights["commercialjobs_factory"] * commercialJobs(r, c) / MAX_JOBS
-		+ weights["industrialjobs_factory"] * industrialJobs(r, c) / MAX_JOBS;
+	return utilityValue(ZoningParams::UTILITY_FACTORY, r, c, max_value);
+}
+
+/**
+ * 指定されたセルの効用を、コンパイル済みの係数行列を使って計算する。
+ *
+ * @param utility		効用の種類 (ZoningParams::UTILITY_LIFE / UTILITY_SHOP / UTILITY_FACTORY)
+ */
+float Zoning::utilityValue(int utility, int r, int c, float max_value) {
+	const float (*w)[ZoningParams::NUM_UTILITIES] = params.utility;
+
+	float v = w[ZoningParams::INPUT_ACCESSIBILITY][utility] * accessibility(r, c)
+		+ w[ZoningParams::INPUT_NEIGHBOR_POPULATION][utility] * neighborPopulation(r, c)
+		+ w[ZoningParams::INPUT_NEIGHBOR_COMMERCIAL][utility] * neighborCommercial(r, c)
+		+ w[ZoningParams::INPUT_POLLUTION][utility] * pollution(r, c)
+		+ w[ZoningParams::INPUT_SLOPE][utility] * slope(r, c)
+		+ w[ZoningParams::INPUT_LANDVALUE][utility] * landValue(r, c)
+		+ w[ZoningParams::INPUT_POPULATION][utility] * population(r, c)
+		+ w[ZoningParams::INPUT_COMMERCIALJOBS][utility] * commercialJobs(r, c)
+		+ w[ZoningParams::INPUT_INDUSTRIALJOBS][utility] * industrialJobs(r, c);
 
 	// 桁あふれを防ぐため
 	return expf(v - max_value);
@@ -706,19 +1153,24 @@ float Zoning::factoryValue(int c, int r, float max_value) {
  * スコアを計算する。
  */
 float Zoning::computeScore() {
-	float score = 0.0f;
-	float total_population = 0.0f;
-
-	for (int r = 0; r < grid_size; ++r) {
-		for (int c = 0; c < grid_size; ++c) {
-			score += life(r, c) * population(r, c);
-			score += shop(r, c) * commercialJobs(r, c);
-			score += factory(r, c) * industrialJobs(r, c);
-			total_population += population(r, c) + commercialJobs(r, c) + industrialJobs(r, c);
-		}
+	ZONING_TRACE_SCOPE("computeScore");
+
+	// タイルごとの部分和を、タイルの順に足し合わせる
+	int num_tiles = ThreadPool::numTiles(grid_size, grid_size);
+	vector<double> scores(num_tiles);
+	vector<double> totals(num_tiles);
+	ThreadPool::forEachTile(grid_size, grid_size, [&](int tile, int r0, int r1) {
+		SimdKernels::scoreTerms(life[r0], shop[r0], factory[r0], population[r0], commercialJobs[r0], industrialJobs[r0], (r1 - r0) * grid_size, scores[tile], totals[tile]);
+	});
+
+	double score = 0.0;
+	double total_population = 0.0;
+	for (int i = 0; i < num_tiles; ++i) {
+		score += scores[i];
+		total_population += totals[i];
 	}
 
-	return score / total_population;
+	return (float)(score / total_population);
 }
 
 /**
@@ -734,29 +1186,58 @@ void Zoning::updateZones() {
 	cout << industrialJobs << endl;
 #endif
 
-	QElapsedTimer timer;
-	timer.start();
+	ZONING_TRACE_SCOPE("updateZones");
 
-	for (int r = 0; r < grid_size; ++r) {
-		for (int c = 0; c < grid_size; ++c) {
-			if (industrialJobs(r, c) / MAX_JOBS > population(r, c) / MAX_POPULATION && industrialJobs(r, c) > commercialJobs(r, c)) {
-				zones(r, c) = TYPE_INDUSTRIAL;
-			} else if (population(r, c) / MAX_POPULATION < 0.1 && commercialJobs(r, c) / MAX_JOBS < 0.1 && industrialJobs(r, c) / MAX_JOBS < 0.1) {
-				zones(r, c) = TYPE_PARK;
-			} else if (population(r, c) / MAX_POPULATION > commercialJobs(r, c) / MAX_JOBS * 2) {
-				zones(r, c) = TYPE_RESIDENTIAL;
-			} else if (commercialJobs(r, c) / MAX_JOBS > population(r, c) / MAX_POPULATION * 2) {
-				zones(r, c) = TYPE_COMMERCIAL;
-			} else {
-				zones(r, c) = TYPE_MIXED;
-			}
+	// 判定の順序は、工業、公園、住宅、商業、混合
+	static const unsigned char codes[5] = { TYPE_RESIDENTIAL, TYPE_COMMERCIAL, TYPE_INDUSTRIAL, TYPE_MIXED, TYPE_PARK };
+	ThreadPool::forEachTile(grid_size, grid_size, [&](int tile, int r0, int r1) {
+		SimdKernels::classifyZones(zones[r0], population[r0], commercialJobs[r0], industrialJobs[r0], (r1 - r0) * grid_size, (float)MAX_POPULATION, (float)MAX_JOBS, codes);
+	});
+}
+
+/**
+ * 現在のゾーンと、各フィールドをファイルに保存する。
+ * ゾーンはzone.pngに、各フィールドは<フィールド名>.txtに、1行1行のテキストで保存する。
+ */
+void Zoning::saveFields() {
+	saveZoneImage(zones, outputPath("zone.png"));
+	saveField(accessibility, outputPath("accessibility.txt"));
+	saveField(neighborPopulation, outputPath("neighbor_population.txt"));
+	saveField(neighborCommercial, outputPath("neighbor_commercial.txt"));
+	saveField(pollution, outputPath("pollution.txt"));
+	saveField(slope, outputPath("slope.txt"));
+	saveField(landValue, outputPath("landvalue.txt"));
+	saveField(population, outputPath("population.txt"));
+	saveField(commercialJobs, outputPath("commercialjobs.txt"));
+	saveField(industrialJobs, outputPath("industrialjobs.txt"));
+	saveField(life, outputPath("life.txt"));
+	saveField(shop, outputPath("shop.txt"));
+	saveField(factory, outputPath("factory.txt"));
+}
+
+void Zoning::saveField(const Mat_<float>& field, const QString& filename) {
+	ZONING_TRACE_SCOPE("saveField");
+
+	FILE* fp = fopen(filename.toUtf8().constData(), "w");
+	if (fp == NULL) {
+		cout << "Warning: " << filename.toUtf8().constData() << " could not be opened." << endl;
+		return;
+	}
+
+	for (int r = 0; r < field.rows; ++r) {
+		for (int c = 0; c < field.cols; ++c) {
+			if (c > 0) fprintf(fp, " ");
+			fprintf(fp, "%g", field(r, c));
 		}
+		fprintf(fp, "\n");
 	}
 
-	elapsedTimes["updateZones"] += timer.elapsed() * 0.001;
+	fclose(fp);
 }
 
-void Zoning::saveZoneImage(const Mat_<uchar>& zones, char* filename) {
+void Zoning::saveZoneImage(const Mat_<uchar>& zones, const QString& filename) {
+	ZONING_TRACE_SCOPE("saveZoneImage");
+
 	Mat tmp(grid_size, grid_size, CV_8UC3);
 	for (int r = 0; r < grid_size; ++r) {
 		for (int c = 0; c < grid_size; ++c) {
@@ -777,7 +1258,15 @@ void Zoning::saveZoneImage(const Mat_<uchar>& zones, char* filename) {
 	}
 
 	flip(tmp, tmp, 0);
-	imwrite(filename, tmp);
+	imwrite(filename.toUtf8().constData(), tmp);
+}
+
+/**
+ * 出力ファイルのパスを返却する。outputDirが空なら、カレントディレクトリに出力する。
+ */
+QString Zoning::outputPath(const QString& filename) {
+	if (outputDir.isEmpty()) return filename;
+	else return outputDir + "/" + filename;
 }
 
 QVector2D Zoning::gridToCity(const QVector2D& pt) {
@@ -791,11 +1280,24 @@ QVector2D Zoning::cityToGrid(const QVector2D& pt) {
 	return QVector2D(floor(x), floor(y));
 }
 
+/**
+ * 全セルの合計を返却する。タイルごとの部分和を、タイルの順に足し合わせるので、スレッド数によらず結果は同じ。
+ */
 float Zoning::matsum(Mat_<float>& mat) {
-	Mat_<float> temp;
-	reduce(mat, temp, 0, CV_REDUCE_SUM);
-	reduce(temp, temp, 1, CV_REDUCE_SUM);
-	return temp(0, 0);
+	vector<double> sums(ThreadPool::numTiles(mat.rows, mat.cols));
+	ThreadPool::forEachTile(mat.rows, mat.cols, [&](int tile, int r0, int r1) {
+		double sum = 0.0;
+		for (int r = r0; r < r1; ++r) {
+			for (int c = 0; c < mat.cols; ++c) {
+				sum += mat(r, c);
+			}
+		}
+		sums[tile] = sum;
+	});
+
+	double total = 0.0;
+	for (int i = 0; i < sums.size(); ++i) total += sums[i];
+	return (float)total;
 }
 
 float Zoning::matmax(Mat_<float>& mat) {
@@ -806,28 +1308,37 @@ float Zoning::matmax(Mat_<float>& mat) {
 }
 
 vector<float> Zoning::computeFeature(const Mat_<uchar>& zones) {
-	Mat_<float> f = Mat_<float>::zeros(5, 5);
-	int count = 0;
-
-	for (int r = 0; r < grid_size; ++r) {
-		for (int c = 0; c < grid_size; ++c) {
-			for (int dr = -1; dr <= 1; ++dr) {
-				if (r + dr < 0 || r + dr >= grid_size) continue;
-				for (int dc = -1; dc <= 1; ++dc) {
-					if (c + dc < 0 || c + dc >= grid_size) continue;
-					if (dr == 0 && dc == 0) continue;
-					if (dr != 0 && dc != 0) continue;
-
-					int t1 = zones(r, c);
-					int t2 = zones(r+dr, c+dc);
-					f(t1, t2)++;
-					count++;
+	ZONING_TRACE_SCOPE("computeFeature");
+
+	// タイルごとに隣接するゾーンの組を数える（整数なので、足し合わせる順序によらない）
+	vector<Mat_<int> > tile_counts(ThreadPool::numTiles(grid_size, grid_size));
+	ThreadPool::forEachTile(grid_size, grid_size, [&](int tile, int r0, int r1) {
+		Mat_<int> counts = Mat_<int>::zeros(5, 5);
+		for (int r = r0; r < r1; ++r) {
+			for (int c = 0; c < grid_size; ++c) {
+				for (int dr = -1; dr <= 1; ++dr) {
+					if (r + dr < 0 || r + dr >= grid_size) continue;
+					for (int dc = -1; dc <= 1; ++dc) {
+						if (c + dc < 0 || c + dc >= grid_size) continue;
+						if (dr == 0 && dc == 0) continue;
+						if (dr != 0 && dc != 0) continue;
+
+						int t1 = zones(r, c);
+						int t2 = zones(r+dr, c+dc);
+						counts(t1, t2)++;
+					}
 				}
 			}
 		}
-	}
+		tile_counts[tile] = counts;
+	});
+
+	Mat_<int> counts = Mat_<int>::zeros(5, 5);
+	for (int i = 0; i < tile_counts.size(); ++i) counts += tile_counts[i];
+	int count = (int)sum(counts)[0];
 
-	f /= (float)count;
+	Mat_<float> f;
+	counts.convertTo(f, CV_32F, 1.0 / count);
 
 	vector<float> ret;
 	for (int r = 0; r < f.rows; ++r) {
@@ -3,29 +3,43 @@
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
 #include "RoadGraph.h"
+#include "ConvolutionEngine.h"
+#include "ZoningParams.h"
+#include "Random.h"
+#include "StepScheduler.h"
+#include "FieldTracker.h"
+#include "NetworkAccessibility.h"
+#include "RoadGraphCSR.h"
 
 using namespace std;
 using namespace cv;
 
 class Zoning {
+	friend class ZoningBench;
+
 public:
 	static enum { TYPE_RESIDENTIAL = 0, TYPE_COMMERCIAL = 1, TYPE_INDUSTRIAL = 2, TYPE_MIXED = 3, TYPE_PARK = 4, TYPE_UNUSED = 9 };
+	static enum { ACCESSIBILITY_DENSITY = 0, ACCESSIBILITY_NETWORK };
 
 	static const float MAX_LANDVALUE;
 	static const int MAX_POPULATION;
 	static const int MAX_JOBS;
+	static const int TOURNAMENT_SIZE;
 
 	float city_length;	// cityの一辺の距離 [m]
 	float cell_length;	// セルの一辺の距離 [m]
 	int grid_size;		// グリッドの一辺のサイズ
 	RoadGraph roads;
+	RoadGraphCSR roadsCSR;	// roadsのスナップショット（アクセシビリティの計算で使う）
 
 	QMap<QString, float> weights;
+	ZoningParams params;	// weightsをコンパイルしたもの
 
 	Mat_<uchar> zones;
 
 
 	Mat_<float> accessibility;
+	Mat_<float> roadLength[3];			// 道路の種類（高速道路、幹線道路、一般道路）ごとの、各セルの道路長
 	Mat_<float> neighborPopulation;		// 周辺の人口
 	Mat_<float> neighborCommercial;		// 周辺の商業の量
 	Mat_<float> pollution;
@@ -39,24 +53,77 @@ public:
 	Mat_<float> shop;		// 店をオープンするための指標
 	Mat_<float> factory;	// 工場をオープンするための指標
 
+	bool batchMoves;	// 人・仕事の移動を、1つずつではなく多項分布で一括して行うか
+	bool fusedEvaluation;	// 地価と生活・店・工場の指標を、1回の走査でまとめて計算するか（結果が従来の計算と一致するか未検証なので、既定ではfalse）
+
+	// アクセシビリティ
+	int accessibilityMode;		// ACCESSIBILITY_DENSITY: 周辺の道路長から、ACCESSIBILITY_NETWORK: 道路ネットワーク上の移動時間から計算する
+	NetworkAccessibility networkAccessibility;
+
+	// インクリメンタル更新
+	bool incrementalFields;		// 周辺人口・周辺商業・汚染度を、変化したセルだけから更新するか
+	int fullRebuildInterval;	// 何ステップごとに、ソース全体から作り直すか（0なら作り直さない）
+	Mat_<float> neighborPopulationRaw;	// クリップ前の周辺人口
+	Mat_<float> neighborCommercialRaw;	// クリップ前の周辺商業
+	Mat_<float> pollutionRaw;			// クリップ前の汚染度
+	Mat_<float> populationDelta;		// 前回の周辺計算以降の人口の変化量
+	Mat_<float> commercialJobsDelta;	// 前回の周辺計算以降の商業の仕事量の変化量
+	Mat_<float> industrialJobsDelta;	// 前回の周辺計算以降の工業の仕事量の変化量
+
 	QMap<QString, float> elapsedTimes;
 
+	QString outputDir;	// 結果ファイルの出力先（空ならカレントディレクトリ）
+	bool verbose;		// 進捗・処理時間を表示するか
+
+	int seed;		// init()で指定された乱数シード
+	int step;		// init()からのステップ数
+
+	StepScheduler scheduler;	// 1ステップのステージの依存グラフ（nextSteps()で構築する）
+	float lastScore;			// 最後に実行したステップのスコア（computeScoreステージが書き込む）
+	FieldTracker tracker;		// 各フィールドの版番号と、派生フィールドの依存関係
+
+private:
+	static enum { STREAM_INIT_ZONES = 0, STREAM_INIT_UNITS = 1, STREAM_MOVES = 2 };
+
+	Random rng;		// 現在のステップの乱数列
+
+	ConvolutionEngine neighborPopulationConv;
+	ConvolutionEngine neighborCommercialConv;
+	ConvolutionEngine pollutionConv;
+
+	Zoning() {}
+
 public:
-	Zoning(float city_length, int grid_size, const QMap<QString, float>& weights);
+	Zoning(float city_length, int grid_size, const QMap<QString, float>& weights, bool verbose = true);
+	Zoning* fork() const;
 
+	static QMap<QString, float> defaultWeights();
+	void setWeights(const QMap<QString, float>& weights);
+	void refresh();
 	void setRoads(RoadGraph& roads);
 	void init(int rand_seed = 0);
 	void nextSteps(int numSteps, float move_rate, bool saveScores, bool saveBestZoning, bool saveZonings);
 	void testRandomGeneration(int num);
+	float computeScore();
+	vector<float> computeFeature(const Mat_<uchar>& zones);
+	void saveFields();
 
 private:
+	void buildStepGraph(float move_rate);
 	void computeAccessibility();
+	void rasterizeRoads();
+	void combineAccessibility();
 	//void computeActivity();
 	void computeNeighborPopulation();
 	void computeNeighborCommercial();
 
 
 	void computePollution();
+	void updateNeighborField(ConvolutionEngine& conv, bool kernelChanged, const Mat_<float>& source, Mat_<float>& delta, Mat_<float>& raw, Mat_<float>& field);
+	void resetNeighborFields();
+	void evaluateFields();
+	void refreshField(int field, void (Zoning::*compute)());
+	void updateDependencies();
 	void updateLandValue();
 	void updatePeopleAndJobs(float ratio);
 	void removePeople(int num);
@@ -65,21 +132,26 @@ private:
 	void addCommercialJobs(int num);
 	void removeIndustrialJobs(int num);
 	void addIndustrialJobs(int num);
+	int removeUnits(Mat_<float>& units, Mat_<float>& delta, int num);
+	int addUnits(Mat_<float>& units, Mat_<float>& delta, const Mat_<float>& attractiveness, int num);
+	int removeUnitsBatch(Mat_<float>& units, Mat_<float>& delta, int num);
+	int addUnitsBatch(Mat_<float>& units, Mat_<float>& delta, const Mat_<float>& attractiveness, int max_units, int num);
 	void computeLife();
 	void computeShop();
 	void computeFactory();
 	float lifeValue(int x, int y, float max_value = 1.0f);
 	float shopValue(int x, int y, float max_value = 1.0f);
 	float factoryValue(int x, int y, float max_value = 1.0f);
-	float computeScore();
+	float utilityValue(int utility, int r, int c, float max_value);
+	float occupancy(int r, int c);
 	void updateZones();
 
-	void saveZoneImage(const Mat_<uchar>& mat, char* filename);
+	void saveField(const Mat_<float>& field, const QString& filename);
+	void saveZoneImage(const Mat_<uchar>& mat, const QString& filename);
+	QString outputPath(const QString& filename);
 	QVector2D gridToCity(const QVector2D& pt);
 	QVector2D cityToGrid(const QVector2D& pt);
 	float matsum(Mat_<float>& mat);
 	float matmax(Mat_<float>& mat);
-
-	vector<float> computeFeature(const Mat_<uchar>& zones);
 };
 
@@ -0,0 +1,406 @@
+﻿/**
+ * Zoningの各ステージの処理時間を、都市とグリッドサイズを変えながら計測する。
+ *
+ * 使い方:
+ *   ZoningSimBench [--cities a.gsm,b.gsm] [--sizes 60,128,...] [--reps n] [--pool-threads n] [--simd scalar] [--out bench.csv]
+ *   ZoningSimBench --check [--sizes 60,128,...]
+ *
+ * 結果は、1行が (都市, グリッドサイズ, ステージ) のCSVで出力するので、ビルド間でdiffを取ることができる。
+ * --checkを指定すると、計測の代わりに、高速化した実装と参照実装の結果を比較し、一致しなければ1を返す。
+ */
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <QFile>
+#include <QStringList>
+#include "Zoning.h"
+#include "GraphUtil.h"
+#include "SimdKernels.h"
+#include "ThreadPool.h"
+#include "Random.h"
+
+/**
+ * 1つのステージの計測結果。
+ */
+struct StageStats {
+	QString name;
+	vector<double> samples;	// 各回の処理時間 [ns]
+
+	double mean() const {
+		double sum = 0.0;
+		for (int i = 0; i < samples.size(); ++i) sum += samples[i];
+		return samples.size() > 0 ? sum / samples.size() : 0.0;
+	}
+
+	double variance() const {
+		if (samples.size() < 2) return 0.0;
+		double m = mean();
+		double sum = 0.0;
+		for (int i = 0; i < samples.size(); ++i) sum += (samples[i] - m) * (samples[i] - m);
+		return sum / (samples.size() - 1);
+	}
+
+	double min() const {
+		double ret = numeric_limits<double>::max();
+		for (int i = 0; i < samples.size(); ++i) ret = std::min(ret, samples[i]);
+		return ret;
+	}
+};
+
+/**
+ * Zoningの非公開のステージを、1つずつ呼び出して計測する。
+ */
+class ZoningBench {
+public:
+	static void measure(Zoning& zoning, int reps, float move_rate, vector<StageStats>& stats);
+	static bool checkConvolution(Zoning& zoning);
+
+private:
+	enum { STAGE_ACCESSIBILITY = 0, STAGE_NEIGHBOR_POPULATION, STAGE_NEIGHBOR_COMMERCIAL, STAGE_POLLUTION, STAGE_LANDVALUE, STAGE_LIFE, STAGE_SHOP, STAGE_FACTORY, STAGE_FUSED_FIELDS, STAGE_PEOPLE_AND_JOBS, STAGE_ZONES, STAGE_SCORE, STAGE_FEATURE, NUM_STAGES };
+
+	template<class F>
+	static void time(StageStats& stats, F func) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		func();
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		stats.samples.push_back((double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+	}
+};
+
+/**
+ * 各ステージをreps回ずつ計測する。
+ * 1回の計測は、シミュレーションの1ステップと同じ順序で各ステージを呼び出す。
+ * 周辺フィールドは、毎回ソース全体から作り直す場合の時間を計測する。
+ */
+void ZoningBench::measure(Zoning& zoning, int reps, float move_rate, vector<StageStats>& stats) {
+	static const char* names[NUM_STAGES] = { "accessibility", "neighborPopulation", "neighborCommercial", "pollution", "landValue", "life", "shop", "factory", "fusedFields", "peopleAndJobs", "zones", "score", "feature" };
+
+	stats.resize(NUM_STAGES);
+	for (int i = 0; i < NUM_STAGES; ++i) {
+		stats[i].name = names[i];
+		stats[i].samples.clear();
+	}
+
+	for (int rep = 0; rep < reps; ++rep) {
+		time(stats[STAGE_ACCESSIBILITY], [&]() { zoning.computeAccessibility(); });
+
+		zoning.resetNeighborFields();
+		time(stats[STAGE_NEIGHBOR_POPULATION], [&]() { zoning.computeNeighborPopulation(); });
+		time(stats[STAGE_NEIGHBOR_COMMERCIAL], [&]() { zoning.computeNeighborCommercial(); });
+		time(stats[STAGE_POLLUTION], [&]() { zoning.computePollution(); });
+
+		time(stats[STAGE_LANDVALUE], [&]() { zoning.updateLandValue(); });
+		time(stats[STAGE_LIFE], [&]() { zoning.computeLife(); });
+		time(stats[STAGE_SHOP], [&]() { zoning.computeShop(); });
+		time(stats[STAGE_FACTORY], [&]() { zoning.computeFactory(); });
+		zoning.tracker.invalidateAll();
+		time(stats[STAGE_FUSED_FIELDS], [&]() { zoning.evaluateFields(); });
+		time(stats[STAGE_PEOPLE_AND_JOBS], [&]() { zoning.updatePeopleAndJobs(move_rate); });
+		time(stats[STAGE_ZONES], [&]() { zoning.updateZones(); });
+
+		volatile float score;
+		time(stats[STAGE_SCORE], [&]() { score = zoning.computeScore(); });
+		vector<float> feature;
+		time(stats[STAGE_FEATURE], [&]() { feature = zoning.computeFeature(zoning.zones); });
+	}
+}
+
+/**
+ * 周辺人口・周辺商業・汚染度の畳み込みについて、FFTと直接法の結果の差の最大値が、
+ * 出力の最大値のConvolutionEngine::TOLERANCE倍以内であることを確認する。
+ * 直接法は、値が0でないセルの数に比例して時間がかかるので、ソースは最大4096セルだけに値を持たせる。
+ *
+ * @return		全て許容誤差以内ならtrue
+ */
+bool ZoningBench::checkConvolution(Zoning& zoning) {
+	static const char* names[3] = { "neighborPopulation", "neighborCommercial", "pollution" };
+
+	// 各エンジンのカーネルを、既定の重みでセットしておく
+	zoning.computeNeighborPopulation();
+	zoning.computeNeighborCommercial();
+	zoning.computePollution();
+	ConvolutionEngine* engines[3] = { &zoning.neighborPopulationConv, &zoning.neighborCommercialConv, &zoning.pollutionConv };
+
+	const int grid_size = zoning.grid_size;
+	const int num_cells = grid_size * grid_size;
+	const int num = std::min(num_cells, 4096);
+	Random rand(grid_size);
+	Mat_<float> src = Mat_<float>::zeros(grid_size, grid_size);
+	for (int i = 0; i < num; ++i) {
+		int k = num == num_cells ? i : rand.nextUInt() % num_cells;
+		src(k / grid_size, k % grid_size) = rand.uniform(0.0f, Zoning::MAX_POPULATION);
+	}
+
+	bool ok = true;
+	for (int i = 0; i < 3; ++i) {
+		Mat_<float> fft, direct;
+		engines[i]->applyFFT(src, fft);
+		engines[i]->applyDirect(src, direct);
+
+		double max_diff = cv::norm(fft, direct, cv::NORM_INF);
+		double max_value = cv::norm(direct, cv::NORM_INF);
+		bool same = max_diff <= ConvolutionEngine::TOLERANCE * max_value;
+		cerr << grid_size << " x " << grid_size << " " << names[i] << ": " << max_diff << " / " << max_value << " " << (same ? "ok" : "MISMATCH") << endl;
+		ok = ok && same;
+	}
+
+	return ok;
+}
+
+namespace {
+
+void printUsage() {
+	cout << "Usage: ZoningSimBench [options]" << endl;
+	cout << "  --cities <files>       comma-separated road graphs (default: osm/lafayette.gsm,osm/san-francisco.gsm,osm/urayasu_small.gsm)" << endl;
+	cout << "  --sizes <list>         comma-separated grid sizes (default: 60,128,256,512,1024,2048)" << endl;
+	cout << "  --city-length <m>      length of one side of the city [m] (default: 9000)" << endl;
+	cout << "  --reps <n>             repetitions per stage (default: 5)" << endl;
+	cout << "  --move-rate <r>        ratio of people/jobs moved per step (default: 0.5)" << endl;
+	cout << "  --unit-moves           move people/jobs one at a time instead of batched sampling" << endl;
+	cout << "  --seed <s>             random seed (default: 0)" << endl;
+	cout << "  --pool-threads <n>     threads used within each simulation step (0: all cores)" << endl;
+	cout << "  --out <file>           output CSV file (default: stdout)" << endl;
+	cout << "  --simd <level>         SIMD kernels to use: scalar, sse4, avx2 or avx512 (default: fastest available)" << endl;
+	cout << "  --check                compare the SIMD kernels and FFT convolution (at each --sizes) against the reference implementations and exit" << endl;
+}
+
+void report(const char* name, const char* kernel, bool ok) {
+	cerr << name << " " << kernel << ": " << (ok ? "ok" : "MISMATCH") << endl;
+}
+
+/**
+ * expShiftの結果が、参照実装と数ulp以内で一致するか。
+ * 参照の値が非正規化数の場合は、絶対誤差が最小の非正規化数以内であればよい。
+ */
+bool expMatches(float ret, float ref) {
+	if (ret == ref) return true;
+	if (std::isinf(ref) || std::isinf(ret)) return false;
+	if (fabs(ref) < numeric_limits<float>::min()) return fabs(ret - ref) <= numeric_limits<float>::denorm_min();
+	return fabs(ret - ref) <= 4.0f * numeric_limits<float>::epsilon() * fabs(ref);
+}
+
+/**
+ * このCPUで使える全てのレベルで各SIMDカーネルを実行し、スカラー版の結果と比較する。
+ * axpy、clamp、classifyZonesはビット単位で、expShiftは数ulp以内で、scoreTermsは相対誤差1e-4以内で一致すること。
+ *
+ * @return		全て一致すればtrue
+ */
+bool checkSimdKernels() {
+	// ベクトル幅で割り切れない長さにして、端数の処理も確認する
+	const int n = 4096 + 13;
+	const unsigned char codes[5] = { Zoning::TYPE_RESIDENTIAL, Zoning::TYPE_COMMERCIAL, Zoning::TYPE_INDUSTRIAL, Zoning::TYPE_MIXED, Zoning::TYPE_PARK };
+
+	Random rand(12345);
+	vector<float> x(n), y(n), exps(n), life(n), shop(n), factory(n), population(n), commercialJobs(n), industrialJobs(n);
+	rand.fillUniform(&x[0], n, -2.0f, 2.0f);
+	rand.fillUniform(&y[0], n, -2.0f, 2.0f);
+	rand.fillUniform(&life[0], n, -1.0f, 1.0f);
+	rand.fillUniform(&shop[0], n, -1.0f, 1.0f);
+	rand.fillUniform(&factory[0], n, -1.0f, 1.0f);
+	rand.fillUniform(&population[0], n, 0.0f, Zoning::MAX_POPULATION);
+	rand.fillUniform(&commercialJobs[0], n, 0.0f, Zoning::MAX_JOBS);
+	rand.fillUniform(&industrialJobs[0], n, 0.0f, Zoning::MAX_JOBS);
+
+	// expShiftは、アンダーフロー・オーバーフローする範囲も含める
+	rand.fillUniform(&exps[0], n, -120.0f, 100.0f);
+	exps[0] = -numeric_limits<float>::infinity();
+	exps[1] = numeric_limits<float>::infinity();
+	exps[2] = 0.0f;
+
+	const int saved = SimdKernels::level();
+	SimdKernels::setLevel(SimdKernels::LEVEL_SCALAR);
+
+	vector<float> ref_axpy = y;
+	SimdKernels::axpy(&ref_axpy[0], &x[0], 0.7f, n);
+	vector<float> ref_clamp = x;
+	SimdKernels::clamp(&ref_clamp[0], -1.0f, 1.0f, n);
+	vector<float> ref_exp(n);
+	SimdKernels::expShift(&ref_exp[0], &exps[0], 1.5f, n);
+	vector<unsigned char> ref_zones(n);
+	SimdKernels::classifyZones(&ref_zones[0], &population[0], &commercialJobs[0], &industrialJobs[0], n, Zoning::MAX_POPULATION, Zoning::MAX_JOBS, codes);
+	double ref_score, ref_total;
+	SimdKernels::scoreTerms(&life[0], &shop[0], &factory[0], &population[0], &commercialJobs[0], &industrialJobs[0], n, ref_score, ref_total);
+
+	bool ok = true;
+	for (int level = SimdKernels::LEVEL_SCALAR + 1; level < SimdKernels::NUM_LEVELS; ++level) {
+		const char* name = SimdKernels::levelName(level);
+		if (SimdKernels::setLevel(level) != level) {
+			cerr << name << ": not supported by this CPU. Skipped." << endl;
+			continue;
+		}
+
+		vector<float> ret = y;
+		SimdKernels::axpy(&ret[0], &x[0], 0.7f, n);
+		bool same = ret == ref_axpy;
+		report(name, "axpy", same);
+		ok = ok && same;
+
+		ret = x;
+		SimdKernels::clamp(&ret[0], -1.0f, 1.0f, n);
+		same = ret == ref_clamp;
+		report(name, "clamp", same);
+		ok = ok && same;
+
+		SimdKernels::expShift(&ret[0], &exps[0], 1.5f, n);
+		same = true;
+		for (int i = 0; i < n; ++i) {
+			if (!expMatches(ret[i], ref_exp[i])) same = false;
+		}
+		report(name, "expShift", same);
+		ok = ok && same;
+
+		vector<unsigned char> zones(n);
+		SimdKernels::classifyZones(&zones[0], &population[0], &commercialJobs[0], &industrialJobs[0], n, Zoning::MAX_POPULATION, Zoning::MAX_JOBS, codes);
+		same = zones == ref_zones;
+		report(name, "classifyZones", same);
+		ok = ok && same;
+
+		double score, total;
+		SimdKernels::scoreTerms(&life[0], &shop[0], &factory[0], &population[0], &commercialJobs[0], &industrialJobs[0], n, score, total);
+		same = fabs(score - ref_score) <= 1e-4 * fabs(ref_score) && fabs(total - ref_total) <= 1e-4 * fabs(ref_total);
+		report(name, "scoreTerms", same);
+		ok = ok && same;
+	}
+
+	SimdKernels::setLevel(saved);
+	return ok;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+	QStringList cities;
+	cities << "osm/lafayette.gsm" << "osm/san-francisco.gsm" << "osm/urayasu_small.gsm";
+	vector<int> sizes;
+	sizes.push_back(60);
+	sizes.push_back(128);
+	sizes.push_back(256);
+	sizes.push_back(512);
+	sizes.push_back(1024);
+	sizes.push_back(2048);
+	float city_length = 9000.0f;
+	int reps = 5;
+	float move_rate = 0.5f;
+	bool batch_moves = true;
+	int seed = 0;
+	int pool_threads = -1;
+	QString out_file;
+	int simd_level = -1;
+	bool check = false;
+
+	for (int i = 1; i < argc; ++i) {
+		QString arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (arg == "--cities" && has_value) {
+			cities = QString(argv[++i]).split(",");
+		} else if (arg == "--sizes" && has_value) {
+			QStringList list = QString(argv[++i]).split(",");
+			sizes.clear();
+			for (int k = 0; k < list.size(); ++k) {
+				sizes.push_back(list[k].toInt());
+			}
+		} else if (arg == "--city-length" && has_value) {
+			city_length = atof(argv[++i]);
+		} else if (arg == "--reps" && has_value) {
+			reps = atoi(argv[++i]);
+		} else if (arg == "--move-rate" && has_value) {
+			move_rate = atof(argv[++i]);
+		} else if (arg == "--unit-moves") {
+			batch_moves = false;
+		} else if (arg == "--seed" && has_value) {
+			seed = atoi(argv[++i]);
+		} else if (arg == "--out" && has_value) {
+			out_file = argv[++i];
+		} else if (arg == "--pool-threads" && has_value) {
+			pool_threads = atoi(argv[++i]);
+		} else if (arg == "--check") {
+			check = true;
+		} else if (arg == "--simd" && has_value) {
+			simd_level = SimdKernels::levelFromName(argv[++i]);
+			if (simd_level < 0) {
+				printUsage();
+				return 1;
+			}
+		} else {
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (reps <= 0 || city_length <= 0.0f) {
+		printUsage();
+		return 1;
+	}
+
+	if (pool_threads >= 0) ThreadPool::setNumThreads(pool_threads);
+	if (simd_level >= 0) SimdKernels::setLevel(simd_level);
+	cerr << "SIMD: " << SimdKernels::levelName(SimdKernels::level()) << ", threads: " << ThreadPool::numThreads() << endl;
+
+	if (check) {
+		bool ok = checkSimdKernels();
+		for (int j = 0; j < sizes.size(); ++j) {
+			if (sizes[j] <= 0) continue;
+			Zoning zoning(city_length, sizes[j], Zoning::defaultWeights(), false);
+			ok = ZoningBench::checkConvolution(zoning) && ok;
+		}
+		cerr << (ok ? "All checks passed." : "Some checks failed.") << endl;
+		ThreadPool::shutdown();
+		return ok ? 0 : 1;
+	}
+
+	FILE* fp = stdout;
+	if (!out_file.isEmpty()) {
+		fp = fopen(out_file.toUtf8().constData(), "w");
+		if (fp == NULL) {
+			cout << "Error: " << out_file.toUtf8().constData() << " could not be created." << endl;
+			ThreadPool::shutdown();
+			return 1;
+		}
+	}
+
+	fprintf(fp, "city,grid_size,moves,stage,reps,mean_ns,stddev_ns,variance_ns2,min_ns,ns_per_cell,cells_per_sec\n");
+
+	for (int i = 0; i < cities.size(); ++i) {
+		if (!QFile::exists(cities[i])) {
+			cerr << "Warning: " << cities[i].toUtf8().constData() << " does not exist. Skipped." << endl;
+			continue;
+		}
+
+		RoadGraph roads;
+		if (!GraphUtil::loadRoads(roads, cities[i])) {
+			cerr << "Warning: " << cities[i].toUtf8().constData() << " could not be loaded. Skipped." << endl;
+			continue;
+		}
+
+		for (int j = 0; j < sizes.size(); ++j) {
+			int grid_size = sizes[j];
+			if (grid_size <= 0) continue;
+			cerr << cities[i].toUtf8().constData() << ", " << grid_size << " x " << grid_size << " ..." << endl;
+
+			Zoning zoning(city_length, grid_size, Zoning::defaultWeights(), false);
+			zoning.batchMoves = batch_moves;
+			zoning.setRoads(roads);
+			zoning.init(seed);
+
+			vector<StageStats> stats;
+			ZoningBench::measure(zoning, reps, move_rate, stats);
+
+			double cells = (double)grid_size * grid_size;
+			for (int k = 0; k < stats.size(); ++k) {
+				double mean = stats[k].mean();
+				double variance = stats[k].variance();
+				fprintf(fp, "%s,%d,%s,%s,%d,%.0lf,%.0lf,%.6g,%.0lf,%.4lf,%.6g\n",
+					cities[i].toUtf8().constData(), grid_size, batch_moves ? "batch" : "unit", stats[k].name.toUtf8().constData(), reps,
+					mean, sqrt(variance), variance, stats[k].min(), mean / cells, mean > 0.0 ? cells / mean * 1e9 : 0.0);
+			}
+			fflush(fp);
+		}
+	}
+
+	if (fp != stdout) fclose(fp);
+	ThreadPool::shutdown();
+
+	return 0;
+}
@@ -0,0 +1,279 @@
+﻿/**
+ * GUIを使わずに、コマンドラインからゾーニングのシミュレーションを実行する。
+ * Qtのウィジェットや、OpenGLのコンテキストは使用しない。
+ *
+ * 使い方:
+ *   ZoningSimCli --roads osm/lafayette.gsm [options]
+ *
+ * 各シードの結果は <out>/seed_<シード>/ に、全シードのスコアと特徴量は <out>/summary.txt に出力する。
+ * --threadsを指定した場合は、各シードを並列に実行し、summary.txtだけを出力する。
+ */
+#include <iostream>
+#include <QFile>
+#include <QDir>
+#include <QStringList>
+#include <QTextStream>
+#include "Zoning.h"
+#include "GraphUtil.h"
+#include "SimdKernels.h"
+#include "ThreadPool.h"
+#include "ZoningEnsemble.h"
+#include "Trace.h"
+
+namespace {
+
+void printUsage() {
+	cout << "Usage: ZoningSimCli --roads <file> [options]" << endl;
+	cout << "  --roads <file>         road graph (.gsm)" << endl;
+	cout << "  --city-length <m>      length of one side of the city [m] (default: 9000)" << endl;
+	cout << "  --grid-size <n>        number of cells along one side (default: 60)" << endl;
+	cout << "  --weights <file>       weights file, one \"name value\" per line (default: built-in)" << endl;
+	cout << "  --seed <s>             first random seed (default: 0)" << endl;
+	cout << "  --runs <n>             number of seeds to run, starting from --seed (default: 1)" << endl;
+	cout << "  --steps <n>            simulation steps per run (default: 10)" << endl;
+	cout << "  --move-rate <r>        ratio of people/jobs moved per step (default: 0.5)" << endl;
+	cout << "  --batch-moves          move people/jobs with batched multinomial sampling" << endl;
+	cout << "  --accessibility <mode> accessibility from road length density or network travel time: density or network (default: density)" << endl;
+	cout << "  --out <dir>            output directory (default: .)" << endl;
+	cout << "  --save-fields          save the final fields of each run" << endl;
+	cout << "  --save-zonings         save the zone map of every step" << endl;
+	cout << "  --threads <n>          run seeds in parallel on n threads (0: all cores) and write summary.txt only" << endl;
+	cout << "  --pool-threads <n>     threads used within each step (0: all cores; default: all cores, or 1 with --threads)" << endl;
+	cout << "  --trace <file>         save a Chrome trace-event JSON of the run" << endl;
+	cout << "  --simd <level>         SIMD kernels to use: scalar, sse4, avx2 or avx512 (default: fastest available)" << endl;
+	cout << "  --quiet                do not print progress" << endl;
+}
+
+/**
+ * 重みファイルを読み込み、weightsの該当する値を上書きする。
+ * 各行は "名前 値" の形式で、#以降はコメントとして無視する。
+ *
+ * @return			読み込めたらtrue
+ */
+bool loadWeights(const QString& filename, QMap<QString, float>& weights) {
+	QFile file(filename);
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) return false;
+
+	QTextStream in(&file);
+	int line_no = 0;
+	while (!in.atEnd()) {
+		QString line = in.readLine();
+		line_no++;
+
+		int comment = line.indexOf('#');
+		if (comment >= 0) line = line.left(comment);
+		line = line.trimmed();
+		if (line.isEmpty()) continue;
+
+		QStringList list = line.split(QRegExp("[\\s=,]+"), QString::SkipEmptyParts);
+		bool ok = false;
+		float value = 0.0f;
+		if (list.size() == 2) value = list[1].toFloat(&ok);
+		if (!ok) {
+			cout << "Error: " << filename.toUtf8().constData() << ":" << line_no << ": invalid line." << endl;
+			return false;
+		}
+
+		if (!weights.contains(list[0])) {
+			cout << "Warning: unknown weight \"" << list[0].toUtf8().constData() << "\"." << endl;
+		}
+		weights[list[0]] = value;
+	}
+
+	return true;
+}
+
+/**
+ * トレースを保存する。ファイル名が空なら何もしない。
+ */
+void saveTrace(const QString& filename) {
+	if (filename.isEmpty()) return;
+
+#if ZONING_TRACE
+	if (!Trace::dump(filename)) {
+		cout << "Warning: " << filename.toUtf8().constData() << " could not be created." << endl;
+	}
+#else
+	cout << "Warning: tracing is disabled in this build (ZONING_TRACE=0)." << endl;
+#endif
+}
+
+}
+
+int main(int argc, char *argv[]) {
+	QString roads_file;
+	QString weights_file;
+	QString out_dir = ".";
+	float city_length = 9000.0f;
+	int grid_size = 60;
+	int seed = 0;
+	int runs = 1;
+	int steps = 10;
+	float move_rate = 0.5f;
+	bool batch_moves = false;
+	int accessibility_mode = Zoning::ACCESSIBILITY_DENSITY;
+	bool save_fields = false;
+	bool save_zonings = false;
+	bool verbose = true;
+	int num_threads = 1;
+	int pool_threads = -1;
+	QString trace_file;
+	int simd_level = -1;
+
+	for (int i = 1; i < argc; ++i) {
+		QString arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (arg == "--roads" && has_value) {
+			roads_file = argv[++i];
+		} else if (arg == "--city-length" && has_value) {
+			city_length = atof(argv[++i]);
+		} else if (arg == "--grid-size" && has_value) {
+			grid_size = atoi(argv[++i]);
+		} else if (arg == "--weights" && has_value) {
+			weights_file = argv[++i];
+		} else if (arg == "--seed" && has_value) {
+			seed = atoi(argv[++i]);
+		} else if (arg == "--runs" && has_value) {
+			runs = atoi(argv[++i]);
+		} else if (arg == "--steps" && has_value) {
+			steps = atoi(argv[++i]);
+		} else if (arg == "--move-rate" && has_value) {
+			move_rate = atof(argv[++i]);
+		} else if (arg == "--out" && has_value) {
+			out_dir = argv[++i];
+		} else if (arg == "--threads" && has_value) {
+			num_threads = atoi(argv[++i]);
+		} else if (arg == "--trace" && has_value) {
+			trace_file = argv[++i];
+		} else if (arg == "--pool-threads" && has_value) {
+			pool_threads = atoi(argv[++i]);
+		} else if (arg == "--simd" && has_value) {
+			simd_level = SimdKernels::levelFromName(argv[++i]);
+			if (simd_level < 0) {
+				printUsage();
+				return 1;
+			}
+		} else if (arg == "--accessibility" && has_value) {
+			QString mode = argv[++i];
+			if (mode == "density") {
+				accessibility_mode = Zoning::ACCESSIBILITY_DENSITY;
+			} else if (mode == "network") {
+				accessibility_mode = Zoning::ACCESSIBILITY_NETWORK;
+			} else {
+				printUsage();
+				return 1;
+			}
+		} else if (arg == "--batch-moves") {
+			batch_moves = true;
+		} else if (arg == "--save-fields") {
+			save_fields = true;
+		} else if (arg == "--save-zonings") {
+			save_zonings = true;
+		} else if (arg == "--quiet") {
+			verbose = false;
+		} else {
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (roads_file.isEmpty() || city_length <= 0.0f || grid_size <= 0 || runs <= 0 || steps <= 0 || num_threads < 0) {
+		printUsage();
+		return 1;
+	}
+	if (!QFile::exists(roads_file)) {
+		cout << "Error: " << roads_file.toUtf8().constData() << " does not exist." << endl;
+		return 1;
+	}
+
+	QMap<QString, float> weights = Zoning::defaultWeights();
+	if (!weights_file.isEmpty() && !loadWeights(weights_file, weights)) {
+		cout << "Error: " << weights_file.toUtf8().constData() << " could not be loaded." << endl;
+		return 1;
+	}
+
+	if (!QDir().mkpath(out_dir)) {
+		cout << "Error: " << out_dir.toUtf8().constData() << " could not be created." << endl;
+		return 1;
+	}
+
+	// シードを並列に実行する場合は、既定では各ステップの中は並列化しない
+	if (pool_threads < 0 && num_threads != 1) pool_threads = 1;
+	if (pool_threads >= 0) ThreadPool::setNumThreads(pool_threads);
+	if (simd_level >= 0) SimdKernels::setLevel(simd_level);
+	if (verbose) cout << "SIMD: " << SimdKernels::levelName(SimdKernels::level()) << ", threads: " << ThreadPool::numThreads() << endl;
+
+	Zoning zoning(city_length, grid_size, weights, verbose);
+	zoning.batchMoves = batch_moves;
+	zoning.accessibilityMode = accessibility_mode;
+
+	RoadGraph roads;
+	if (!GraphUtil::loadRoads(roads, roads_file)) {
+		cout << "Error: " << roads_file.toUtf8().constData() << " could not be loaded." << endl;
+		ThreadPool::shutdown();
+		return 1;
+	}
+	zoning.setRoads(roads);
+
+	FILE* fp = fopen(QString(out_dir + "/summary.txt").toUtf8().constData(), "w");
+	if (fp == NULL) {
+		cout << "Error: summary.txt could not be created in " << out_dir.toUtf8().constData() << "." << endl;
+		ThreadPool::shutdown();
+		return 1;
+	}
+
+	if (num_threads != 1) {
+		vector<int> seeds(runs);
+		for (int run = 0; run < runs; ++run) {
+			seeds[run] = seed + run;
+		}
+
+		vector<ZoningSample> samples = ZoningEnsemble::run(zoning, seeds, steps, move_rate, num_threads);
+		for (int run = 0; run < samples.size(); ++run) {
+			fprintf(fp, "%d,%lf", samples[run].seed, samples[run].score);
+			for (int k = 0; k < samples[run].feature.size(); ++k) {
+				fprintf(fp, ",%lf", samples[run].feature[k]);
+			}
+			fprintf(fp, "\n");
+		}
+		fclose(fp);
+
+		if (verbose) {
+			cout << samples.size() << " runs done." << endl;
+		}
+		saveTrace(trace_file);
+		ThreadPool::shutdown();
+		return 0;
+	}
+
+	for (int run = 0; run < runs; ++run) {
+		int s = seed + run;
+		zoning.outputDir = out_dir + QString("/seed_%1").arg(s);
+		QDir().mkpath(zoning.outputDir);
+
+		zoning.init(s);
+		zoning.nextSteps(steps, move_rate, true, true, save_zonings);
+		if (save_fields) zoning.saveFields();
+
+		// シード、スコア、特徴量を1行に出力する
+		float score = zoning.computeScore();
+		fprintf(fp, "%d,%lf", s, score);
+		vector<float> feature = zoning.computeFeature(zoning.zones);
+		for (int k = 0; k < feature.size(); ++k) {
+			fprintf(fp, ",%lf", feature[k]);
+		}
+		fprintf(fp, "\n");
+		fflush(fp);
+
+		if (verbose) {
+			cout << "Seed " << s << ": score " << score << endl;
+		}
+	}
+
+	fclose(fp);
+	saveTrace(trace_file);
+	ThreadPool::shutdown();
+
+	return 0;
+}
@@ -0,0 +1,53 @@
+﻿#include "ZoningEnsemble.h"
+#include "Zoning.h"
+#include <thread>
+#include <atomic>
+
+/**
+ * 各シードについて、init(seed)してからnumStepsステップ進め、スコアと特徴量を計算する。
+ *
+ * @param base			基準となるゾーニング（道路、重み、グリッドの設定を使用する）
+ * @param seeds			シードのリスト
+ * @param numSteps		各シミュレーションのステップ数
+ * @param move_rate		各ステップで動かす人・仕事の割合
+ * @param num_threads	スレッド数（0なら、全てのコアを使う）
+ * @return				シードの順に並んだ結果
+ */
+std::vector<ZoningSample> ZoningEnsemble::run(const Zoning& base, const std::vector<int>& seeds, int numSteps, float move_rate, int num_threads) {
+	std::vector<ZoningSample> samples(seeds.size());
+	if (seeds.size() == 0) return samples;
+
+	if (num_threads <= 0) num_threads = std::max(1, (int)std::thread::hardware_concurrency());
+	num_threads = std::min(num_threads, (int)seeds.size());
+
+	// 各スレッドは、次のシードを取り出して実行する。結果は、シードの位置に書き込むので順序は保たれる
+	std::atomic<int> next(0);
+	auto worker = [&]() {
+		Zoning* zoning = base.fork();
+
+		for (int i = next++; i < seeds.size(); i = next++) {
+			zoning->init(seeds[i]);
+			zoning->nextSteps(numSteps, move_rate, false, false, false);
+
+			samples[i].seed = seeds[i];
+			samples[i].score = zoning->computeScore();
+			samples[i].feature = zoning->computeFeature(zoning->zones);
+		}
+
+		delete zoning;
+	};
+
+	if (num_threads == 1) {
+		worker();
+	} else {
+		std::vector<std::thread> threads;
+		for (int t = 0; t < num_threads; ++t) {
+			threads.push_back(std::thread(worker));
+		}
+		for (int t = 0; t < num_threads; ++t) {
+			threads[t].join();
+		}
+	}
+
+	return samples;
+}
@@ -0,0 +1,29 @@
+﻿#pragma once
+
+#include <vector>
+
+class Zoning;
+
+/**
+ * 1回のシミュレーションの結果。
+ */
+struct ZoningSample {
+	int seed;
+	float score;
+	std::vector<float> feature;
+};
+
+/**
+ * 異なるシードのシミュレーションを、複数のスレッドで並列に実行する。
+ *
+ * 各スレッドは、基準となるZoningをfork()した専用のオブジェクトを使い回すので、
+ * 道路データやアクセシビリティはコピーされない。各シードの乱数列は (seed, step) で決まるので、
+ * 結果はスレッド数や実行順序に関係なく同じになり、シードの順に返却される。
+ */
+class ZoningEnsemble {
+public:
+	static std::vector<ZoningSample> run(const Zoning& base, const std::vector<int>& seeds, int numSteps, float move_rate, int num_threads = 0);
+
+private:
+	ZoningEnsemble() {}
+};
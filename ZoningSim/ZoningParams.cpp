@@ -0,0 +1,115 @@
+﻿#include "ZoningParams.h"
+
+namespace {
+	const char* INPUT_NAMES[ZoningParams::NUM_INPUTS] = { "accessibility", "neighbor_population", "neighbor_commercial", "pollution", "slope", "landvalue", "population", "commercialjobs", "industrialjobs" };
+	const char* UTILITY_NAMES[ZoningParams::NUM_UTILITIES] = { "life", "shop", "factory" };
+}
+
+ZoningParams::ZoningParams() {
+	highway_accessibility = 0.0f;
+	avenue_accessibility = 0.0f;
+	street_accessibility = 0.0f;
+	population_neighbor = 0.0f;
+	distance_neighbor_population = 0.0f;
+	commercial_neighbor = 0.0f;
+	distance_neighbor_commercial = 0.0f;
+	industrial_pollution = 0.0f;
+	distance_pollution = 0.0f;
+
+	for (int i = 0; i < NUM_INPUTS; ++i) {
+		landvalue[i] = 0.0f;
+		for (int k = 0; k < NUM_UTILITIES; ++k) {
+			utility[i][k] = 0.0f;
+		}
+	}
+}
+
+/**
+ * 重みをコンパイルする。
+ * 重みが更新されるたびに、一度だけ呼び出せば良い。
+ *
+ * @param weights			重み
+ * @param normalization		各入力に掛ける正規化係数（例えば、人口なら1 / MAX_POPULATION）
+ */
+void ZoningParams::compile(const QMap<QString, float>& weights, const float normalization[NUM_INPUTS]) {
+	highway_accessibility = weights.value("highway_accessibility");
+	avenue_accessibility = weights.value("avenue_accessibility");
+	street_accessibility = weights.value("street_accessibility");
+
+	population_neighbor = weights.value("population_neighbor");
+	distance_neighbor_population = weights.value("distance_neighbor_population");
+	commercial_neighbor = weights.value("commercial_neighbor");
+	distance_neighbor_commercial = weights.value("distance_neighbor_commercial");
+	industrial_pollution = weights.value("industrial_pollution");
+	distance_pollution = weights.value("distance_pollution");
+
+	for (int i = 0; i < NUM_INPUTS; ++i) {
+		if (i == INPUT_LANDVALUE) {
+			landvalue[i] = 0.0f;
+		} else {
+			landvalue[i] = weights.value(QString(INPUT_NAMES[i]) + "_landvalue") * normalization[i];
+		}
+
+		for (int k = 0; k < NUM_UTILITIES; ++k) {
+			utility[i][k] = weights.value(QString(INPUT_NAMES[i]) + "_" + UTILITY_NAMES[k]) * normalization[i];
+		}
+	}
+}
+
+/**
+ * otherと値が異なる重みのグループを、ビットマスク（1 << GROUP_xxx）で返却する。
+ */
+unsigned int ZoningParams::changedGroups(const ZoningParams& other) const {
+	unsigned int ret = 0;
+
+	if (highway_accessibility != other.highway_accessibility || avenue_accessibility != other.avenue_accessibility || street_accessibility != other.street_accessibility) {
+		ret |= group(GROUP_ACCESSIBILITY);
+	}
+	if (population_neighbor != other.population_neighbor || distance_neighbor_population != other.distance_neighbor_population) {
+		ret |= group(GROUP_NEIGHBOR_POPULATION);
+	}
+	if (commercial_neighbor != other.commercial_neighbor || distance_neighbor_commercial != other.distance_neighbor_commercial) {
+		ret |= group(GROUP_NEIGHBOR_COMMERCIAL);
+	}
+	if (industrial_pollution != other.industrial_pollution || distance_pollution != other.distance_pollution) {
+		ret |= group(GROUP_POLLUTION);
+	}
+	for (int i = 0; i < NUM_INPUTS; ++i) {
+		if (landvalue[i] != other.landvalue[i]) ret |= group(GROUP_LANDVALUE);
+		for (int k = 0; k < NUM_UTILITIES; ++k) {
+			if (utility[i][k] != other.utility[i][k]) ret |= group(GROUP_LIFE + k);
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * 地価の係数が0でない入力を、ビットマスク（1 << INPUT_xxx）で返却する。
+ */
+unsigned int ZoningParams::landValueInputs() const {
+	unsigned int ret = 0;
+	for (int i = 0; i < NUM_INPUTS; ++i) {
+		if (landvalue[i] != 0.0f) ret |= 1u << i;
+	}
+	return ret;
+}
+
+/**
+ * 指定された効用の係数が0でない入力を、ビットマスク（1 << INPUT_xxx）で返却する。
+ */
+unsigned int ZoningParams::utilityInputs(int utility) const {
+	unsigned int ret = 0;
+	for (int i = 0; i < NUM_INPUTS; ++i) {
+		if (this->utility[i][utility] != 0.0f) ret |= 1u << i;
+	}
+	return ret;
+}
+
+const char* ZoningParams::inputName(int input) {
+	return INPUT_NAMES[input];
+}
+
+const char* ZoningParams::utilityName(int utility) {
+	return UTILITY_NAMES[utility];
+}
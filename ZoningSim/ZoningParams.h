@@ -0,0 +1,55 @@
+﻿#pragma once
+
+#include <QMap>
+#include <QString>
+
+/**
+ * 文字列キーの重み（QMap<QString, float>）を、固定スロットのfloat配列にコンパイルしたもの。
+ * シミュレーションの内側のループでは、QMapの代わりにこれを参照する。
+ *
+ * 地価と効用の係数は、各入力の正規化（MAX_POPULATIONなどでの除算）を畳み込んだ値を保持する。
+ */
+class ZoningParams {
+public:
+	// 地価・効用の入力
+	static enum { INPUT_ACCESSIBILITY = 0, INPUT_NEIGHBOR_POPULATION, INPUT_NEIGHBOR_COMMERCIAL, INPUT_POLLUTION, INPUT_SLOPE, INPUT_LANDVALUE, INPUT_POPULATION, INPUT_COMMERCIALJOBS, INPUT_INDUSTRIALJOBS, NUM_INPUTS };
+
+	// 効用の種類
+	static enum { UTILITY_LIFE = 0, UTILITY_SHOP, UTILITY_FACTORY, NUM_UTILITIES };
+
+	// 重みのグループ（グループごとに、影響するフィールドが1つに決まる）
+	static enum { GROUP_ACCESSIBILITY = 0, GROUP_NEIGHBOR_POPULATION, GROUP_NEIGHBOR_COMMERCIAL, GROUP_POLLUTION, GROUP_LANDVALUE, GROUP_LIFE, GROUP_SHOP, GROUP_FACTORY, NUM_GROUPS };
+
+public:
+	// アクセシビリティ
+	float highway_accessibility;
+	float avenue_accessibility;
+	float street_accessibility;
+
+	// 周辺人口、周辺商業、汚染度
+	float population_neighbor;
+	float distance_neighbor_population;
+	float commercial_neighbor;
+	float distance_neighbor_commercial;
+	float industrial_pollution;
+	float distance_pollution;
+
+	// 地価の係数（INPUT_LANDVALUEのスロットは常に0）
+	float landvalue[NUM_INPUTS];
+
+	// 効用の係数行列 (9x3)
+	float utility[NUM_INPUTS][NUM_UTILITIES];
+
+public:
+	ZoningParams();
+
+	void compile(const QMap<QString, float>& weights, const float normalization[NUM_INPUTS]);
+
+	unsigned int changedGroups(const ZoningParams& other) const;
+	static unsigned int group(int g) { return 1u << g; }
+	unsigned int landValueInputs() const;
+	unsigned int utilityInputs(int utility) const;
+
+	static const char* inputName(int input);
+	static const char* utilityName(int utility);
+};
@@ -1,10 +1,23 @@
 #include "MainWindow.h"
+#include "ThreadPool.h"
+#include "Trace.h"
 #include <QtGui/QApplication>
+#include <iostream>
 
 int main(int argc, char *argv[])
 {
 	QApplication a(argc, argv);
 	MainWindow w;
 	w.show();
-	return a.exec();
+	int ret = a.exec();
+
+#if ZONING_TRACE
+	QByteArray trace_file = qgetenv("ZONING_TRACE_FILE");
+	if (!trace_file.isEmpty() && !Trace::dump(QString::fromLocal8Bit(trace_file))) {
+		std::cerr << "Warning: " << trace_file.constData() << " could not be created." << std::endl;
+	}
+#endif
+
+	ThreadPool::shutdown();
+	return ret;
 }